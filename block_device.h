@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+// Storage addressed in fixed-size sectors, as seen by FatFS and the MSC host.
+class BlockDevice {
+ public:
+  static constexpr int kSectorSize = 4096;
+  using Sector = std::byte[kSectorSize];
+
+  virtual ~BlockDevice() = default;
+
+  // Size of the sectors the device is addressed in: kSectorSize, unless the
+  // device splits sectors up.
+  virtual int SectorSize() { return kSectorSize; }
+
+  // The returned data is only valid until the next call on this device.
+  virtual std::span<const std::byte> ReadSector(int i) = 0;
+
+  virtual void WriteSector(int i, std::span<const std::byte> payload) = 0;
+
+  virtual std::size_t SectorCount() = 0;
+
+  // The contents of sectors [first, first + count) are no longer needed, and
+  // may read back as anything until they are next written. Devices that can
+  // make use of the hint erase them ahead of time.
+  virtual void Trim(int first, int count) {}
+
+  // Sectors [first, first + count) hold a regular file's contents, which
+  // FatFS doesn't need in order to mount the volume. Devices that make writes
+  // power-fail-atomic may skip doing so for them, until the sectors are
+  // trimmed or cleared.
+  virtual void MarkDataOnly(int first, int count) {}
+
+  // Undoes MarkDataOnly() for sectors [first, first + count), which may now
+  // hold anything.
+  virtual void ClearDataOnly(int first, int count) {}
+
+  // Makes all previous writes durable.
+  virtual void Sync() {}
+};
@@ -1,89 +1,208 @@
 #include "bridge.h"
 
 #include <fmt/core.h>
+#include <pico/time.h>
 
-#include <charconv>
-#include <iomanip>
-#include <ios>
-#include <iostream>
-#include <regex>
-#include <sstream>
-
-namespace {
-int ParseNonce(std::string_view str) {
-  if (str.empty()) {
-    return -1;
-  }
-  int value;
-  const std::from_chars_result result =
-      std::from_chars(str.begin(), str.end(), value);
-  if (result.ptr != str.end()) {
-    throw std::system_error(std::make_error_code(result.ec),
-                            "Corrupted nonce file contents.");
-  }
-  return value;
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "profile.h"
+
+Bridge::Bridge(CaptureSink& capture) : capture_(capture) {}
+
+void Bridge::AddChannel(int number, SerialPort& usb, SerialPort& uart,
+                        Framer framer) {
+  if (number < 0 || number >= Stats::kChannels) {
+    throw std::out_of_range(
+        fmt::format("Channel number {} is out of valid range [0, {})", number,
+                    Stats::kChannels));
+  }
+  channels_.push_back({
+      .number = number,
+      .usb = &usb,
+      .uart = &uart,
+      .stats = &Stats::Global().channels[number],
+      .framer = std::move(framer),
+  });
 }
-}  // namespace
-
-Bridge::Bridge(CdcDevice& usb, uart_inst_t& uart, FileSystem& fs)
-    : usb_(usb), uart_(uart), fs_(fs) {
-  // Use a new nonce for each run, keeping track of the previous nonce in a
-  // file.
-  File nonce_file = fs_.OpenFile(
-      "/nonce.txt", {.read = true, .write = true, .open_always = true});
-  const int previous_nonce = ParseNonce(nonce_file.ReadAll());
-  const int nonce = previous_nonce + 1;
-  std::cout << "Nonce: " << nonce << std::endl;
-  nonce_file.Seek(0);
-  nonce_file.Write(std::to_string(nonce));
+
+void Bridge::SetFramer(int number, Framer framer) {
+  for (Channel& channel : channels_) {
+    if (channel.number == number) {
+      channel.next_framer = std::move(framer);
+    }
+  }
 }
 
-std::string_view Bridge::Name(Device device) {
-  if (device == Device::kUsb) {
-    return "USB";
+void Bridge::SetUsbInputPaused(int number, bool paused) {
+  for (Channel& channel : channels_) {
+    if (channel.number == number) {
+      channel.usb_input_paused = paused;
+    }
+  }
+}
+
+void Bridge::Task() {
+  PROFILE_SCOPE("Bridge::Task");
+  const int count = channels_.size();
+  for (int i = 0; i < count; ++i) {
+    Service(channels_[(next_ + i) % count]);
+  }
+  next_ = count == 0 ? 0 : (next_ + 1) % count;
+}
+
+void Bridge::Service(Channel& channel) {
+  if (const std::optional<UartConfig> config =
+          channel.usb->TakeConfigRequest()) {
+    channel.uart->SetConfig(*config);
+  }
+  if (!channel.usb_input_paused) {
+    Forward(channel, CaptureDirection::kUsbToUart);
+  }
+  if (channel.next_framer) {
+    UpdateFramer(channel);
   }
-  return "UART";
+  std::visit(
+      [&]<typename T>(T& framer) {
+        if constexpr (std::is_same_v<T, std::monostate>) {
+          Forward(channel, CaptureDirection::kUartToUsb);
+        } else {
+          ForwardFrames(channel, framer);
+        }
+      },
+      channel.framer);
 }
 
-std::optional<char> Bridge::Read(Device device) {
-  if (device == Device::kUsb && usb_.ReadAvailable() > 0) {
-    return usb_.ReadChar();
+void Bridge::Forward(Channel& channel, CaptureDirection direction) {
+  const bool from_usb = direction == CaptureDirection::kUsbToUart;
+  SerialPort& source = from_usb ? *channel.usb : *channel.uart;
+  SerialPort& sink = from_usb ? *channel.uart : *channel.usb;
+  // Only take as much as the partner can accept; the rest stays buffered in
+  // the source until the next call.
+  const int limit = std::min(kChunkSize, sink.WriteAvailable());
+  if (!from_usb) {
+    UpdateUsbTxFull(channel, limit == 0);
   }
-  if (device == Device::kUart && uart_is_readable(&uart_)) {
-    return uart_getc(&uart_);
+  std::array<char, kChunkSize> buffer;
+  std::array<TimestampedByte, kChunkSize> stamped;
+  const Chunk chunk = Receive(source, std::span(buffer).first(limit), stamped);
+  if (chunk.data.empty()) {
+    return;
   }
-  return std::nullopt;
+
+  Record(channel.number, direction, chunk);
+  const int written = sink.Write(chunk.data);
+  (from_usb ? channel.stats->usb_to_uart_bytes
+            : channel.stats->uart_to_usb_bytes)
+      .Add(written);
+  // The read was limited to what the sink said it could take, so a short
+  // write means the sink broke that promise; the rest is already gone from
+  // the source.
+  channel.stats->bridge_dropped_bytes.Add(chunk.data.size() - written);
+  // One flush per chunk rather than per byte.
+  sink.Flush();
 }
 
-void Bridge::Write(Device device, char c) {
-  if (device == Device::kUsb) {
-    usb_.WriteChar(c);
-    usb_.Flush();
+template <typename Policy>
+void Bridge::ForwardFrames(Channel& channel, FrameBuffer<Policy>& framer) {
+  SerialPort& source = *channel.uart;
+  SerialPort& sink = *channel.usb;
+  // Reads stop once the framer is full, of frames the host hasn't taken yet
+  // and the partial frame; the UART's own buffering and flow control then
+  // take over while the host is slow. Reads also stop while the framer is
+  // being emptied for a switch to different framing.
+  const int limit =
+      channel.next_framer ? 0 : std::min<int>(kChunkSize, framer.Free());
+  std::array<char, kChunkSize> buffer;
+  std::array<TimestampedByte, kChunkSize> stamped;
+  const Chunk chunk = Receive(source, std::span(buffer).first(limit), stamped);
+  // Taken after the read, so that no timestamp is later than this.
+  const uint64_t now = time_us_64();
+  int frames = 0;
+  if (!chunk.data.empty()) {
+    Record(channel.number, CaptureDirection::kUartToUsb, chunk);
+    frames += framer.Push(chunk.data, chunk.stamped, now);
+  }
+  frames += framer.Poll(now);
+  channel.stats->uart_to_usb_frames.Add(frames);
+
+  const std::span<const char> ready = framer.Ready();
+  if (ready.empty()) {
     return;
   }
-  uart_putc(&uart_, c);
+  const int available = sink.WriteAvailable();
+  UpdateUsbTxFull(channel, available == 0);
+  const int written =
+      sink.Write(ready.first(std::min<std::size_t>(ready.size(), available)));
+  framer.Consume(written);
+  channel.stats->uart_to_usb_bytes.Add(written);
+  // Flushing only once every completed frame is queued keeps frames from
+  // being split across USB transfers, beyond the packets a large frame needs.
+  if (framer.Ready().empty()) {
+    sink.Flush();
+  }
 }
 
-Bridge::Device Bridge::Partner(Device device) {
-  if (device == Device::kUsb) {
-    return Device::kUart;
+void Bridge::UpdateFramer(Channel& channel) {
+  const bool empty = std::visit(
+      [&]<typename T>(T& framer) {
+        if constexpr (std::is_same_v<T, std::monostate>) {
+          return true;
+        } else {
+          // A partial frame would otherwise wait for its idle gap, which
+          // some policies don't have.
+          channel.stats->uart_to_usb_frames.Add(framer.Flush());
+          return framer.Ready().empty();
+        }
+      },
+      channel.framer);
+  if (empty) {
+    channel.framer = std::move(*channel.next_framer);
+    channel.next_framer.reset();
   }
-  return Device::kUsb;
 }
 
-void Bridge::Task() {
-  for (Device device : {Device::kUsb, Device::kUart}) {
-    const std::optional<char> oc = Read(device);
-    if (!oc) {
-      continue;
-    }
-    const char c = *oc;
+void Bridge::UpdateUsbTxFull(Channel& channel, bool full) {
+  if (full && !channel.usb_tx_full) {
+    channel.stats->usb_tx_full.Add();
+  }
+  channel.usb_tx_full = full;
+}
 
-    // Log the transfer
-    std::cout << fmt::format("{} {}: {:#04x}", write_index_, Name(device), c)
-              << std::endl;
-    ++write_index_;
+Bridge::Chunk Bridge::Receive(SerialPort& source, std::span<char> buffer,
+                              std::span<TimestampedByte> stamped) {
+  if (!source.HasRxTimestamps()) {
+    return {.data = source.Read(buffer)};
+  }
+  const std::span<TimestampedByte> entries =
+      source.ReadTimestamped(stamped.first(buffer.size()));
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    buffer[i] = entries[i].byte;
+  }
+  return {.data = buffer.first(entries.size()), .stamped = entries};
+}
 
-    Write(Partner(device), c);
+void Bridge::Record(int channel, CaptureDirection direction,
+                    const Chunk& chunk) {
+  if (chunk.stamped.empty()) {
+    capture_.Record(channel, direction, chunk.data, time_us_64());
+    return;
+  }
+  // One record per run of bytes without an idle gap, each dated by its first
+  // byte's arrival.
+  std::size_t start = 0;
+  for (std::size_t i = 1; i <= chunk.stamped.size(); ++i) {
+    if (i < chunk.stamped.size() &&
+        chunk.stamped[i].time_us - chunk.stamped[i - 1].time_us < kIdleGapUs) {
+      continue;
+    }
+    capture_.Record(channel, direction, chunk.data.subspan(start, i - start),
+                    chunk.stamped[start].time_us);
+    start = i;
   }
 }
@@ -1,33 +1,101 @@
 #pragma once
 
-#include <hardware/uart.h>
-
+#include <cstdint>
 #include <optional>
-#include <string_view>
+#include <span>
+#include <vector>
 
-#include "cdc_device.h"
-#include "fs.h"
+#include "capture_format.h"
+#include "capture_sink.h"
+#include "framer.h"
+#include "serial_port.h"
+#include "stats.h"
+#include "tusb_config.h"
 
+// Moves data between the USB and UART sides of each channel. Only depends on
+// the SerialPort and CaptureSink interfaces, so either side and the capture
+// can be swapped for simulated ones (e.g. to benchmark off-target).
 class Bridge {
  public:
-  Bridge(CdcDevice& usb, uart_inst_t& uart, FileSystem& fs);
+  // Forwarded traffic is also passed to the capture, e.g. a CaptureTrigger in
+  // front of the recorder.
+  explicit Bridge(CaptureSink& capture);
+
+  // The channel number identifies the channel in captures and statistics.
+  // Traffic from the UART is forwarded to USB a frame at a time if a framer is
+  // given; traffic from USB is always forwarded as it arrives.
+  void AddChannel(int number, SerialPort& usb, SerialPort& uart,
+                  Framer framer = {});
+
+  // Switches the channel to the given framing, once the bytes already in its
+  // current framer have been sent on. Does nothing for channels not added.
+  void SetFramer(int number, Framer framer);
+
+  // While paused, the channel's USB input is left in the USB FIFO, e.g. so
+  // that something else can drive the UART. Traffic from the UART is still
+  // forwarded.
+  void SetUsbInputPaused(int number, bool paused);
 
+  // Services every channel once, round-robin. Each channel moves at most one
+  // chunk per direction per call, so a saturated channel can't starve the
+  // others, and the starting channel rotates so that none is always first in
+  // line for the shared capture buffers.
   void Task();
 
  private:
-  enum class Device {
-    kUsb,
-    kUart,
+  // Maximum number of bytes moved in one direction per call to Task(). Matches
+  // the CDC FIFO size so that a full chunk is sent as a single USB packet.
+  static constexpr int kChunkSize = CFG_TUD_CDC_TX_BUFSIZE;
+
+  // For ports that timestamp received bytes, a silence at least this long
+  // starts a new capture record, so that it shows up in the capture. This is
+  // Modbus RTU's fixed minimum inter-frame gap for rates above 19200 baud.
+  static constexpr uint64_t kIdleGapUs = 1750;
+
+  struct Channel {
+    int number;
+    SerialPort* usb;
+    SerialPort* uart;
+    ChannelStats* stats;
+    Framer framer;
+    // Framing to switch to once framer is empty.
+    std::optional<Framer> next_framer;
+    bool usb_tx_full = false;
+    bool usb_input_paused = false;
   };
 
-  std::string_view Name(Device device);
-  std::optional<char> Read(Device device);
-  void Write(Device device, char c);
-  Device Partner(Device device);
+  // Data read from a port, with arrival times if the port provides them.
+  struct Chunk {
+    std::span<char> data;
+    std::span<TimestampedByte> stamped;
+  };
+
+  void Service(Channel& channel);
+
+  // Switches to next_framer if the current framer has sent everything.
+  void UpdateFramer(Channel& channel);
+
+  // Moves one chunk in the given direction as it arrived.
+  void Forward(Channel& channel, CaptureDirection direction);
+
+  // Moves data from the UART into the framer, and completed frames from the
+  // framer to USB.
+  template <typename Policy>
+  void ForwardFrames(Channel& channel, FrameBuffer<Policy>& framer);
+
+  void UpdateUsbTxFull(Channel& channel, bool full);
+
+  // Reads into buffer, and for ports that timestamp bytes, also the matching
+  // prefix of stamped.
+  Chunk Receive(SerialPort& source, std::span<char> buffer,
+                std::span<TimestampedByte> stamped);
 
-  CdcDevice& usb_;
-  uart_inst_t& uart_;
-  FileSystem& fs_;
+  // Records a chunk in the capture. Timestamped chunks become one record per
+  // run of bytes without an idle gap, each dated by its first byte's arrival.
+  void Record(int channel, CaptureDirection direction, const Chunk& chunk);
 
-  int write_index_ = 0;
+  CaptureSink& capture_;
+  std::vector<Channel> channels_;
+  // Channel serviced first by the next call to Task().
+  int next_ = 0;
 };
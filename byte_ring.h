@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+
+// Power-of-two byte ring buffer tracked by free-running 32-bit head (total
+// bytes written) and tail (total bytes read) positions. Only the low bits of a
+// position index into the storage, and the storage is aligned to its own size,
+// so either side can be a DMA channel running in address-wrap mode: the DMA
+// side just reports its new position with SetHead() or SetTail().
+//
+// The storage is allocated on its own. Next to the positions, its alignment
+// would pad the ring out to twice its size.
+//
+// Safe for one producer and one consumer running in different contexts (e.g.
+// an interrupt handler and the main loop).
+template <std::size_t kSize>
+class ByteRing {
+ public:
+  static_assert(std::has_single_bit(kSize), "Ring size must be a power of 2.");
+  static constexpr int kSizeBits = std::countr_zero(kSize);
+
+  // Number of bytes written but not yet read. May exceed the ring size if a
+  // DMA producer has lapped the consumer.
+  std::size_t Size() const { return Head() - Tail(); }
+
+  std::size_t Free() const { return kSize - std::min(Size(), kSize); }
+
+  uint32_t Head() const { return head_.load(std::memory_order_acquire); }
+  uint32_t Tail() const { return tail_.load(std::memory_order_acquire); }
+
+  void SetHead(uint32_t head) { head_.store(head, std::memory_order_release); }
+  void SetTail(uint32_t tail) { tail_.store(tail, std::memory_order_release); }
+
+  // Address of the byte at the given free-running position.
+  char* At(uint32_t position) {
+    return &storage_->bytes[position & (kSize - 1)];
+  }
+
+  // Number of bytes from the given position to the end of the storage.
+  std::size_t ContiguousFrom(uint32_t position) {
+    return kSize - (position & (kSize - 1));
+  }
+
+  // Copies as much of the input as fits. Returns the number of bytes written.
+  std::size_t Write(std::span<const char> data) {
+    const uint32_t head = Head();
+    const std::size_t size = std::min(data.size(), Free());
+    const std::size_t first = std::min(size, ContiguousFrom(head));
+    std::memcpy(At(head), data.data(), first);
+    std::memcpy(At(head + first), data.data() + first, size - first);
+    SetHead(head + size);
+    return size;
+  }
+
+  // Returns the subspan of the input buffer that was actually read into.
+  //
+  // If the producer has overwritten data that was never read, the oldest
+  // bytes are skipped and counted in Overruns().
+  std::span<char> Read(std::span<char> buffer) {
+    const uint32_t head = Head();
+    uint32_t tail = Tail();
+    if (head - tail > kSize) {
+      overruns_ += head - tail - kSize;
+      tail = head - kSize;
+    }
+    const std::size_t size = std::min<std::size_t>(buffer.size(), head - tail);
+    const std::size_t first = std::min(size, ContiguousFrom(tail));
+    std::memcpy(buffer.data(), At(tail), first);
+    std::memcpy(buffer.data() + first, At(tail + first), size - first);
+    SetTail(tail + size);
+    return buffer.first(size);
+  }
+
+  // Total number of bytes lost to the producer lapping the consumer.
+  uint32_t Overruns() const { return overruns_; }
+
+ private:
+  struct alignas(kSize) Storage {
+    std::array<char, kSize> bytes;
+  };
+
+  std::unique_ptr<Storage> storage_ = std::make_unique<Storage>();
+  std::atomic<uint32_t> head_ = 0;
+  std::atomic<uint32_t> tail_ = 0;
+  uint32_t overruns_ = 0;
+};
@@ -0,0 +1,168 @@
+#include "capture.h"
+
+#include <fmt/core.h>
+#include <pico/time.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#include "logging.h"
+
+namespace {
+int ParseNonce(std::string_view str) {
+  if (str.empty()) {
+    return -1;
+  }
+  int value;
+  const std::from_chars_result result =
+      std::from_chars(str.begin(), str.end(), value);
+  if (result.ptr != str.end()) {
+    throw std::system_error(std::make_error_code(result.ec),
+                            "Corrupted nonce file contents.");
+  }
+  return value;
+}
+
+// Use a new nonce for each run, keeping track of the previous nonce in a file.
+int NextNonce(FileSystem& fs) {
+  File nonce_file = fs.OpenFile(
+      "/nonce.txt", {.read = true, .write = true, .open_always = true});
+  const int previous_nonce = ParseNonce(nonce_file.ReadAll());
+  const int nonce = previous_nonce + 1;
+  Log("Nonce: {}", nonce);
+  nonce_file.Seek(0);
+  nonce_file.Write(std::to_string(nonce));
+  return nonce;
+}
+}  // namespace
+
+CaptureRecorder::CaptureRecorder(FileSystem& fs)
+    : fs_(fs), buffers_(std::make_unique<std::array<Buffer, 2>>()) {
+  Start();
+  last_record_time_ = last_sync_time_ = time_us_64();
+}
+
+void CaptureRecorder::Record(int channel, CaptureDirection direction,
+                             std::span<const char> data) {
+  Record(channel, direction, data, time_us_64());
+}
+
+void CaptureRecorder::Record(int channel, CaptureDirection direction,
+                             std::span<const char> data, uint64_t time_us) {
+  const uint64_t now = std::max(time_us, last_record_time_);
+  const CaptureHeader header = {
+      .direction = direction,
+      .channel = static_cast<uint8_t>(channel),
+      .delta_us = now - last_record_time_,
+      .length = static_cast<uint32_t>(data.size()),
+  };
+  std::array<std::byte, CaptureHeader::kMaxSize> header_bytes;
+  const std::size_t header_size = header.Encode(header_bytes);
+  if (header_size + data.size() > StagingFree()) {
+    dropped_bytes_ += data.size();
+    return;
+  }
+  last_record_time_ = now;
+  Stage(std::span(header_bytes).first(header_size));
+  Stage(std::as_bytes(data));
+}
+
+void CaptureRecorder::Task() {
+  Buffer& active = (*buffers_)[active_];
+  if (!pending_ && active.size == active.data.size()) {
+    Rotate();
+  }
+  if (pending_) {
+    // The file position is always sector-aligned here, so FatFS writes this
+    // straight through as a single sector.
+    file_.Write((*buffers_)[active_ ^ 1].data);
+    pending_ = false;
+    unsynced_ = true;
+  }
+
+  const uint64_t now = time_us_64();
+  if (now - last_sync_time_ < kSyncIntervalUs) {
+    return;
+  }
+  last_sync_time_ = now;
+  Buffer& partial = (*buffers_)[active_];
+  if (partial.size == synced_size_ && !unsynced_) {
+    return;
+  }
+  // Persist the partial buffer too, then rewind so that once it fills up it
+  // still gets written as one whole sector.
+  const int position = file_.Tell();
+  file_.Write(std::span(partial.data).first(partial.size));
+  file_.Sync();
+  file_.Seek(position);
+  synced_size_ = partial.size;
+  unsynced_ = false;
+}
+
+void CaptureRecorder::Reopen() {
+  // The old handle refers to the previous mount and can't be closed cleanly;
+  // it only needs to remember the file position.
+  const int position = file_.Tell();
+  try {
+    file_ = fs_.OpenFile(path_, {.write = true, .open_existing = true});
+  } catch (const std::filesystem::filesystem_error& e) {
+    // The host deleted or renamed the file or its directory. The staged
+    // records continue the old file, so they go too.
+    Log("Reopening {} failed, discarding {} staged bytes: {}", path_,
+        (*buffers_)[0].size + (*buffers_)[1].size, e.what());
+    for (Buffer& buffer : *buffers_) {
+      buffer.size = 0;
+    }
+    pending_ = false;
+    synced_size_ = 0;
+    unsynced_ = false;
+    Start();
+    return;
+  }
+  file_.Seek(position);
+  // Whatever was synced before may have been discarded along with the old
+  // mount, so sync everything again.
+  synced_size_ = 0;
+  unsynced_ = true;
+}
+
+void CaptureRecorder::Start() {
+  const int nonce = NextNonce(fs_);
+  fs_.CreateDirectory("/captures");
+  path_ = fmt::format("/captures/{:08}.bin", nonce);
+  file_ = fs_.OpenFile(path_, {.write = true, .create_always = true});
+  Log("Capturing to {}", path_);
+
+  Stage(std::as_bytes(std::span(kCaptureMagic)));
+}
+
+std::size_t CaptureRecorder::StagingFree() {
+  const Buffer& active = (*buffers_)[active_];
+  return (active.data.size() - active.size) +
+         (pending_ ? 0 : BlockDevice::kSectorSize);
+}
+
+void CaptureRecorder::Stage(std::span<const std::byte> data) {
+  while (!data.empty()) {
+    Buffer& buffer = (*buffers_)[active_];
+    if (buffer.size == buffer.data.size()) {
+      Rotate();
+      continue;
+    }
+    const std::size_t size =
+        std::min(data.size(), buffer.data.size() - buffer.size);
+    std::memcpy(buffer.data.data() + buffer.size, data.data(), size);
+    buffer.size += size;
+    data = data.subspan(size);
+  }
+}
+
+void CaptureRecorder::Rotate() {
+  pending_ = true;
+  active_ ^= 1;
+  (*buffers_)[active_].size = 0;
+  synced_size_ = 0;
+}
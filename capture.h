@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+#include "block_device.h"
+#include "capture_format.h"
+#include "capture_sink.h"
+#include "fs.h"
+
+// Records bridged traffic into a binary capture file (see capture_format.h)
+// under /captures/, named after a nonce that is bumped on every boot.
+//
+// Record() only copies into RAM staging buffers. Task() writes out full
+// sector-sized buffers and periodically syncs, so slow flash operations never
+// happen on the bridging path.
+class CaptureRecorder : public CaptureSink {
+ public:
+  // Upper bound on how much captured traffic a reset can lose.
+  static constexpr uint64_t kSyncIntervalUs = 2'000'000;
+
+  CaptureRecorder(FileSystem& fs);
+
+  // Stages a record of the given channel's traffic. If there is no room
+  // because the staging buffers have not been written out yet, the record is
+  // dropped and counted in DroppedBytes().
+  void Record(int channel, CaptureDirection direction,
+              std::span<const char> data);
+
+  // Same, for traffic that happened at the given time_us_64() time. Records
+  // are stored in call order, so a time before the previous record's is
+  // clamped to it.
+  void Record(int channel, CaptureDirection direction,
+              std::span<const char> data, uint64_t time_us) override;
+
+  // Writes out at most one full staging buffer, and syncs any partial buffer
+  // if the sync interval has elapsed.
+  void Task();
+
+  // Opens the capture file again after the filesystem was remounted, picking
+  // up where the old handle left off. If the host deleted or renamed it,
+  // starts a new capture file instead, dropping the staged records.
+  void Reopen();
+
+  const std::string& Path() { return path_; }
+
+  uint32_t DroppedBytes() { return dropped_bytes_; }
+
+ private:
+  struct Buffer {
+    std::array<std::byte, BlockDevice::kSectorSize> data;
+    std::size_t size = 0;
+  };
+
+  // Creates a new capture file under the next nonce, and stages its magic.
+  void Start();
+
+  std::size_t StagingFree();
+
+  // Caller must ensure the data fits in StagingFree().
+  void Stage(std::span<const std::byte> data);
+
+  // Hands the active buffer off to be written out and starts filling the
+  // other one.
+  void Rotate();
+
+  FileSystem& fs_;
+  File file_;
+  std::string path_;
+
+  std::unique_ptr<std::array<Buffer, 2>> buffers_;
+  // Index of the buffer being filled.
+  int active_ = 0;
+  // Whether the other buffer is full and waiting to be written out.
+  bool pending_ = false;
+  // Size of the active buffer when it was last synced to the file.
+  std::size_t synced_size_ = 0;
+  bool unsynced_ = false;
+
+  uint64_t last_record_time_;
+  uint64_t last_sync_time_;
+  uint32_t dropped_bytes_ = 0;
+};
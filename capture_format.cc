@@ -0,0 +1,62 @@
+#include "capture_format.h"
+
+namespace {
+std::size_t EncodeVarint(uint64_t value, std::span<std::byte> out) {
+  std::size_t size = 0;
+  do {
+    std::byte b{static_cast<uint8_t>(value & 0x7F)};
+    value >>= 7;
+    if (value != 0) {
+      b |= std::byte{0x80};
+    }
+    out[size++] = b;
+  } while (value != 0);
+  return size;
+}
+
+std::optional<uint64_t> DecodeVarint(std::span<const std::byte>& input) {
+  uint64_t value = 0;
+  for (std::size_t i = 0; i < input.size() && i < 10; ++i) {
+    const auto b = std::to_integer<uint64_t>(input[i]);
+    value |= (b & 0x7F) << (7 * i);
+    if ((b & 0x80) == 0) {
+      input = input.subspan(i + 1);
+      return value;
+    }
+  }
+  return std::nullopt;
+}
+}  // namespace
+
+std::size_t CaptureHeader::Encode(std::span<std::byte, kMaxSize> out) const {
+  out[0] = std::byte{static_cast<uint8_t>(
+      (static_cast<uint8_t>(direction) << 7) | (channel & 0x7F))};
+  std::size_t size = 1;
+  size += EncodeVarint(delta_us, std::span(out).subspan(size));
+  size += EncodeVarint(length, std::span(out).subspan(size));
+  return size;
+}
+
+std::optional<CaptureHeader> CaptureHeader::Decode(
+    std::span<const std::byte>& input) {
+  if (input.empty()) {
+    return std::nullopt;
+  }
+  std::span<const std::byte> rest = input.subspan(1);
+  const std::optional<uint64_t> delta_us = DecodeVarint(rest);
+  if (!delta_us) {
+    return std::nullopt;
+  }
+  const std::optional<uint64_t> length = DecodeVarint(rest);
+  if (!length) {
+    return std::nullopt;
+  }
+  const auto tag = std::to_integer<uint8_t>(input[0]);
+  input = rest;
+  return CaptureHeader{
+      .direction = static_cast<CaptureDirection>(tag >> 7),
+      .channel = static_cast<uint8_t>(tag & 0x7F),
+      .delta_us = *delta_us,
+      .length = static_cast<uint32_t>(*length),
+  };
+}
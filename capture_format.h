@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+
+// Binary traffic capture format.
+//
+// A capture file starts with kCaptureMagic, followed by back-to-back records.
+// Each record is a CaptureHeader followed by `length` payload bytes:
+//
+//   tag     1 byte   bit 7: CaptureDirection, bits 0-6: channel number
+//   delta   varint   microseconds since the previous record, or since the
+//                    start of the capture for the first one
+//   length  varint   payload size in bytes
+//
+// Varints are unsigned LEB128, so a typical record costs 3 bytes of overhead.
+
+inline constexpr std::string_view kCaptureMagic = "RS232CP1";
+
+enum class CaptureDirection : uint8_t {
+  kUsbToUart = 0,
+  kUartToUsb = 1,
+};
+
+struct CaptureHeader {
+  // Tag byte plus two maximum-length varints.
+  static constexpr std::size_t kMaxSize = 1 + 10 + 5;
+
+  CaptureDirection direction;
+  uint8_t channel = 0;
+  uint64_t delta_us = 0;
+  uint32_t length = 0;
+
+  // Returns the number of bytes written to the front of the output.
+  std::size_t Encode(std::span<std::byte, kMaxSize> out) const;
+
+  // Decodes a header from the front of the input and advances the input past
+  // it. Returns nullopt, leaving the input untouched, if the input ends before
+  // the header does.
+  static std::optional<CaptureHeader> Decode(std::span<const std::byte>& input);
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "capture_format.h"
+
+// Destination for bridged traffic: the capture recorder itself, or a filter in
+// front of it such as the trigger. Lets the bridge run without a filesystem,
+// e.g. in host benchmarks.
+class CaptureSink {
+ public:
+  virtual ~CaptureSink() = default;
+
+  // Takes a copy of traffic on the given channel that happened at the given
+  // time_us_64() time. Must not block.
+  virtual void Record(int channel, CaptureDirection direction,
+                      std::span<const char> data, uint64_t time_us) = 0;
+};
@@ -0,0 +1,25 @@
+#include "cdc_device.h"
+
+#include <hardware/clocks.h>
+#include <hardware/sync.h>
+
+#include "logging.h"
+
+std::optional<UartConfig> CdcDevice::TakeConfigRequest() {
+  if (!line_coding_changed_) {
+    return std::nullopt;
+  }
+  // The callback runs from the TinyUSB timer interrupt.
+  const uint32_t interrupts = save_and_disable_interrupts();
+  const cdc_line_coding_t coding = line_coding_;
+  line_coding_changed_ = false;
+  restore_interrupts(interrupts);
+
+  const std::optional<UartConfig> config = UartConfig::FromLineCoding(
+      coding.bit_rate, coding.stop_bits, coding.parity, coding.data_bits,
+      clock_get_hz(clk_peri));
+  if (!config) {
+    Log("Unsupported line coding; keeping UART settings.");
+  }
+  return config;
+}
@@ -2,7 +2,12 @@
 
 #include <tusb.h>
 
-class CdcDevice {
+#include <optional>
+#include <span>
+
+#include "serial_port.h"
+
+class CdcDevice : public SerialPort {
  public:
   CdcDevice(uint8_t id) : id_(id) {}
 
@@ -12,10 +17,34 @@ class CdcDevice {
 
   char ReadChar() { return tud_cdc_n_read_char(id_); }
 
+  std::span<char> Read(std::span<char> buffer) override {
+    return buffer.first(tud_cdc_n_read(id_, buffer.data(), buffer.size()));
+  }
+
+  // Number of bytes that can be written before the TX FIFO is full.
+  int WriteAvailable() override { return tud_cdc_n_write_available(id_); }
+
   void WriteChar(char c) { tud_cdc_n_write_char(id_, c); }
 
-  void Flush() { tud_cdc_n_write_flush(id_); }
+  int Write(std::span<const char> data) override {
+    return tud_cdc_n_write(id_, data.data(), data.size());
+  }
+
+  void Flush() override { tud_cdc_n_write_flush(id_); }
+
+  // Called from the TinyUSB line coding callback.
+  void SetLineCoding(const cdc_line_coding_t& coding) {
+    line_coding_ = coding;
+    line_coding_changed_ = true;
+  }
+
+  // Maps the host's line coding onto the UART. Codings the UART can't
+  // produce are logged and ignored.
+  std::optional<UartConfig> TakeConfigRequest() override;
 
  private:
   const uint8_t id_;
+
+  cdc_line_coding_t line_coding_;
+  volatile bool line_coding_changed_ = false;
 };
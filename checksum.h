@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+// FNV-1a.
+inline uint32_t Checksum(std::span<const std::byte> data) {
+  uint32_t hash = 2166136261;
+  for (std::byte b : data) {
+    hash = (hash ^ std::to_integer<uint32_t>(b)) * 16777619;
+  }
+  return hash;
+}
+
+// Checksum of the fields of an on-flash record that come before its
+// `checksum` field.
+uint32_t RecordChecksum(const auto& record) {
+  return Checksum(std::as_bytes(std::span(&record, 1))
+                      .first(offsetof(std::remove_cvref_t<decltype(record)>,
+                                      checksum)));
+}
@@ -0,0 +1,70 @@
+#include "core1_uart.h"
+
+#include <pico/multicore.h>
+
+#include <algorithm>
+#include <array>
+
+#include "uart.h"
+
+namespace {
+Core1Uart* g_core1_uart;
+}  // namespace
+
+Core1Uart::Core1Uart(uart_inst_t& uart, int baud_rate, ChannelStats& stats,
+                     FlowControl flow_control)
+    : uart_(uart),
+      baud_rate_(baud_rate),
+      stats_(stats),
+      flow_control_(flow_control) {
+  g_core1_uart = this;
+  multicore_launch_core1(&Core1Uart::Core1Main);
+}
+
+void Core1Uart::Core1Main() {
+  Core1Uart& self = *g_core1_uart;
+  // Lets core0 pause this core while it writes to flash, since this loop
+  // executes from flash. The DMA channels keep running in the meantime.
+  multicore_lockout_victim_init();
+
+  Uart uart(self.uart_, self.baud_rate_, self.stats_, self.flow_control_);
+  std::array<char, 64> buffer;
+  while (true) {
+    const std::size_t rx_limit =
+        std::min(buffer.size(), self.from_uart_.Free());
+    const std::span<char> rx = uart.Read(std::span(buffer).first(rx_limit));
+    self.from_uart_.Push(rx);
+
+    const std::size_t tx_limit =
+        std::min<std::size_t>(buffer.size(), uart.WriteAvailable());
+    const std::span<char> tx =
+        self.to_uart_.Pop(std::span(buffer).first(tx_limit));
+    uart.Write(tx);
+
+    if (self.to_uart_.Size() == 0) {
+      UartConfig config;
+      if (!self.configs_.Pop(std::span(&config, 1)).empty()) {
+        uart.SetConfig(config);
+      }
+    }
+  }
+}
+
+std::span<char> Core1Uart::Read(std::span<char> buffer) {
+  return from_uart_.Pop(buffer);
+}
+
+int Core1Uart::WriteAvailable() {
+  if (configs_.Free() < kConfigQueueSize) {
+    return 0;
+  }
+  return to_uart_.Free();
+}
+
+int Core1Uart::Write(std::span<const char> data) {
+  return to_uart_.Push(data);
+}
+
+void Core1Uart::SetConfig(const UartConfig& config) {
+  configs_.Push(std::span(&config, 1));
+}
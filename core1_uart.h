@@ -0,0 +1,49 @@
+#pragma once
+
+#include <hardware/uart.h>
+
+#include <span>
+
+#include "serial_port.h"
+#include "spsc_queue.h"
+#include "stats.h"
+
+// Runs a DMA-serviced Uart on core1, and exposes it to core0 as a SerialPort.
+// Data crosses between the cores through a pair of SPSC queues, so UART
+// servicing never waits on TinyUSB, FatFS or console output on core0.
+//
+// Only one instance may exist, since it takes over core1.
+class Core1Uart : public SerialPort {
+ public:
+  // About 40ms of traffic at 1 Mbaud in each direction.
+  static constexpr std::size_t kQueueSize = 4096;
+
+  // Launches core1, which initializes the UART so that its DMA interrupts are
+  // also handled there.
+  Core1Uart(uart_inst_t& uart, int baud_rate, ChannelStats& stats,
+            FlowControl flow_control = FlowControl::kNone);
+
+  // SerialPort implementation; must only be called from core0.
+  std::span<char> Read(std::span<char> buffer) override;
+  int WriteAvailable() override;
+  int Write(std::span<const char> data) override;
+  void SetConfig(const UartConfig& config) override;
+
+ private:
+  static void Core1Main();
+
+  uart_inst_t& uart_;
+  const int baud_rate_;
+  ChannelStats& stats_;
+  const FlowControl flow_control_;
+
+  // Produced by core1, consumed by core0.
+  SpscQueue<char, kQueueSize> from_uart_;
+  // Produced by core0, consumed by core1.
+  SpscQueue<char, kQueueSize> to_uart_;
+  // Config changes, produced by core0 and consumed by core1. Core0 stops
+  // writing while one is queued, so that core1 can hand it over to the Uart
+  // between the data sent before and after it.
+  static constexpr std::size_t kConfigQueueSize = 4;
+  SpscQueue<UartConfig, kConfigQueueSize> configs_;
+};
@@ -0,0 +1,134 @@
+#include "dma_stream.h"
+
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+
+#include <array>
+
+namespace {
+// Indexed by TX DMA channel; used to route the shared DMA interrupts.
+std::array<DmaStream*, NUM_DMA_CHANNELS> g_streams = {};
+// Whether each core has installed its DMA interrupt handler.
+std::array<bool, 2> g_irq_installed = {};
+}  // namespace
+
+DmaStream::DmaStream(const volatile void* rx_source, unsigned rx_dreq,
+                     volatile void* tx_dest, unsigned tx_dreq)
+    : irq_index_(get_core_num()),
+      rx_channel_(rx_source ? dma_claim_unused_channel(true) : -1),
+      tx_channel_(dma_claim_unused_channel(true)) {
+  if (rx_channel_ >= 0) {
+    // RX: peripheral FIFO into the ring, wrapping the write address.
+    dma_channel_config rx_config = dma_channel_get_default_config(rx_channel_);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx_config, false);
+    channel_config_set_write_increment(&rx_config, true);
+    channel_config_set_ring(&rx_config, true, RxRing::kSizeBits);
+    channel_config_set_dreq(&rx_config, rx_dreq);
+    dma_channel_configure(rx_channel_, &rx_config, rx_.At(0), rx_source,
+                          kRxTransferCount, false);
+  }
+
+  // TX: ring into the peripheral FIFO, wrapping the read address. Each
+  // transfer covers everything queued when it starts, wrap-around included.
+  dma_channel_config tx_config = dma_channel_get_default_config(tx_channel_);
+  channel_config_set_transfer_data_size(&tx_config, DMA_SIZE_8);
+  channel_config_set_read_increment(&tx_config, true);
+  channel_config_set_write_increment(&tx_config, false);
+  channel_config_set_ring(&tx_config, false, TxRing::kSizeBits);
+  channel_config_set_dreq(&tx_config, tx_dreq);
+  dma_channel_configure(tx_channel_, &tx_config, tx_dest, tx_.At(0), 0,
+                        false);
+
+  g_streams[tx_channel_] = this;
+  if (!g_irq_installed[irq_index_]) {
+    const unsigned irq = irq_index_ == 0 ? DMA_IRQ_0 : DMA_IRQ_1;
+    irq_add_shared_handler(irq, &DmaStream::HandleDmaIrq,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(irq, true);
+    g_irq_installed[irq_index_] = true;
+  }
+  dma_irqn_set_channel_enabled(irq_index_, tx_channel_, true);
+  if (rx_channel_ >= 0) {
+    dma_irqn_set_channel_enabled(irq_index_, rx_channel_, true);
+    dma_channel_set_trans_count(rx_channel_, kRxTransferCount, true);
+  }
+}
+
+DmaStream::~DmaStream() {
+  for (int channel : {rx_channel_, tx_channel_}) {
+    if (channel < 0) {
+      continue;
+    }
+    dma_irqn_set_channel_enabled(irq_index_, channel, false);
+    dma_channel_abort(channel);
+    dma_channel_unclaim(channel);
+  }
+  g_streams[tx_channel_] = nullptr;
+}
+
+void DmaStream::HandleDmaIrq() {
+  const unsigned irq_index = get_core_num();
+  for (DmaStream* stream : g_streams) {
+    if (stream == nullptr || stream->irq_index_ != irq_index) {
+      continue;
+    }
+    if (stream->rx_channel_ >= 0 &&
+        dma_irqn_get_channel_status(irq_index, stream->rx_channel_)) {
+      dma_irqn_acknowledge_channel(irq_index, stream->rx_channel_);
+      // The write address has wrapped back to the start of the ring; keep
+      // going from there.
+      stream->rx_completed_ = stream->rx_completed_ + kRxTransferCount;
+      dma_channel_set_trans_count(stream->rx_channel_, kRxTransferCount, true);
+    }
+    if (dma_irqn_get_channel_status(irq_index, stream->tx_channel_)) {
+      dma_irqn_acknowledge_channel(irq_index, stream->tx_channel_);
+      stream->ServiceTx();
+    }
+  }
+}
+
+void DmaStream::UpdateRxHead() {
+  if (rx_channel_ < 0) {
+    return;
+  }
+  const auto interrupts = save_and_disable_interrupts();
+  const uint32_t remaining = dma_hw->ch[rx_channel_].transfer_count;
+  rx_.SetHead(rx_completed_ + (kRxTransferCount - remaining));
+  restore_interrupts(interrupts);
+}
+
+std::span<char> DmaStream::Read(std::span<char> buffer) {
+  UpdateRxHead();
+  return rx_.Read(buffer);
+}
+
+std::size_t DmaStream::RxSize() {
+  UpdateRxHead();
+  return rx_.Size();
+}
+
+int DmaStream::Write(std::span<const char> data) {
+  const int written = tx_.Write(data);
+  const auto interrupts = save_and_disable_interrupts();
+  ServiceTx();
+  restore_interrupts(interrupts);
+  return written;
+}
+
+bool DmaStream::TxIdle() {
+  return tx_.Size() == 0 && !dma_channel_is_busy(tx_channel_);
+}
+
+void DmaStream::ServiceTx() {
+  if (dma_channel_is_busy(tx_channel_)) {
+    return;
+  }
+  tx_.SetTail(tx_.Tail() + tx_in_flight_);
+  tx_in_flight_ = tx_.Size();
+  if (tx_in_flight_ > 0) {
+    dma_channel_transfer_from_buffer_now(tx_channel_, tx_.At(tx_.Tail()),
+                                         tx_in_flight_);
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "byte_ring.h"
+
+// Byte stream between a peripheral's FIFOs and RAM ring buffers, serviced by
+// a pair of DMA channels: RX runs continuously into a ring in write-wrap mode,
+// and TX sends whatever has been queued in read-wrap mode. Shared by the
+// hardware and PIO UARTs.
+//
+// The DMA interrupt is handled on the core that constructed the stream, which
+// must also be the only core using it.
+class DmaStream {
+ public:
+  // Enough for ~40ms of traffic at 1 Mbaud, which covers a flash sector erase.
+  static constexpr std::size_t kRxRingSize = 4096;
+  static constexpr std::size_t kTxRingSize = 1024;
+
+  // rx_source and tx_dest are the peripheral's FIFO registers, read and
+  // written a byte at a time as paced by the given DREQs. Claims two DMA
+  // channels, or only one for TX if rx_source is null, in which case nothing
+  // is ever received.
+  DmaStream(const volatile void* rx_source, unsigned rx_dreq,
+            volatile void* tx_dest, unsigned tx_dreq);
+  ~DmaStream();
+
+  DmaStream(const DmaStream&) = delete;
+  DmaStream& operator=(const DmaStream&) = delete;
+
+  // Returns the subspan of the input buffer that was actually read into.
+  std::span<char> Read(std::span<char> buffer);
+
+  // Number of received bytes not yet read, as of the last Read() or RxSize().
+  std::size_t RxSize();
+
+  // Number of received bytes lost because the RX ring was full.
+  uint32_t RxOverruns() { return rx_.Overruns(); }
+
+  int WriteAvailable() { return tx_.Free(); }
+
+  // Queues data for transmission. Returns the number of bytes actually queued.
+  int Write(std::span<const char> data);
+
+  // Number of bytes queued or in flight.
+  std::size_t TxSize() { return tx_.Size(); }
+
+  // Whether every queued byte has been handed to the peripheral. It may still
+  // be holding some in its own FIFO.
+  bool TxIdle();
+
+ private:
+  using RxRing = ByteRing<kRxRingSize>;
+  using TxRing = ByteRing<kTxRingSize>;
+
+  // RX DMA transfers run for this many bytes before the channel has to be
+  // re-triggered. A multiple of the ring size, so that each run ends exactly
+  // where the next one starts.
+  static constexpr uint32_t kRxTransferCount = 1u << 30;
+
+  static void HandleDmaIrq();
+
+  // Publishes the number of bytes the RX DMA channel has written so far.
+  void UpdateRxHead();
+
+  // Retires the TX transfer in flight, if finished, and starts the next one.
+  // Must be called with the DMA IRQ masked.
+  void ServiceTx();
+
+  // DMA_IRQ_0 on core0 and DMA_IRQ_1 on core1.
+  const unsigned irq_index_;
+  // -1 without RX.
+  const int rx_channel_;
+  const int tx_channel_;
+
+  RxRing rx_;
+  TxRing tx_;
+
+  // Bytes written by all completed RX DMA runs.
+  volatile uint32_t rx_completed_ = 0;
+  // Size of the TX DMA transfer in flight.
+  volatile uint32_t tx_in_flight_ = 0;
+};
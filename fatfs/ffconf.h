@@ -193,8 +193,13 @@
 /  function will be available. */
 
 
+#if RS232_SMALL_SECTORS
+#define FF_MIN_SS		512
+#define FF_MAX_SS		512
+#else
 #define FF_MIN_SS		4096
 #define FF_MAX_SS		4096
+#endif
 /* This set of options configures the range of sector size to be supported. (512,
 /  1024, 2048 or 4096) Always set both 512 for most systems, generic memory card and
 /  harddisk, but a larger value may be required for on-board flash memory and some
@@ -213,7 +218,7 @@
 /  f_fdisk function. 0x100000000 max. This option has no effect when FF_LBA64 == 0. */
 
 
-#define FF_USE_TRIM		0
+#define FF_USE_TRIM		1
 /* This option switches support for ATA-TRIM. (0:Disable or 1:Enable)
 /  To enable Trim function, also CTRL_TRIM command should be implemented to the
 /  disk_ioctl() function. */
@@ -1,67 +1,191 @@
 #include "flash.h"
 
 #include <fmt/core.h>
+#if PICO_ON_DEVICE
 #include <hardware/flash.h>
 #include <hardware/sync.h>
+#include <pico/time.h>
+#endif
+#if RS232_DUAL_CORE
+#include <pico/multicore.h>
+#endif
 
 #include <algorithm>
+#include <cstring>
+#include <memory>
 #include <stdexcept>
 
+#include "profile.h"
+#include "stats.h"
+
 namespace {
+#if PICO_ON_DEVICE
+// Flash must be erased on sector boundaries.
+static_assert(FlashDisk::kSectorSize == FLASH_SECTOR_SIZE);
+static_assert(FlashDisk::kPageSize == FLASH_PAGE_SIZE);
+
 const auto flash =
     std::span(reinterpret_cast<const FlashDisk::Sector*>(XIP_BASE),
               PICO_FLASH_SIZE_BYTES / FlashDisk::kSectorSize);
+
+// Runs a flash operation with nothing else executing from flash.
+template <typename Operation>
+void RunExclusive(Operation operation) {
+#if RS232_DUAL_CORE
+  // Core1 executes from flash, so it must be parked while flash is busy.
+  multicore_lockout_start_blocking();
+#endif
+  const auto interrupts = save_and_disable_interrupts();
+  operation();
+  restore_interrupts(interrupts);
+#if RS232_DUAL_CORE
+  multicore_lockout_end_blocking();
+#endif
+}
+#endif
+
+struct PageComparison {
+  bool changed;
+  // Some bit goes from 0 to 1, which only an erase can do.
+  bool needs_erase;
+  // The new contents are all 1s, as left by an erase.
+  bool blank;
+};
+
+// Flash is always word-aligned; the payload is at least kSrcAlignment-aligned,
+// which lets the loads below compile to whole-word loads when it is 4.
+template <std::size_t kSrcAlignment>
+PageComparison ComparePage(const std::byte* dest, const std::byte* src) {
+  dest = std::assume_aligned<alignof(uint32_t)>(dest);
+  src = std::assume_aligned<kSrcAlignment>(src);
+  uint32_t changed = 0;
+  uint32_t set_bits = 0;
+  uint32_t blank = ~uint32_t{0};
+  for (unsigned offset = 0; offset < FlashDisk::kPageSize;
+       offset += sizeof(uint32_t)) {
+    uint32_t old_word;
+    uint32_t new_word;
+    std::memcpy(&old_word, dest + offset, sizeof(old_word));
+    std::memcpy(&new_word, src + offset, sizeof(new_word));
+    changed |= old_word ^ new_word;
+    set_bits |= new_word & ~old_word;
+    blank &= new_word;
+  }
+  return {.changed = changed != 0,
+          .needs_erase = set_bits != 0,
+          .blank = blank == ~uint32_t{0}};
+}
 }  // namespace
 
-FlashDisk::FlashDisk(int sector_count) { sectors_ = flash.last(sector_count); }
+#if PICO_ON_DEVICE
+FlashDisk::FlashDisk(int sector_count, int skip_sectors) {
+  sectors_ = flash.last(sector_count + skip_sectors).first(sector_count);
+}
+#endif
 
-const FlashDisk::Sector& FlashDisk::ReadSector(int i) {
+std::span<const std::byte> FlashDisk::ReadSector(int i) {
   CheckInRange(i);
   return sectors_[i];
 }
 
 void FlashDisk::WriteSector(int i, std::span<const std::byte> payload) {
+  PROFILE_SCOPE("FlashDisk::WriteSector");
+  const std::optional<WritePlan> plan = PlanWrite(i, payload);
+  if (!plan) {
+    // Source and destination already match; no write needed at all.
+    return;
+  }
+  if (plan->erase) {
+    EraseSector(i);
+  }
+  // Program each run of consecutive pages in one go.
+  int page = 0;
+  while (page < kPagesPerSector) {
+    if (!plan->pages[page]) {
+      ++page;
+      continue;
+    }
+    const int first = page;
+    while (page < kPagesPerSector && plan->pages[page]) {
+      ++page;
+    }
+    ProgramPages(
+        i, first * kPageSize,
+        payload.subspan(first * kPageSize, (page - first) * kPageSize));
+  }
+}
+
+std::optional<FlashDisk::WritePlan> FlashDisk::PlanWrite(
+    int i, std::span<const std::byte> payload) {
+  PROFILE_SCOPE("FlashDisk::PlanWrite");
   CheckInRange(i);
   if (payload.size() != kSectorSize) {
     throw std::length_error(
         fmt::format("Payload size does not match flash sector size: {} vs {}",
                     payload.size(), kSectorSize));
   }
-  const Sector& dest = sectors_[i];
-  const std::span<const std::byte, kSectorSize> src(payload.data(),
-                                                    kSectorSize);
-
-  // See how much of the source already matches the destination to try to avoid
-  // an unneccessary sector erase.
-  const uint32_t unaligned_mismatch_offset =
-      std::ranges::mismatch(dest, src).in2 - src.begin();
-  // Find the page-aligned subspan of the source that doesn't match.
-  const std::span<const std::byte> src_mismatch =
-      src.subspan((unaligned_mismatch_offset / kPageSize) * kPageSize);
-  if (src_mismatch.empty()) {
-    // Source and destination already match; no write needed at all.
-    return;
+  const std::byte* dest = sectors_[i];
+  const std::byte* src = payload.data();
+  const bool aligned =
+      reinterpret_cast<uintptr_t>(src) % alignof(uint32_t) == 0;
+
+  WritePlan plan = {.erase = false};
+  std::bitset<kPagesPerSector> blank;
+  for (int page = 0; page < kPagesPerSector; ++page) {
+    const std::size_t offset = page * kPageSize;
+    const PageComparison comparison =
+        aligned ? ComparePage<alignof(uint32_t)>(dest + offset, src + offset)
+                : ComparePage<1>(dest + offset, src + offset);
+    plan.pages[page] = comparison.changed;
+    plan.erase |= comparison.needs_erase;
+    blank[page] = comparison.blank;
+  }
+  if (plan.erase) {
+    // The erase blanks every page, not just the ones that changed.
+    plan.pages = ~blank;
+  } else if (plan.pages.none()) {
+    return std::nullopt;
   }
+  return plan;
+}
 
-  // Offset from start of flash.
-  const uint32_t offset =
-      // Offset from start of flash to start of sector
-      (sectors_.data() - flash.data() + i) * kSectorSize +
-      // Offset from start of sector to first mismatched page.
-      (src_mismatch.data() - src.data());
+#if PICO_ON_DEVICE
+void FlashDisk::EraseSector(int i) {
+  PROFILE_SCOPE("FlashDisk::EraseSector");
+  CheckInRange(i);
+  const uint32_t offset = FlashOffset(i);
+  const uint64_t start = time_us_64();
+  RunExclusive([&] { flash_range_erase(offset, kSectorSize); });
+  RecordBlackout(time_us_64() - start);
+  ++erase_count_;
+  Stats::Global().flash_erases.Add();
+}
 
-  const auto interrupts = save_and_disable_interrupts();
-  if (src_mismatch.data() == src.data()) {
-    // All pages differ between source and destination; we need to erase the
-    // entire sector. In this case, the computed offset will already be aligned
-    // to a sector boundary.
-    flash_range_erase(offset, kSectorSize);
-  }
-  // Write all differing pages.
-  flash_range_program(offset,
-                      reinterpret_cast<const uint8_t*>(src_mismatch.data()),
-                      src_mismatch.size());
-  restore_interrupts(interrupts);
+void FlashDisk::ProgramPages(int i, int offset,
+                             std::span<const std::byte> data) {
+  PROFILE_SCOPE("FlashDisk::ProgramPages");
+  CheckInRange(i);
+  CheckInPages(offset, data.size());
+  const uint32_t flash_offset = FlashOffset(i) + offset;
+  const uint64_t start = time_us_64();
+  RunExclusive([&] {
+    flash_range_program(flash_offset,
+                        reinterpret_cast<const uint8_t*>(data.data()),
+                        data.size());
+  });
+  RecordBlackout(time_us_64() - start);
+  program_count_ += data.size() / kPageSize;
+  Stats::Global().flash_programmed_pages.Add(data.size() / kPageSize);
+}
+
+uint32_t FlashDisk::FlashOffset(int i) {
+  return (sectors_.data() - flash.data() + i) * kSectorSize;
+}
+#endif
+
+void FlashDisk::RecordBlackout(uint32_t duration_us) {
+  max_blackout_us_ = std::max(max_blackout_us_, duration_us);
+  Stats::Global().flash_max_blackout_us.RecordMax(duration_us);
 }
 
 void FlashDisk::CheckInRange(int i) {
@@ -72,3 +196,14 @@ void FlashDisk::CheckInRange(int i) {
       fmt::format("Flash sector index {} is out of valid range [0, {})", i,
                   sectors_.size()));
 }
+
+void FlashDisk::CheckInPages(int offset, std::size_t size) {
+  if (offset % kPageSize == 0 && size % kPageSize == 0 &&
+      offset + size <= kSectorSize) {
+    return;
+  }
+  throw std::invalid_argument(fmt::format(
+      "Flash program of {} bytes at offset {} is not within whole pages of "
+      "one sector",
+      size, offset));
+}
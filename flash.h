@@ -1,31 +1,141 @@
 #pragma once
 
-#include <hardware/flash.h>
-
+#include <bitset>
 #include <cstdint>
+#include <optional>
 #include <span>
+#if !PICO_ON_DEVICE
+#include <filesystem>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+#endif
 
-class FlashDisk {
- public:
-  // Flash must be erased on sector boundaries.
-  static constexpr int kSectorSize = FLASH_SECTOR_SIZE;
-  using Sector = std::byte[kSectorSize];
+#include "block_device.h"
 
+// NOR flash, erased a sector (kSectorSize) at a time and programmed in whole
+// pages. On the RP2040 this is the end of the QSPI flash the firmware runs
+// from (flash.cc). Host builds keep the sectors in an image file instead
+// (flash_host.cc), with the same rules enforced and timings modeled.
+class FlashDisk : public BlockDevice {
+ public:
   // Flash must be written to on page boundaries, which are smaller than
   // sectors.
-  static constexpr unsigned kPageSize = FLASH_PAGE_SIZE;
+  static constexpr unsigned kPageSize = 256;
+  static constexpr int kPagesPerSector = kSectorSize / kPageSize;
+
+#if PICO_ON_DEVICE
+  // Uses the end of flash memory as storage, less the last `skip_sectors`
+  // sectors, which another FlashDisk may use.
+  FlashDisk(int sector_count, int skip_sectors = 0);
+#else
+  // Typical W25Q16JV timings, as on the Feather RP2040.
+  static constexpr uint32_t kEraseUs = 45'000;
+  static constexpr uint32_t kProgramPageUs = 400;
+
+  // Maps the image file as storage, creating it erased if it doesn't exist.
+  // Throws std::filesystem::filesystem_error if that fails.
+  FlashDisk(int sector_count, const std::filesystem::path& image);
+  ~FlashDisk();
+
+  FlashDisk(const FlashDisk&) = delete;
+  FlashDisk& operator=(const FlashDisk&) = delete;
+
+  // Thrown by the operation that power is cut during.
+  struct PowerCut : std::runtime_error {
+    PowerCut() : std::runtime_error("Flash power cut") {}
+  };
+
+  // Lets `operations` more erases and page programs complete, then cuts power
+  // halfway through the next one: it throws PowerCut having erased or
+  // programmed only the first half of its range. The image is left as it
+  // would be after a brown-out, for the layers above to recover from.
+  void CutPowerAfter(int operations) { power_budget_ = operations; }
+#endif
+
+  std::span<const std::byte> ReadSector(int i) override;
+
+  // Equivalent to carrying out PlanWrite() in one go.
+  void WriteSector(int i, std::span<const std::byte> payload) override;
+
+  std::size_t SectorCount() override { return sectors_.size(); }
 
-  // Uses the end of flash memory as storage.
-  FlashDisk(int sector_count);
+  // Low-level operations, for layers that manage erases themselves.
 
-  const Sector& ReadSector(int i);
+  struct WritePlan {
+    // Whether the sector needs erasing first.
+    bool erase;
+    // Pages that need programming, after the erase if there is one.
+    std::bitset<kPagesPerSector> pages;
+  };
 
-  void WriteSector(int i, std::span<const std::byte> payload);
+  // Works out the flash operations needed to replace the sector's contents
+  // with the payload. Returns nullopt if the contents already match.
+  //
+  // Each page is either unchanged, programmable in place because the payload
+  // only clears bits, or needs the sector erased. Only an erase reprograms
+  // every page, and then only those that aren't blank in the payload. A
+  // word-aligned payload is compared a word at a time.
+  std::optional<WritePlan> PlanWrite(int i, std::span<const std::byte> payload);
 
-  std::size_t SectorCount() { return sectors_.size(); }
+  // Sets every bit of the sector to 1.
+  void EraseSector(int i);
+
+  // Programs whole pages starting at a page-aligned offset into the sector.
+  // Programming can only clear bits; bits that are already 0 stay 0.
+  void ProgramPages(int i, int offset, std::span<const std::byte> data);
+
+  // Number of sector erases performed.
+  uint32_t EraseCount() { return erase_count_; }
+
+  // Number of pages programmed.
+  uint32_t ProgramCount() { return program_count_; }
+
+  // Longest single erase or program operation, during which interrupts were
+  // disabled.
+  uint32_t MaxBlackoutUs() { return max_blackout_us_; }
+
+#if !PICO_ON_DEVICE
+  // Total time the operations so far would have kept the flash busy.
+  uint64_t ModeledBusyUs() { return modeled_busy_us_; }
+
+  // Indexed by sector.
+  std::span<const uint32_t> SectorEraseCounts() {
+    return sector_erase_counts_;
+  }
+
+  // Prints how many sectors have been erased how often, in power-of-two
+  // buckets.
+  void DumpEraseHistogram(std::ostream& out);
+#endif
 
  private:
   void CheckInRange(int i);
+  // Checks that a program operation covers whole pages of one sector.
+  void CheckInPages(int offset, std::size_t size);
+
+#if PICO_ON_DEVICE
+  // Offset of the sector from the start of flash.
+  uint32_t FlashOffset(int i);
+#else
+  // Whether power is cut during the operation about to be carried out.
+  bool CutsPower();
+#endif
+
+  void RecordBlackout(uint32_t duration_us);
 
   std::span<const Sector> sectors_;
+
+#if !PICO_ON_DEVICE
+  int image_fd_ = -1;
+  std::byte* image_ = nullptr;
+  std::vector<uint32_t> sector_erase_counts_;
+  uint64_t modeled_busy_us_ = 0;
+  // Operations until the power cut, or -1 for none.
+  int power_budget_ = -1;
+#endif
+
+  uint32_t erase_count_ = 0;
+  uint32_t program_count_ = 0;
+  uint32_t max_blackout_us_ = 0;
 };
@@ -0,0 +1,158 @@
+#include "flash.h"
+
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <hardware/sync.h>
+#include <pico/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+#include "profile.h"
+#include "stats.h"
+
+namespace {
+std::filesystem::filesystem_error ErrnoError(
+    std::string_view op, const std::filesystem::path& path) {
+  return std::filesystem::filesystem_error(
+      fmt::format("Flash image {} failed", op), path,
+      std::error_code(errno, std::generic_category()));
+}
+
+// Takes up the operation's time on the simulated clock, with interrupts
+// disabled as RunExclusive() has them on the device.
+void Busy(uint32_t duration_us) {
+  const uint32_t interrupts = save_and_disable_interrupts();
+  busy_wait_us(duration_us);
+  restore_interrupts(interrupts);
+}
+}  // namespace
+
+FlashDisk::FlashDisk(int sector_count, const std::filesystem::path& image)
+    : sector_erase_counts_(sector_count, 0) {
+  const std::size_t size = std::size_t{kSectorSize} * sector_count;
+  image_fd_ = open(image.c_str(), O_RDWR | O_CREAT, 0644);
+  if (image_fd_ < 0) {
+    throw ErrnoError("open", image);
+  }
+  // The destructor doesn't run if the constructor throws.
+  const auto close_and_throw = [&](std::string_view op) {
+    const std::filesystem::filesystem_error error = ErrnoError(op, image);
+    close(image_fd_);
+    throw error;
+  };
+  struct stat status;
+  if (fstat(image_fd_, &status) != 0) {
+    close_and_throw("stat");
+  }
+  const std::size_t old_size = status.st_size;
+  if (old_size < size && ftruncate(image_fd_, size) != 0) {
+    close_and_throw("resize");
+  }
+  void* mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd_, 0);
+  if (mapping == MAP_FAILED) {
+    close_and_throw("map");
+  }
+  image_ = static_cast<std::byte*>(mapping);
+  // New flash comes erased; a grown file comes zeroed.
+  if (old_size < size) {
+    std::memset(image_ + old_size, 0xFF, size - old_size);
+  }
+  sectors_ = std::span(reinterpret_cast<const Sector*>(image_), sector_count);
+}
+
+FlashDisk::~FlashDisk() {
+  munmap(image_, sectors_.size_bytes());
+  close(image_fd_);
+}
+
+void FlashDisk::EraseSector(int i) {
+  PROFILE_SCOPE("FlashDisk::EraseSector");
+  CheckInRange(i);
+  std::byte* const dest = image_ + std::size_t{kSectorSize} * i;
+  if (CutsPower()) {
+    std::memset(dest, 0xFF, kSectorSize / 2);
+    throw PowerCut();
+  }
+  std::memset(dest, 0xFF, kSectorSize);
+  Busy(kEraseUs);
+  modeled_busy_us_ += kEraseUs;
+  RecordBlackout(kEraseUs);
+  ++sector_erase_counts_[i];
+  ++erase_count_;
+  Stats::Global().flash_erases.Add();
+}
+
+void FlashDisk::ProgramPages(int i, int offset,
+                             std::span<const std::byte> data) {
+  PROFILE_SCOPE("FlashDisk::ProgramPages");
+  CheckInRange(i);
+  CheckInPages(offset, data.size());
+  std::byte* const dest = image_ + std::size_t{kSectorSize} * i + offset;
+  // Programming ANDs the data in. Real flash would silently drop any bit
+  // that needs setting, which hides missing erases in the layers above, so
+  // that is an error here, even for 0xFF padding; callers updating part of a
+  // page program the rest with its current contents.
+  for (std::size_t j = 0; j < data.size(); ++j) {
+    if ((data[j] & ~dest[j]) != std::byte{0}) {
+      throw std::logic_error(fmt::format(
+          "Flash program of sector {} sets bits at offset {} that need an "
+          "erase first",
+          i, offset + j));
+    }
+  }
+  if (CutsPower()) {
+    for (std::size_t j = 0; j < data.size() / 2; ++j) {
+      dest[j] &= data[j];
+    }
+    throw PowerCut();
+  }
+  for (std::size_t j = 0; j < data.size(); ++j) {
+    dest[j] &= data[j];
+  }
+  const uint32_t pages = data.size() / kPageSize;
+  Busy(pages * kProgramPageUs);
+  modeled_busy_us_ += pages * kProgramPageUs;
+  RecordBlackout(pages * kProgramPageUs);
+  program_count_ += pages;
+  Stats::Global().flash_programmed_pages.Add(pages);
+}
+
+bool FlashDisk::CutsPower() {
+  if (power_budget_ < 0) {
+    return false;
+  }
+  if (power_budget_ == 0) {
+    power_budget_ = -1;
+    return true;
+  }
+  --power_budget_;
+  return false;
+}
+
+void FlashDisk::DumpEraseHistogram(std::ostream& out) {
+  // Bucket b counts sectors erased [2^(b-1), 2^b) times; bucket 0 never.
+  std::map<int, int> buckets;
+  for (uint32_t count : sector_erase_counts_) {
+    ++buckets[std::bit_width(count)];
+  }
+  out << fmt::format("Erase counts of {} sectors: min {} max {}\n",
+                     sector_erase_counts_.size(),
+                     std::ranges::min(sector_erase_counts_),
+                     std::ranges::max(sector_erase_counts_));
+  for (const auto& [bucket, sectors] : buckets) {
+    const uint32_t low = bucket == 0 ? 0 : 1u << (bucket - 1);
+    const uint32_t high = bucket == 0 ? 0 : (1u << bucket) - 1;
+    out << fmt::format("  {:>6}-{:<6} {}\n", low, high, sectors);
+  }
+}
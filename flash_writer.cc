@@ -0,0 +1,403 @@
+#include "flash_writer.h"
+
+#include <fmt/core.h>
+#include <pico/time.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "checksum.h"
+#include "logging.h"
+#include "stats.h"
+
+namespace {
+constexpr uint32_t kJournalMagic = 0x4C4E524A;  // "JRNL"
+constexpr int kRecordSector = 0;
+
+int FirstPage(const std::bitset<FlashDisk::kPagesPerSector>& pages) {
+  int page = 0;
+  while (page < FlashDisk::kPagesPerSector && !pages[page]) {
+    ++page;
+  }
+  return page;
+}
+
+// Programs the bytes at the offset, leaving the rest of their page alone by
+// reprogramming it with what it already holds.
+void ProgramInPage(FlashDisk& flash, int i, int offset,
+                   std::span<const std::byte> bytes) {
+  alignas(uint32_t) std::array<std::byte, FlashDisk::kPageSize> page;
+  const int page_offset = offset - offset % FlashDisk::kPageSize;
+  std::ranges::copy(
+      flash.ReadSector(i).subspan(page_offset, FlashDisk::kPageSize),
+      page.begin());
+  std::ranges::copy(bytes, page.begin() + (offset - page_offset));
+  flash.ProgramPages(i, page_offset, page);
+}
+}  // namespace
+
+FlashWriter::FlashWriter(FlashDisk& flash, FlashDisk& journal)
+    : flash_(flash),
+      journal_(journal),
+      slots_(kSlots),
+      free_(flash.SectorCount()),
+      erased_(flash.SectorCount()),
+      data_only_(flash.SectorCount()) {
+  if (journal.SectorCount() != kJournalSectors) {
+    throw std::invalid_argument(
+        fmt::format("Journal has {} sectors instead of {}",
+                    journal.SectorCount(), kJournalSectors));
+  }
+  Recover();
+}
+
+std::span<const std::byte> FlashWriter::ReadSector(int i) {
+  if (Slot* slot = Find(i)) {
+    return slot->data;
+  }
+  return flash_.ReadSector(i);
+}
+
+void FlashWriter::Sync() {
+  while (!Idle()) {
+    Step();
+  }
+  flash_.Sync();
+}
+
+void FlashWriter::Trim(int first, int count) {
+  if (first < 0 || count < 0 || first + count > SectorCount()) {
+    throw std::out_of_range(
+        fmt::format("Trim of sectors [{}, {}) is out of valid range [0, {})",
+                    first, first + count, SectorCount()));
+  }
+  for (int i = first; i < first + count; ++i) {
+    // FatFS may reuse the sector for a directory.
+    data_only_[i] = false;
+    if (free_[i] || Find(i) != nullptr) {
+      continue;
+    }
+    free_[i] = true;
+    Stats::Global().flash_trimmed_sectors.Add();
+  }
+}
+
+void FlashWriter::MarkDataOnly(int first, int count) {
+  if (first < 0 || count < 0 || first + count > SectorCount()) {
+    throw std::out_of_range(fmt::format(
+        "Data-only sectors [{}, {}) are out of valid range [0, {})", first,
+        first + count, SectorCount()));
+  }
+  for (int i = first; i < first + count; ++i) {
+    data_only_[i] = true;
+  }
+}
+
+void FlashWriter::ClearDataOnly(int first, int count) {
+  if (first < 0 || count < 0 || first + count > SectorCount()) {
+    throw std::out_of_range(fmt::format(
+        "Data-only sectors [{}, {}) are out of valid range [0, {})", first,
+        first + count, SectorCount()));
+  }
+  std::fill_n(data_only_.begin() + first, count, false);
+}
+
+void FlashWriter::Enqueue(int i, std::span<const std::byte> payload,
+                          std::function<void()> on_complete) {
+  if (payload.size() != kSectorSize) {
+    throw std::length_error(
+        fmt::format("Payload size does not match sector size: {} vs {}",
+                    payload.size(), kSectorSize));
+  }
+  Slot* slot = Find(i);
+  if (slot != nullptr && slot->committed) {
+    // The journal holds the pending data as what recovery would write. Finish
+    // writing it, so that there is never more than one record to replay.
+    while (slot->sector == i && slot->committed) {
+      Step();
+    }
+    if (slot->sector != i) {
+      slot = nullptr;
+    }
+  }
+  if (slot != nullptr) {
+    // Coalesce with the pending write, which has to be planned again.
+    slot->planned = false;
+    if (on_complete) {
+      slot->on_complete = [previous = std::move(slot->on_complete),
+                           next = std::move(on_complete)] {
+        if (previous) {
+          previous();
+        }
+        next();
+      };
+    }
+  } else {
+    while ((slot = Find(-1)) == nullptr) {
+      Step();
+    }
+    slot->sector = i;
+    slot->sequence = next_sequence_++;
+    slot->on_complete = std::move(on_complete);
+    slot->planned = false;
+    slot->started = false;
+  }
+  std::ranges::copy(payload, slot->data.begin());
+  free_[i] = false;
+}
+
+void FlashWriter::Task() {
+  const uint64_t start = time_us_64();
+  while (!Idle() && time_us_64() - start < kTaskBudgetUs) {
+    Step();
+  }
+  // Erases black out interrupts for tens of milliseconds, so only do one per
+  // call, and only when there is nothing more urgent.
+  if (Idle() && time_us_64() - start < kTaskBudgetUs) {
+    EraseAhead();
+  }
+  if (flash_.MaxBlackoutUs() > reported_blackout_us_) {
+    reported_blackout_us_ = flash_.MaxBlackoutUs();
+    Log("Longest flash interrupt-off window: {} us", reported_blackout_us_);
+  }
+}
+
+bool FlashWriter::Idle() { return Next() == nullptr; }
+
+FlashWriter::Slot* FlashWriter::Find(int i) {
+  for (Slot& slot : slots_) {
+    if (slot.sector == i) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+FlashWriter::Slot* FlashWriter::Next() {
+  Slot* next = nullptr;
+  for (Slot& slot : slots_) {
+    if (slot.sector >= 0 &&
+        (next == nullptr || slot.sequence - next->sequence > (1u << 31))) {
+      next = &slot;
+    }
+  }
+  return next;
+}
+
+void FlashWriter::Step() {
+  Slot* slot = Next();
+  if (slot == nullptr) {
+    return;
+  }
+
+  if (!slot->planned) {
+    Plan(*slot);
+    return;
+  }
+
+  if (slot->journaled) {
+    if (slot->journal_plan.erase) {
+      journal_.EraseSector(slot->journal_sector);
+      slot->journal_plan.erase = false;
+      return;
+    }
+    if (const int page = FirstPage(slot->journal_plan.pages);
+        page < FlashDisk::kPagesPerSector) {
+      const int offset = page * FlashDisk::kPageSize;
+      journal_.ProgramPages(
+          slot->journal_sector, offset,
+          std::span(slot->data).subspan(offset, FlashDisk::kPageSize));
+      slot->journal_plan.pages[page] = false;
+      return;
+    }
+    if (slot->commit_pending) {
+      Commit(*slot);
+      return;
+    }
+  }
+
+  if (slot->plan.erase) {
+    flash_.EraseSector(slot->sector);
+    erased_[slot->sector] = true;
+    slot->plan.erase = false;
+    slot->started = true;
+    return;
+  }
+
+  const int page = FirstPage(slot->plan.pages);
+  if (page == FlashDisk::kPagesPerSector) {
+    if (slot->committed) {
+      MarkDone(journal_records_ - 1);
+      slot->committed = false;
+      return;
+    }
+    Complete(*slot);
+    return;
+  }
+  if (!slot->started && erased_[slot->sector]) {
+    // Erased ahead of time by EraseAhead().
+    Stats::Global().flash_preerased_writes.Add();
+  }
+  const int offset = page * FlashDisk::kPageSize;
+  flash_.ProgramPages(
+      slot->sector, offset,
+      std::span(slot->data).subspan(offset, FlashDisk::kPageSize));
+  erased_[slot->sector] = false;
+  slot->plan.pages[page] = false;
+  slot->started = true;
+}
+
+void FlashWriter::Plan(Slot& slot) {
+  // Planned against what is in flash now, so a write that was partly carried
+  // out before its data was replaced picks up where it left off.
+  const std::optional<FlashDisk::WritePlan> plan =
+      flash_.PlanWrite(slot.sector, slot.data);
+  if (!plan) {
+    Complete(slot);
+    return;
+  }
+  slot.plan = *plan;
+  slot.planned = true;
+  slot.journaled = !data_only_[slot.sector];
+  slot.commit_pending = slot.journaled;
+  if (!slot.journaled) {
+    return;
+  }
+  // Every record is done by now, so any data sector is free to reuse.
+  slot.journal_sector = next_journal_sector_;
+  next_journal_sector_ = next_journal_sector_ % (kJournalSectors - 1) + 1;
+  slot.journal_plan = journal_.PlanWrite(slot.journal_sector, slot.data)
+                          .value_or(FlashDisk::WritePlan{.erase = false});
+}
+
+void FlashWriter::Commit(Slot& slot) {
+  if (journal_records_ == kRecordsPerSector) {
+    // Every record in it is done, and this write's isn't in it yet.
+    journal_.EraseSector(kRecordSector);
+    journal_records_ = 0;
+    return;
+  }
+  JournalRecord record = {
+      .magic = kJournalMagic,
+      .sequence = journal_sequence_++,
+      .sector = static_cast<uint16_t>(slot.sector),
+      .journal_sector = static_cast<uint16_t>(slot.journal_sector),
+      .payload_checksum = Checksum(slot.data),
+  };
+  record.checksum = RecordChecksum(record);
+  record.done = ~uint32_t{0};
+  std::ranges::fill(record.reserved, ~uint32_t{0});
+  ProgramInPage(journal_, kRecordSector,
+                journal_records_ * sizeof(JournalRecord),
+                std::as_bytes(std::span(&record, 1)));
+  ++journal_records_;
+  slot.commit_pending = false;
+  slot.committed = true;
+  Stats::Global().flash_journaled_writes.Add();
+}
+
+void FlashWriter::MarkDone(int record) {
+  const uint32_t done = 0;
+  ProgramInPage(journal_, kRecordSector,
+                record * sizeof(JournalRecord) +
+                    offsetof(JournalRecord, done),
+                std::as_bytes(std::span(&done, 1)));
+}
+
+void FlashWriter::Recover() {
+  // Records are appended in order, so the first erased one ends the scan, and
+  // the last valid one is the latest. One that fails its checksum was being
+  // appended when power was lost, and its write never started.
+  const std::span<const std::byte> records = journal_.ReadSector(kRecordSector);
+  const auto blank = [](std::span<const std::byte> bytes) {
+    return std::ranges::all_of(
+        bytes, [](std::byte b) { return b == std::byte{0xFF}; });
+  };
+  std::optional<JournalRecord> latest;
+  int latest_index;
+  for (int n = 0; n < kRecordsPerSector; ++n) {
+    const std::span<const std::byte> bytes =
+        records.subspan(n * sizeof(JournalRecord), sizeof(JournalRecord));
+    if (blank(bytes)) {
+      break;
+    }
+    journal_records_ = n + 1;
+    JournalRecord record;
+    std::memcpy(&record, bytes.data(), sizeof(record));
+    if (record.magic == kJournalMagic &&
+        record.checksum == RecordChecksum(record)) {
+      latest = record;
+      latest_index = n;
+    }
+  }
+  if (!blank(records.subspan(journal_records_ * sizeof(JournalRecord)))) {
+    // An erase of the record sector was cut short, leaving old records after
+    // blank ones. It only starts once every record is done, so finish it
+    // rather than append over them.
+    Log("Journal record sector was partly erased; erasing it again.");
+    journal_.EraseSector(kRecordSector);
+    journal_records_ = 0;
+    return;
+  }
+  if (!latest) {
+    return;
+  }
+  journal_sequence_ = latest->sequence + 1;
+  next_journal_sector_ = latest->journal_sector % (kJournalSectors - 1) + 1;
+  // A torn done word still means the target was written in full.
+  if (latest->done != ~uint32_t{0}) {
+    return;
+  }
+  const std::span<const std::byte> payload =
+      journal_.ReadSector(latest->journal_sector);
+  if (latest->sector >= SectorCount() ||
+      Checksum(payload) != latest->payload_checksum) {
+    Log("Journal record for sector {} is corrupt; not replaying it.",
+        latest->sector);
+    return;
+  }
+  // The slots are all free, so one doubles as the copy buffer: flash can't be
+  // written from itself.
+  std::array<std::byte, kSectorSize>& copy = slots_.front().data;
+  std::ranges::copy(payload, copy.begin());
+  flash_.WriteSector(latest->sector, copy);
+  MarkDone(latest_index);
+  Stats::Global().flash_journal_replays.Add();
+  Log("Replayed interrupted write of flash sector {} from the journal.",
+      latest->sector);
+}
+
+void FlashWriter::Complete(Slot& slot) {
+  std::function<void()> on_complete = std::exchange(slot.on_complete, {});
+  slot.sector = -1;
+  if (on_complete) {
+    on_complete();
+  }
+}
+
+bool FlashWriter::EraseAhead() {
+  int erased = 0;
+  int candidate = -1;
+  const int count = SectorCount();
+  for (int n = 0; n < count; ++n) {
+    const int i = (erase_cursor_ + n) % count;
+    if (!free_[i]) {
+      continue;
+    }
+    if (erased_[i]) {
+      ++erased;
+    } else if (candidate < 0) {
+      candidate = i;
+    }
+  }
+  if (candidate < 0 || erased >= kErasedPoolSize) {
+    return false;
+  }
+  flash_.EraseSector(candidate);
+  erased_[candidate] = true;
+  erase_cursor_ = (candidate + 1) % count;
+  return true;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "block_device.h"
+#include "flash.h"
+
+// Carries out flash writes in the background, so that a sector write does not
+// black out USB and UART servicing for a whole erase-and-program sequence.
+//
+// WriteSector() only copies the payload into a RAM staging slot. Task() then
+// works through the flash operations one step at a time: a sector erase, or a
+// single page program. Reads of a sector with a pending write are served from
+// its staging slot.
+//
+// Trimmed sectors are tracked in a free-sector bitmap. While there are no
+// writes pending, Task() erases some of them ahead of time, so that a later
+// write to one of them only needs programming.
+//
+// Writes are atomic across power loss: a sector reads back with either its
+// old or its new contents, never erased or half-programmed. The new contents
+// are first copied into one of the journal's data sectors, then a commit
+// record naming the target is appended to its record sector, and only then is
+// the target updated in place; programming the record's done word retires it.
+// At most one record is ever not done, so recovery in the constructor replays
+// at most one sector write. Sectors marked data-only skip the journal.
+class FlashWriter : public BlockDevice {
+ public:
+  static constexpr int kSlots = 2;
+
+  // Task() stops starting new steps after this long.
+  static constexpr uint32_t kTaskBudgetUs = 2'000;
+
+  // Trimmed sectors that Task() keeps erased ahead of time.
+  static constexpr int kErasedPoolSize = 16;
+
+  // One record sector, and data sectors used in turn.
+  static constexpr int kJournalSectors = 8;
+
+  // Finishes any write that power was lost during. The journal must have
+  // kJournalSectors sectors.
+  FlashWriter(FlashDisk& flash, FlashDisk& journal);
+
+  std::span<const std::byte> ReadSector(int i) override;
+
+  // Only blocks if all staging slots are busy.
+  void WriteSector(int i, std::span<const std::byte> payload) override {
+    Enqueue(i, payload);
+  }
+
+  std::size_t SectorCount() override { return flash_.SectorCount(); }
+
+  // Sectors with a pending write stay in use. Trimmed sectors are no longer
+  // data-only.
+  void Trim(int first, int count) override;
+
+  // Later writes to these sectors go straight to flash, as before the journal
+  // existed, until the sectors are trimmed or cleared.
+  void MarkDataOnly(int first, int count) override;
+
+  void ClearDataOnly(int first, int count) override;
+
+  // Completes all pending writes.
+  void Sync() override;
+
+  // Stages a write. on_complete is called from Task() or Sync() once the data
+  // is in flash.
+  void Enqueue(int i, std::span<const std::byte> payload,
+               std::function<void()> on_complete = {});
+
+  void Task();
+
+  bool Idle();
+
+ private:
+  struct Slot {
+    // -1 if the slot is free.
+    int sector = -1;
+    // Word-aligned for FlashDisk::PlanWrite().
+    alignas(uint32_t) std::array<std::byte, kSectorSize> data;
+    // Slots are written in the order they were filled.
+    uint32_t sequence;
+    std::function<void()> on_complete;
+
+    // Whether `plan` has been worked out for the current data.
+    bool planned = false;
+    FlashDisk::WritePlan plan;
+    // Whether any flash operation has been carried out for this slot.
+    bool started = false;
+
+    // For a journaled write, the steps before `plan`: copying the data into
+    // the journal with `journal_plan`, then appending the commit record. Once
+    // committed, `plan` is followed by marking the record done.
+    bool journaled = false;
+    int journal_sector;
+    FlashDisk::WritePlan journal_plan;
+    bool commit_pending = false;
+    bool committed = false;
+  };
+
+  // Appended to the journal's record sector. 32 bytes, so records fill pages
+  // evenly.
+  struct JournalRecord {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t sector;
+    uint16_t journal_sector;
+    // Of the journal sector's contents.
+    uint32_t payload_checksum;
+    uint32_t checksum;
+    // All 1s until the target sector has been written.
+    uint32_t done;
+    uint32_t reserved[2];
+  };
+  static constexpr int kRecordsPerSector = kSectorSize / sizeof(JournalRecord);
+
+  Slot* Find(int i);
+
+  // Oldest pending write, if any.
+  Slot* Next();
+
+  // Performs one bounded unit of work for the oldest pending write.
+  void Step();
+
+  // Works out how to write the slot, and whether through the journal.
+  void Plan(Slot& slot);
+
+  // Appends the commit record for the slot, or erases the record sector if it
+  // is full.
+  void Commit(Slot& slot);
+
+  // Programs the done word of the record with the given index.
+  void MarkDone(int record);
+
+  void Complete(Slot& slot);
+
+  // Replays the last record if it isn't done.
+  void Recover();
+
+  // Erases one free sector if the pool of erased ones is short. Returns
+  // whether it did.
+  bool EraseAhead();
+
+  FlashDisk& flash_;
+  FlashDisk& journal_;
+  std::vector<Slot> slots_;
+  uint32_t next_sequence_ = 0;
+  // Indexed by sector: whether it was trimmed and hasn't been written since,
+  // and whether it is known to be erased. Kept in RAM only, so every sector
+  // counts as in use after a reset.
+  std::vector<bool> free_;
+  std::vector<bool> erased_;
+  // Indexed by sector: whether writes to it skip the journal.
+  std::vector<bool> data_only_;
+  // Where EraseAhead() looks first, so free sectors are erased in the
+  // ascending order FatFS tends to reallocate them in.
+  int erase_cursor_ = 0;
+  uint32_t reported_blackout_us_ = 0;
+
+  // Records in the record sector, valid or not.
+  int journal_records_ = 0;
+  uint32_t journal_sequence_ = 0;
+  // Journal data sector the next write copies its data into.
+  int next_journal_sector_ = 1;
+};
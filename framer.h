@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <variant>
+
+#include "serial_port.h"
+
+// Splits a received byte stream into protocol frames, so that each frame can
+// be forwarded to the host in one go rather than as whatever happened to
+// arrive between polls. Kept free of SDK dependencies so that it can be
+// exercised on a host.
+//
+// Where frames end is decided by a policy, a type with:
+//
+//   // Whether the partial frame, whose last byte was just appended, is now
+//   // complete.
+//   bool Complete(std::span<const char> frame) const;
+//
+//   // Silence after which a partial frame is complete anyway; 0 for never.
+//   uint64_t idle_gap_us;
+//
+// and optionally, for policies that can tell a frame's size from its start:
+//
+//   // Total size of the frame, or 0 if the partial frame doesn't tell yet.
+//   std::size_t FrameSize(std::span<const char> frame) const;
+
+// Frames end with (and include) a delimiter byte.
+struct DelimiterFraming {
+  char delimiter;
+  uint64_t idle_gap_us = 20'000;
+
+  static constexpr DelimiterFraming Newline() { return {.delimiter = '\n'}; }
+  // SLIP END.
+  static constexpr DelimiterFraming Slip() {
+    return {.delimiter = static_cast<char>(0xC0)};
+  }
+  // COBS frames are terminated by the one zero byte they contain.
+  static constexpr DelimiterFraming Cobs() { return {.delimiter = 0}; }
+
+  bool Complete(std::span<const char> frame) const {
+    return frame.back() == delimiter;
+  }
+};
+
+// Frames start with a fixed-size header containing the length of the payload
+// that follows, optionally followed by a fixed-size trailer such as a CRC.
+struct LengthFraming {
+  // Size of the whole header, which includes the length field.
+  std::size_t header_size;
+  std::size_t length_offset = 0;
+  // 1 or 2 bytes.
+  std::size_t length_size = 1;
+  bool big_endian = true;
+  std::size_t trailer_size = 0;
+  uint64_t idle_gap_us = 20'000;
+
+  bool Complete(std::span<const char> frame) const {
+    const std::size_t size = FrameSize(frame);
+    return size != 0 && frame.size() >= size;
+  }
+
+  std::size_t FrameSize(std::span<const char> frame) const {
+    if (frame.size() < header_size) {
+      return 0;
+    }
+    const auto byte = [&](std::size_t i) {
+      return static_cast<uint8_t>(frame[length_offset + i]);
+    };
+    std::size_t length = byte(0);
+    if (length_size == 2) {
+      length = big_endian ? (length << 8) | byte(1) : length | (byte(1) << 8);
+    }
+    return header_size + length + trailer_size;
+  }
+};
+
+// Frames are separated by silence on the line only.
+struct IdleFraming {
+  uint64_t idle_gap_us;
+
+  // 3.5 character times of 11 bits, fixed at 1750us above 19200 baud as the
+  // Modbus serial line spec recommends.
+  static constexpr IdleFraming ModbusRtu(uint32_t baud_rate) {
+    return {.idle_gap_us =
+                baud_rate > 19'200 ? 1750 : 38'500'000 / uint64_t{baud_rate}};
+  }
+
+  bool Complete(std::span<const char> frame) const { return false; }
+};
+
+// Accumulates bytes into frames according to the policy. Completed frames are
+// kept at the front of the buffer until the caller has sent them, and while
+// they take up room the partial frame waits for it rather than being split.
+//
+// A frame that outgrows the whole buffer is sent on in pieces of the buffer's
+// size. If the policy knows the frame's size, the rest of it follows the same
+// way without being parsed, so the next frame is found where it starts.
+template <typename Policy>
+class FrameBuffer {
+ public:
+  // Enough for a maximum-size Modbus RTU frame.
+  static constexpr std::size_t kCapacity = 256;
+
+  explicit FrameBuffer(Policy policy) : policy_(policy) {}
+
+  // Number of bytes Push() can accept.
+  std::size_t Free() const { return kCapacity - size_; }
+
+  // Appends received bytes, each of which arrived at the corresponding time in
+  // times, or at now_us if times is empty. Returns the number of frames
+  // completed.
+  int Push(std::span<const char> data, std::span<const TimestampedByte> times,
+           uint64_t now_us) {
+    int frames = 0;
+    for (std::size_t i = 0; i < data.size(); ++i) {
+      const uint64_t time_us = times.empty() ? now_us : times[i].time_us;
+      if (IdleSince(time_us)) {
+        frames += CompleteIdle();
+      }
+      buffer_[size_++] = data[i];
+      last_byte_us_ = time_us;
+      if (oversize_remaining_ > 0) {
+        --oversize_remaining_;
+        if (oversize_remaining_ == 0 || size_ == kCapacity) {
+          frames += Complete();
+        }
+      } else if (policy_.Complete(Partial())) {
+        frames += Complete();
+      } else if (Partial().size() == kCapacity) {
+        oversize_remaining_ = Overflow();
+        frames += Complete();
+      }
+    }
+    return frames;
+  }
+
+  // Completes the partial frame if the line has been idle long enough. Returns
+  // the number of frames completed.
+  int Poll(uint64_t now_us) { return IdleSince(now_us) ? CompleteIdle() : 0; }
+
+  // Completes the partial frame regardless. Returns the number of frames
+  // completed.
+  int Flush() { return Complete(); }
+
+  // Completed frames that haven't been sent yet.
+  std::span<const char> Ready() const {
+    return std::span(buffer_).first(complete_);
+  }
+
+  // Drops the given number of bytes from the front of Ready().
+  void Consume(std::size_t size) {
+    std::memmove(buffer_.data(), buffer_.data() + size, size_ - size);
+    size_ -= size;
+    complete_ -= size;
+  }
+
+ private:
+  std::span<const char> Partial() const {
+    return std::span(buffer_).subspan(complete_, size_ - complete_);
+  }
+
+  bool IdleSince(uint64_t time_us) const {
+    return policy_.idle_gap_us != 0 && size_ > complete_ &&
+           time_us >= last_byte_us_ + policy_.idle_gap_us;
+  }
+
+  int Complete() {
+    const bool any = size_ > complete_;
+    complete_ = size_;
+    return any;
+  }
+
+  // A gap also ends an oversized frame, so the next byte is parsed as the
+  // start of a frame even if the oversized one was cut short.
+  int CompleteIdle() {
+    oversize_remaining_ = 0;
+    return Complete();
+  }
+
+  // Bytes of the full-buffer partial frame still to come.
+  std::size_t Overflow() const {
+    if constexpr (requires { policy_.FrameSize(Partial()); }) {
+      const std::size_t size = policy_.FrameSize(Partial());
+      return size > kCapacity ? size - kCapacity : 0;
+    } else {
+      return 0;
+    }
+  }
+
+  Policy policy_;
+  std::array<char, kCapacity> buffer_;
+  // Bytes buffered, of which the first complete_ form whole frames.
+  std::size_t size_ = 0;
+  std::size_t complete_ = 0;
+  uint64_t last_byte_us_ = 0;
+  // Bytes of an oversized frame still to pass through.
+  std::size_t oversize_remaining_ = 0;
+};
+
+// A channel's framing; monostate forwards bytes as they arrive. Dispatched
+// once per chunk, so the per-byte path is specialized for each policy.
+using Framer = std::variant<std::monostate, FrameBuffer<DelimiterFraming>,
+                            FrameBuffer<LengthFraming>,
+                            FrameBuffer<IdleFraming>>;
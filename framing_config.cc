@@ -0,0 +1,165 @@
+#include "framing_config.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include "logging.h"
+#include "stats.h"
+
+namespace {
+std::vector<std::string_view> Tokens(std::string_view line) {
+  std::vector<std::string_view> tokens;
+  while (true) {
+    const std::size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos) {
+      return tokens;
+    }
+    line.remove_prefix(start);
+    const std::size_t end = std::min(line.find_first_of(" \t\r"), line.size());
+    tokens.push_back(line.substr(0, end));
+    line.remove_prefix(end);
+  }
+}
+
+template <typename T>
+T ParseNumber(std::string_view token, int base, int line_number) {
+  T value;
+  const std::from_chars_result result =
+      std::from_chars(token.data(), token.data() + token.size(), value, base);
+  if (result.ec != std::errc() || result.ptr != token.data() + token.size()) {
+    throw std::invalid_argument(fmt::format(
+        "Expected a number, not '{}', on framing line {}", token, line_number));
+  }
+  return value;
+}
+
+Framer ParseFramer(std::span<const std::string_view> args, int line_number) {
+  const std::string_view kind = args[0];
+  const auto expect_args = [&](std::size_t min, std::size_t max) {
+    if (args.size() - 1 < min || args.size() - 1 > max) {
+      throw std::invalid_argument(
+          fmt::format("Wrong number of arguments for {} framing on line {}",
+                      kind, line_number));
+    }
+  };
+  const auto size = [&](std::size_t i) {
+    return ParseNumber<std::size_t>(args[i], 10, line_number);
+  };
+  if (kind == "none") {
+    expect_args(0, 0);
+    return {};
+  }
+  if (kind == "newline") {
+    expect_args(0, 0);
+    return FrameBuffer(DelimiterFraming::Newline());
+  }
+  if (kind == "slip") {
+    expect_args(0, 0);
+    return FrameBuffer(DelimiterFraming::Slip());
+  }
+  if (kind == "cobs") {
+    expect_args(0, 0);
+    return FrameBuffer(DelimiterFraming::Cobs());
+  }
+  if (kind == "delimiter") {
+    expect_args(1, 1);
+    return FrameBuffer(DelimiterFraming{
+        .delimiter = static_cast<char>(
+            ParseNumber<uint8_t>(args[1], 16, line_number))});
+  }
+  if (kind == "length") {
+    expect_args(4, 5);
+    const LengthFraming policy = {
+        .header_size = size(1),
+        .length_offset = size(2),
+        .length_size = size(3),
+        .big_endian = args[4] == "big",
+        .trailer_size = args.size() > 5 ? size(5) : 0,
+    };
+    if ((args[4] != "big" && args[4] != "little") ||
+        (policy.length_size != 1 && policy.length_size != 2) ||
+        policy.length_offset + policy.length_size > policy.header_size ||
+        policy.header_size + policy.trailer_size >
+            FrameBuffer<LengthFraming>::kCapacity) {
+      throw std::invalid_argument(fmt::format(
+          "Invalid length framing on framing line {}", line_number));
+    }
+    return FrameBuffer(policy);
+  }
+  if (kind == "idle") {
+    expect_args(1, 1);
+    return FrameBuffer(IdleFraming{
+        .idle_gap_us = ParseNumber<uint64_t>(args[1], 10, line_number)});
+  }
+  if (kind == "modbus") {
+    expect_args(1, 1);
+    const uint32_t baud_rate = ParseNumber<uint32_t>(args[1], 10, line_number);
+    if (baud_rate == 0) {
+      throw std::invalid_argument(
+          fmt::format("Invalid baud rate on framing line {}", line_number));
+    }
+    return FrameBuffer(IdleFraming::ModbusRtu(baud_rate));
+  }
+  throw std::invalid_argument(
+      fmt::format("Unknown framing '{}' on line {}", kind, line_number));
+}
+}  // namespace
+
+std::vector<ChannelFraming> ParseFramingConfig(std::string_view text) {
+  std::vector<ChannelFraming> channels;
+  int line_number = 0;
+  while (!text.empty()) {
+    const std::size_t end = std::min(text.find('\n'), text.size());
+    const std::string_view line = text.substr(0, end);
+    text.remove_prefix(std::min(end + 1, text.size()));
+    ++line_number;
+    const std::vector<std::string_view> tokens = Tokens(line);
+    if (tokens.empty() || tokens[0].starts_with('#')) {
+      continue;
+    }
+    if (tokens.size() < 2) {
+      throw std::invalid_argument(
+          fmt::format("Missing framing on framing line {}", line_number));
+    }
+    const int channel = ParseNumber<int>(tokens[0], 10, line_number);
+    if (channel < 0 || channel >= Stats::kChannels) {
+      throw std::invalid_argument(fmt::format(
+          "Channel {} out of range on framing line {}", channel, line_number));
+    }
+    channels.push_back({
+        .channel = channel,
+        .framer = ParseFramer(std::span(tokens).subspan(1), line_number),
+    });
+  }
+  return channels;
+}
+
+void LoadFramingConfig(FileSystem& fs, Bridge& bridge) {
+  std::vector<ChannelFraming> channels;
+  try {
+    channels = ParseFramingConfig(
+        fs.OpenFile(kFramingPath, {.read = true, .open_existing = true})
+            .ReadAll());
+  } catch (const std::filesystem::filesystem_error&) {
+    // No file; everything unframed.
+  } catch (const std::exception& e) {
+    Log("Ignoring {}: {}", kFramingPath, e.what());
+  }
+  std::array<Framer, Stats::kChannels> framers;
+  for (ChannelFraming& channel : channels) {
+    framers[channel.channel] = std::move(channel.framer);
+  }
+  for (int i = 0; i < Stats::kChannels; ++i) {
+    bridge.SetFramer(i, std::move(framers[i]));
+  }
+  if (!channels.empty()) {
+    Log("Loaded framing for {} channels from {}.", channels.size(),
+        kFramingPath);
+  }
+}
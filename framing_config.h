@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "bridge.h"
+#include "framer.h"
+#include "fs.h"
+
+// Per-channel framing, read from kFramingPath on the volume so that it can be
+// changed from the host without rebuilding.
+inline constexpr char kFramingPath[] = "/FRAMING.TXT";
+
+struct ChannelFraming {
+  int channel;
+  Framer framer;
+};
+
+// Parses one channel per line: the channel number, then the framing and its
+// arguments, separated by whitespace:
+//
+//   none
+//   newline | slip | cobs
+//   delimiter <hex byte>
+//   length <header size> <length offset> <length size> big|little [<trailer>]
+//   idle <gap us>
+//   modbus <baud rate>
+//
+// Blank lines and lines starting with # are skipped. Throws
+// std::invalid_argument on malformed input.
+std::vector<ChannelFraming> ParseFramingConfig(std::string_view text);
+
+// Reads kFramingPath and applies it to the bridge's channels. Channels it
+// doesn't mention are unframed, as are all of them if it is missing or
+// malformed, which is logged.
+void LoadFramingConfig(FileSystem& fs, Bridge& bridge);
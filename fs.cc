@@ -8,6 +8,7 @@
 #include <fmt/core.h>
 #include <fmt/ostream.h>
 #include <fmt/ranges.h>
+#include <pico/time.h>
 
 #include <algorithm>
 #include <array>
@@ -15,22 +16,43 @@
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
+#include <functional>
 #include <iomanip>
-#include <iostream>
 #include <ranges>
 #include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <system_error>
 #include <utility>
 
-#include "flash.h"
+#include "block_device.h"
+#include "logging.h"
+#include "profile.h"
+#include "stats.h"
 
 namespace {
-constexpr int kSectorSize = FlashDisk::kSectorSize;
-FlashDisk* g_disk;
+BlockDevice* g_disk;
+FATFS* g_fs;
+std::function<void()> g_sync_callback;
 
 bool fs_initialized = false;
+
+// FatFS writes the FATs and directories, subdirectories included, through the
+// volume's window. Anything else it writes to the data area while mounted is
+// the contents of a regular file, from the file's buffer or straight from the
+// caller's.
+bool IsFileContents(const BYTE* buffer, LBA_t sector) {
+  return g_fs != nullptr && g_fs->fs_type != 0 && buffer != g_fs->win &&
+         sector >= g_fs->database;
+}
+
+// Marks the whole cluster, which is a flash sector, so that devices that split
+// sectors pass the mark on.
+void MarkCluster(LBA_t sector) {
+  const LBA_t offset = (sector - g_fs->database) % g_fs->csize;
+  g_disk->MarkDataOnly(sector - offset, g_fs->csize);
+}
 }  // namespace
 
 ///////////////////////////
@@ -47,19 +69,39 @@ DSTATUS disk_status(BYTE drive) { return 0; }
 
 DRESULT disk_ioctl(BYTE drive, BYTE command, void* buffer) {
   switch (command) {
-    case CTRL_SYNC:
+    case CTRL_SYNC: {
+      // Issued by FatFS at the end of f_sync() and f_close().
+      const uint64_t start = time_us_64();
+      g_disk->Sync();
+      const uint32_t duration_us = time_us_64() - start;
+      Stats& stats = Stats::Global();
+      stats.fs_syncs.Add();
+      stats.fs_sync_last_us.Set(duration_us);
+      stats.fs_sync_max_us.RecordMax(duration_us);
+      if (g_sync_callback) {
+        g_sync_callback();
+      }
       return RES_OK;
+    }
     case GET_SECTOR_COUNT: {
       *reinterpret_cast<LBA_t*>(buffer) = g_disk->SectorCount();
       return RES_OK;
     }
     case GET_BLOCK_SIZE: {
-      *reinterpret_cast<DWORD*>(buffer) = 1;
+      // Erase block size in sectors, which FatFS aligns the data area to.
+      *reinterpret_cast<DWORD*>(buffer) =
+          BlockDevice::kSectorSize / g_disk->SectorSize();
+      return RES_OK;
+    }
+    case CTRL_TRIM: {
+      // Issued by FatFS when it frees a cluster chain, with an inclusive
+      // range of sectors.
+      const auto* range = reinterpret_cast<const LBA_t*>(buffer);
+      g_disk->Trim(range[0], range[1] - range[0] + 1);
       return RES_OK;
     }
     default:
-      std::cout << fmt::format("Unsupported disk_ioctl command: {}", command)
-                << std::endl;
+      Log("Unsupported disk_ioctl command: {}", command);
       return RES_PARERR;
   }
   return RES_OK;
@@ -67,18 +109,26 @@ DRESULT disk_ioctl(BYTE drive, BYTE command, void* buffer) {
 
 DRESULT disk_read(BYTE drive, BYTE* buffer, LBA_t start_sector,
                   UINT sector_count) {
-  auto* out = reinterpret_cast<FlashDisk::Sector*>(buffer);
+  PROFILE_SCOPE("disk_read");
+  const int sector_size = g_disk->SectorSize();
   for (int i = 0; i < sector_count; ++i) {
-    std::memcpy(*out++, g_disk->ReadSector(start_sector + i), kSectorSize);
+    std::memcpy(buffer + i * sector_size,
+                g_disk->ReadSector(start_sector + i).data(), sector_size);
   }
   return RES_OK;
 }
 
 DRESULT disk_write(BYTE drive, const BYTE* buffer, LBA_t start_sector,
                    UINT sector_count) {
-  auto* in = reinterpret_cast<const FlashDisk::Sector*>(buffer);
+  PROFILE_SCOPE("disk_write");
+  const int sector_size = g_disk->SectorSize();
   for (int i = 0; i < sector_count; ++i) {
-    g_disk->WriteSector(start_sector + i, *(in++));
+    if (IsFileContents(buffer, start_sector + i)) {
+      MarkCluster(start_sector + i);
+    }
+    g_disk->WriteSector(start_sector + i,
+                        std::as_bytes(std::span(buffer + i * sector_size,
+                                                sector_size)));
   }
   return RES_OK;
 }
@@ -163,33 +213,55 @@ void ThrowIfError(std::string_view op, FRESULT result) {
 }
 
 void CreateFileSystem() {
-  const LBA_t partition_sizes[] = {g_disk->SectorCount() - 5};
-  std::array<BYTE, kSectorSize> work_area;
+  // Nothing on the disk is file contents any more.
+  g_disk->ClearDataOnly(0, g_disk->SectorCount());
+  const int split = BlockDevice::kSectorSize / g_disk->SectorSize();
+  const LBA_t partition_sizes[] = {g_disk->SectorCount() - 5 * split};
+  std::array<BYTE, BlockDevice::kSectorSize> work_area;
   ThrowIfError("fdisk", f_fdisk(0, partition_sizes, work_area.data()));
+  // Clusters of one flash sector each, whatever the sector size.
+  const MKFS_PARM options = {.fmt = FM_ANY,
+                             .au_size = BlockDevice::kSectorSize};
   ThrowIfError("mkfs",
-               f_mkfs("0:", nullptr, work_area.data(), work_area.size()));
+               f_mkfs("0:", &options, work_area.data(), work_area.size()));
 }
 }  // namespace
 
 void FileSystem::Install() {
+  if (disk_.SectorSize() != FF_MAX_SS) {
+    throw std::invalid_argument(
+        fmt::format("Disk sector size {} does not match FatFS's {}",
+                    disk_.SectorSize(), FF_MAX_SS));
+  }
   g_disk = &disk_;
+  g_fs = &fs_;
 
-  std::cout << "FAT file system initialization start." << std::endl;
+  Log("FAT file system initialization start.");
   if (FRESULT result = f_mount(&fs_, "", 1); result == FR_NO_FILESYSTEM) {
-    std::cout << "No valid FAT filesystem found. Attempting to create it."
-              << std::endl;
+    Log("No valid FAT filesystem found. Attempting to create it.");
     CreateFileSystem();
     ThrowIfError("mount", f_mount(&fs_, "", 1));
   } else {
     ThrowIfError("mount", result);
-    std::cout << "Reusing existing FAT filesystem." << std::endl;
+    Log("Reusing existing FAT filesystem.");
   }
-  std::cout << "FAT file system initialization complete." << std::endl;
+  Log("FAT file system initialization complete.");
   fs_initialized = true;
 }
 
+void FileSystem::Remount() {
+  ThrowIfError("unmount", f_mount(nullptr, "", 0));
+  // The host may have reused file clusters for directories.
+  disk_.ClearDataOnly(0, disk_.SectorCount());
+  ThrowIfError("mount", f_mount(&fs_, "", 1));
+}
+
+void FileSystem::SetSyncCallback(std::function<void()> callback) {
+  g_sync_callback = std::move(callback);
+}
+
 File FileSystem::OpenFile(std::filesystem::path path, const OpenFlags& flags) {
-  BYTE mode;
+  BYTE mode = 0;
   auto add_flag = [&](bool enable, BYTE flag) {
     if (enable) {
       mode |= flag;
@@ -217,7 +289,7 @@ File::~File() {
   try {
     Close();
   } catch (const std::filesystem::filesystem_error& e) {
-    std::cout << "Error while destructing file: " << e.what() << std::endl;
+    Log("Error while destructing file: {}", e.what());
   }
 }
 
@@ -239,7 +311,7 @@ std::span<std::byte> File::Read(std::span<std::byte> buffer) {
   UINT bytes_read;
   ThrowIfError("read", f_read(fat_file_.get(), buffer.data(), buffer.size(),
                               &bytes_read));
-  return buffer.subspan(bytes_read);
+  return buffer.first(bytes_read);
 }
 
 std::string File::ReadAll() {
@@ -268,11 +340,25 @@ Directory FileSystem::OpenDirectory(std::filesystem::path path) {
   return dir;
 }
 
+int File::FirstSector() {
+  const FATFS& fs = *fat_file_->obj.fs;
+  // Data clusters are numbered from 2.
+  return fs.database + (fat_file_->obj.sclust - 2) * fs.csize;
+}
+
+void FileSystem::CreateDirectory(std::filesystem::path path) {
+  const FRESULT result = f_mkdir(path.c_str());
+  if (result == FR_EXIST) {
+    return;
+  }
+  ThrowIfError("mkdir", result);
+}
+
 Directory::~Directory() {
   try {
     ThrowIfError("closedir", f_closedir(fat_dir_.get()));
   } catch (const std::filesystem::filesystem_error& e) {
-    std::cout << "Error while closing directory: " << e.what() << std::endl;
+    Log("Error while closing directory: {}", e.what());
   }
 }
 
@@ -1,9 +1,10 @@
 #pragma once
 
 #include <ff.h>
-#include "flash.h"
+#include "block_device.h"
 
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <span>
 #include <vector>
@@ -13,7 +14,7 @@ class Directory;
 
 class FileSystem {
  public:
-  FileSystem(FlashDisk& disk) : disk_(disk) {}
+  FileSystem(BlockDevice& disk) : disk_(disk) {}
 
   // See http://elm-chan.org/fsw/ff/doc/open.html mode flags
   struct OpenFlags {
@@ -29,10 +30,20 @@ class FileSystem {
   File OpenFile(std::filesystem::path path, const OpenFlags& flags);
   Directory OpenDirectory(std::filesystem::path path);
 
+  // Does nothing if the directory already exists.
+  void CreateDirectory(std::filesystem::path path);
+
   void Install();
 
+  // Drops all cached filesystem state and mounts again, e.g. after the USB
+  // host has modified the volume. Open files and directories become invalid.
+  void Remount();
+
+  // Invoked whenever FatFS flushes its changes to the disk.
+  void SetSyncCallback(std::function<void()> callback);
+
  private:
-  FlashDisk& disk_;
+  BlockDevice& disk_;
   FATFS fs_;
 };
 
@@ -72,6 +83,10 @@ class File {
 
   void Sync();
 
+  // Disk sector holding the start of the file's data. Only meaningful for a
+  // non-empty file.
+  int FirstSector();
+
  private:
   friend class FileSystem;
   std::unique_ptr<FIL> fat_file_;
@@ -0,0 +1,402 @@
+#include "ftl.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#include "checksum.h"
+#include "logging.h"
+#include "stats.h"
+
+namespace {
+constexpr std::byte kErasedByte{0xFF};
+
+bool IsErased(std::span<const std::byte> data) {
+  return std::ranges::all_of(data,
+                             [](std::byte b) { return b == kErasedByte; });
+}
+}  // namespace
+
+FlashTranslationLayer::FlashTranslationLayer(FlashDisk& flash,
+                                             int spare_sectors)
+    : flash_(flash),
+      map_(flash.SectorCount() - kLogSectors - spare_sectors, kUnmapped),
+      erase_counts_(flash.SectorCount(), 0),
+      states_(flash.SectorCount(), State::kReleased) {
+  Mount();
+}
+
+std::span<const std::byte> FlashTranslationLayer::ReadSector(int i) {
+  CheckInRange(i);
+  static constexpr std::array<std::byte, kSectorSize> kBlankSector = {};
+  if (map_[i] == kUnmapped) {
+    return kBlankSector;
+  }
+  return flash_.ReadSector(map_[i]);
+}
+
+void FlashTranslationLayer::WriteSector(int i,
+                                        std::span<const std::byte> payload) {
+  CheckInRange(i);
+  if (payload.size() != kSectorSize) {
+    throw std::length_error(
+        fmt::format("Payload size does not match sector size: {} vs {}",
+                    payload.size(), kSectorSize));
+  }
+  if (map_[i] != kUnmapped &&
+      std::ranges::equal(flash_.ReadSector(map_[i]), payload)) {
+    return;
+  }
+  Remap(i, payload);
+}
+
+void FlashTranslationLayer::Trim(int first, int count) {
+  for (int i = first; i < first + count; ++i) {
+    CheckInRange(i);
+    const uint16_t physical = map_[i];
+    if (physical == kUnmapped) {
+      continue;
+    }
+    map_[i] = kUnmapped;
+    pending_trims_.push_back(
+        {.logical = static_cast<uint16_t>(i), .physical = physical});
+  }
+}
+
+void FlashTranslationLayer::Task() {
+  if (!pending_trims_.empty()) {
+    FlushTrims();
+    return;
+  }
+  // Checked before pre-erasing: steady writes always leave a released sector,
+  // which would otherwise starve wear leveling.
+  if (remaps_since_wear_check_ >= kWearLevelCheckInterval) {
+    remaps_since_wear_check_ = 0;
+    LevelWear();
+    return;
+  }
+  // Erasing the least worn keeps the hot sectors from ping-ponging between
+  // the first released ones while the other spares sit idle.
+  int least_worn = -1;
+  for (int physical = 0; physical < states_.size(); ++physical) {
+    if (states_[physical] == State::kReleased &&
+        (least_worn < 0 ||
+         erase_counts_[physical] < erase_counts_[least_worn])) {
+      least_worn = physical;
+    }
+  }
+  if (least_worn >= 0) {
+    Erase(least_worn);
+  }
+}
+
+uint32_t FlashTranslationLayer::MinEraseCount() {
+  return std::ranges::min(std::span(erase_counts_).subspan(kLogSectors));
+}
+
+uint32_t FlashTranslationLayer::MaxEraseCount() {
+  return std::ranges::max(std::span(erase_counts_).subspan(kLogSectors));
+}
+
+uint32_t FlashTranslationLayer::MeanEraseCount() {
+  const auto data_counts = std::span(erase_counts_).subspan(kLogSectors);
+  return std::accumulate(data_counts.begin(), data_counts.end(), uint64_t{0}) /
+         data_counts.size();
+}
+
+void FlashTranslationLayer::Mount() {
+  // The newest valid snapshot wins. Older log sectors are stale, and a newer
+  // one with an invalid snapshot was interrupted while being written.
+  int newest = -1;
+  uint32_t newest_sequence = 0;
+  for (int log_sector = 0; log_sector < kLogSectors; ++log_sector) {
+    if (LoadSnapshot(log_sector, newest_sequence)) {
+      newest = log_sector;
+      newest_sequence = sequence_;
+    }
+  }
+
+  if (newest >= 0) {
+    // Reload, since a later log sector may have overwritten the state.
+    LoadSnapshot(newest, 0);
+    log_sector_ = newest;
+    ReplayRecords();
+  }
+
+  for (int physical = 0; physical < states_.size(); ++physical) {
+    if (physical < kLogSectors) {
+      states_[physical] = State::kLog;
+    } else if (IsErased(flash_.ReadSector(physical))) {
+      states_[physical] = State::kErased;
+    } else {
+      states_[physical] = State::kReleased;
+    }
+  }
+  for (uint16_t physical : map_) {
+    if (physical != kUnmapped) {
+      states_[physical] = State::kMapped;
+    }
+  }
+
+  if (newest < 0) {
+    Log("No flash translation layer found. Creating it.");
+    WriteSnapshot();
+  }
+  Log("Flash translation layer mounted: {} logical sectors, log sequence {}, "
+      "erase counts {}-{}",
+      map_.size(), sequence_, MinEraseCount(), MaxEraseCount());
+}
+
+bool FlashTranslationLayer::LoadSnapshot(int log_sector,
+                                         uint32_t min_sequence) {
+  const std::span<const std::byte> data = flash_.ReadSector(log_sector);
+  SnapshotHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != kSnapshotMagic || header.sequence < min_sequence ||
+      header.logical_count != map_.size() ||
+      header.physical_count != erase_counts_.size()) {
+    return false;
+  }
+  const std::size_t map_bytes = map_.size() * sizeof(map_[0]);
+  const std::size_t counts_bytes =
+      erase_counts_.size() * sizeof(erase_counts_[0]);
+  std::vector<std::byte> snapshot(
+      data.begin(),
+      data.begin() + sizeof(header) + map_bytes + counts_bytes);
+  std::memset(snapshot.data() + offsetof(SnapshotHeader, checksum), 0,
+              sizeof(header.checksum));
+  if (Checksum(snapshot) != header.checksum) {
+    return false;
+  }
+  std::memcpy(map_.data(), snapshot.data() + sizeof(header), map_bytes);
+  std::memcpy(erase_counts_.data(),
+              snapshot.data() + sizeof(header) + map_bytes, counts_bytes);
+  sequence_ = header.sequence;
+  return true;
+}
+
+void FlashTranslationLayer::ReplayRecords() {
+  const std::span<const std::byte> data = flash_.ReadSector(log_sector_);
+  log_records_ = 0;
+  while (log_records_ < RecordCapacity()) {
+    Record record;
+    std::memcpy(&record,
+                data.data() + SnapshotSize() + log_records_ * sizeof(Record),
+                sizeof(record));
+    if (record.checksum != RecordChecksum(record) ||
+        record.sequence != sequence_ + 1 || record.logical >= map_.size() ||
+        (record.physical != kUnmapped &&
+         record.physical >= erase_counts_.size())) {
+      // Unwritten, or interrupted while being written.
+      return;
+    }
+    map_[record.logical] = record.physical;
+    if (record.physical != kUnmapped) {
+      erase_counts_[record.physical] = record.erase_count;
+    }
+    sequence_ = record.sequence;
+    ++log_records_;
+  }
+}
+
+void FlashTranslationLayer::WriteSnapshot() {
+  const int next = (log_sector_ + 1) % kLogSectors;
+  Erase(next);
+
+  const SnapshotHeader header = {
+      .magic = kSnapshotMagic,
+      .sequence = ++sequence_,
+      .logical_count = static_cast<uint16_t>(map_.size()),
+      .physical_count = static_cast<uint16_t>(erase_counts_.size()),
+      .checksum = 0,
+  };
+  const std::size_t map_bytes = map_.size() * sizeof(map_[0]);
+  const std::size_t counts_bytes =
+      erase_counts_.size() * sizeof(erase_counts_[0]);
+  std::vector<std::byte> snapshot(SnapshotSize(), kErasedByte);
+  std::memcpy(snapshot.data(), &header, sizeof(header));
+  std::memcpy(snapshot.data() + sizeof(header), map_.data(), map_bytes);
+  std::memcpy(snapshot.data() + sizeof(header) + map_bytes,
+              erase_counts_.data(), counts_bytes);
+  const uint32_t checksum = Checksum(
+      std::span(snapshot).first(sizeof(header) + map_bytes + counts_bytes));
+  std::memcpy(snapshot.data() + offsetof(SnapshotHeader, checksum), &checksum,
+              sizeof(checksum));
+
+  flash_.ProgramPages(next, 0, snapshot);
+  log_sector_ = next;
+  log_records_ = 0;
+  // The snapshot has every trim so far in its map.
+  ReleaseTrims();
+}
+
+void FlashTranslationLayer::AppendRecords(
+    std::span<const uint16_t> logicals) {
+  while (!logicals.empty()) {
+    if (log_records_ == RecordCapacity()) {
+      // The snapshot captures these remaps too.
+      WriteSnapshot();
+      return;
+    }
+    // Records never straddle pages, since the snapshot is padded to whole
+    // pages. Fill as much of the current page as there are records for.
+    const std::size_t offset = SnapshotSize() + log_records_ * sizeof(Record);
+    const std::size_t page_offset =
+        offset / FlashDisk::kPageSize * FlashDisk::kPageSize;
+    const std::size_t count = std::min<std::size_t>(
+        logicals.size(),
+        (page_offset + FlashDisk::kPageSize - offset) / sizeof(Record));
+    // Reprogramming the records already in the page leaves them as they are.
+    std::array<std::byte, FlashDisk::kPageSize> page;
+    std::ranges::copy(flash_.ReadSector(log_sector_).subspan(
+                          page_offset, FlashDisk::kPageSize),
+                      page.begin());
+    for (std::size_t j = 0; j < count; ++j) {
+      const uint16_t physical = map_[logicals[j]];
+      Record record = {
+          .logical = logicals[j],
+          .physical = physical,
+          .sequence = sequence_ + 1 + static_cast<uint32_t>(j),
+          .erase_count = physical == kUnmapped ? 0 : erase_counts_[physical],
+      };
+      record.checksum = RecordChecksum(record);
+      std::memcpy(page.data() + (offset - page_offset) + j * sizeof(Record),
+                  &record, sizeof(record));
+    }
+    flash_.ProgramPages(log_sector_, page_offset, page);
+    sequence_ += count;
+    log_records_ += count;
+    logicals = logicals.subspan(count);
+  }
+}
+
+void FlashTranslationLayer::FlushTrims() {
+  std::vector<uint16_t> logicals;
+  logicals.reserve(pending_trims_.size());
+  for (const PendingTrim& trim : pending_trims_) {
+    logicals.push_back(trim.logical);
+  }
+  AppendRecords(logicals);
+  ReleaseTrims();
+}
+
+void FlashTranslationLayer::ReleaseTrims() {
+  for (const PendingTrim& trim : pending_trims_) {
+    states_[trim.physical] = State::kReleased;
+  }
+  Stats::Global().flash_trimmed_sectors.Add(pending_trims_.size());
+  pending_trims_.clear();
+}
+
+void FlashTranslationLayer::Remap(int logical,
+                                  std::span<const std::byte> payload,
+                                  bool most_worn) {
+  const int physical = Allocate(most_worn);
+  flash_.ProgramPages(physical, 0, payload);
+  uint16_t previous = map_[logical];
+  // A pending trim's record would undo this remap if appended after it.
+  const auto trim = std::ranges::find(pending_trims_, logical,
+                                      &PendingTrim::logical);
+  if (trim != pending_trims_.end()) {
+    previous = trim->physical;
+    pending_trims_.erase(trim);
+  }
+  map_[logical] = physical;
+  states_[physical] = State::kMapped;
+  const uint16_t entry = logical;
+  AppendRecords(std::span(&entry, 1));
+  // Only reusable once the new mapping is durable.
+  if (previous != kUnmapped) {
+    states_[previous] = State::kReleased;
+  }
+  ++remaps_since_wear_check_;
+}
+
+int FlashTranslationLayer::Allocate(bool most_worn) {
+  int best = -1;
+  auto better = [&](int physical) {
+    if (best < 0) {
+      return true;
+    }
+    // Avoid an erase on the write path where possible.
+    if (states_[physical] != states_[best]) {
+      return states_[physical] == State::kErased;
+    }
+    return most_worn ? erase_counts_[physical] > erase_counts_[best]
+                     : erase_counts_[physical] < erase_counts_[best];
+  };
+  for (int physical = 0; physical < states_.size(); ++physical) {
+    const State state = states_[physical];
+    if ((state == State::kErased || state == State::kReleased) &&
+        better(physical)) {
+      best = physical;
+    }
+  }
+  if (best < 0) {
+    throw std::runtime_error("No free flash sectors.");
+  }
+  if (states_[best] == State::kReleased) {
+    Erase(best);
+  } else {
+    Stats::Global().flash_preerased_writes.Add();
+  }
+  return best;
+}
+
+void FlashTranslationLayer::Erase(int physical) {
+  flash_.EraseSector(physical);
+  ++erase_counts_[physical];
+  if (states_[physical] != State::kLog) {
+    states_[physical] = State::kErased;
+  }
+}
+
+void FlashTranslationLayer::LevelWear() {
+  int coldest_logical = -1;
+  for (int logical = 0; logical < map_.size(); ++logical) {
+    if (map_[logical] == kUnmapped) {
+      continue;
+    }
+    if (coldest_logical < 0 || erase_counts_[map_[logical]] <
+                                   erase_counts_[map_[coldest_logical]]) {
+      coldest_logical = logical;
+    }
+  }
+  if (coldest_logical < 0 ||
+      MaxEraseCount() - erase_counts_[map_[coldest_logical]] <=
+          kWearLevelThreshold) {
+    return;
+  }
+  // Flash can't be read while it is being programmed, so stage the data in
+  // RAM. The barely-worn sector it leaves behind then takes new writes.
+  const std::span<const std::byte> cold =
+      flash_.ReadSector(map_[coldest_logical]);
+  const std::vector<std::byte> data(cold.begin(), cold.end());
+  Remap(coldest_logical, data, /*most_worn=*/true);
+}
+
+std::size_t FlashTranslationLayer::SnapshotSize() {
+  const std::size_t size = sizeof(SnapshotHeader) +
+                           map_.size() * sizeof(map_[0]) +
+                           erase_counts_.size() * sizeof(erase_counts_[0]);
+  return (size + FlashDisk::kPageSize - 1) / FlashDisk::kPageSize *
+         FlashDisk::kPageSize;
+}
+
+int FlashTranslationLayer::RecordCapacity() {
+  return (kSectorSize - SnapshotSize()) / sizeof(Record);
+}
+
+void FlashTranslationLayer::CheckInRange(int i) {
+  if (i >= 0 && i < map_.size()) {
+    return;
+  }
+  throw std::out_of_range(
+      fmt::format("Logical sector index {} is out of valid range [0, {})", i,
+                  map_.size()));
+}
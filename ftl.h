@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "block_device.h"
+#include "flash.h"
+
+// Log-structured flash translation layer that spreads erases evenly across
+// the flash, so metadata that FatFS rewrites constantly does not wear out its
+// sectors.
+//
+// Every write remaps the logical sector onto a free physical sector, picking
+// the least-erased one, and releases the physical sector it replaces. The
+// logical-to-physical map lives in RAM and is persisted in a small ring of log
+// sectors, as a snapshot followed by one 16-byte record per remap. A write is
+// durable as soon as WriteSector() returns, and mounting only has to scan a
+// single log sector.
+class FlashTranslationLayer : public BlockDevice {
+ public:
+  // Physical sectors at the start of the flash that hold the map log.
+  static constexpr int kLogSectors = 4;
+
+  // Background wear leveling moves cold data once the most-erased data sector
+  // is this many erases ahead of the least-erased sector holding data.
+  static constexpr uint32_t kWearLevelThreshold = 64;
+
+  // Any existing contents that were not written by this layer are discarded.
+  //
+  // spare_sectors: Physical sectors held back from the logical capacity, so
+  // that there is always somewhere to write new data to.
+  FlashTranslationLayer(FlashDisk& flash, int spare_sectors = 8);
+
+  // Sectors that have never been written, or were trimmed since, read as
+  // zeroes.
+  std::span<const std::byte> ReadSector(int i) override;
+
+  void WriteSector(int i, std::span<const std::byte> payload) override;
+
+  std::size_t SectorCount() override { return map_.size(); }
+
+  // Unmaps the sectors in RAM. Task() persists that later, packing the
+  // records of many trimmed sectors into each page program, and only then
+  // releases their physical sectors to be erased ahead of later writes. Trims
+  // not yet persisted are lost on power loss, leaving the old data mapped.
+  void Trim(int first, int count) override;
+
+  // Does a bounded amount of background work: persisting pending trims,
+  // erasing one released sector so later writes are program-only, or moving
+  // one cold sector's data onto a worn sector.
+  void Task();
+
+  // Erase count statistics over the data sectors.
+  uint32_t MinEraseCount();
+  uint32_t MaxEraseCount();
+  uint32_t MeanEraseCount();
+
+ private:
+  static constexpr uint16_t kUnmapped = 0xFFFF;
+  static constexpr uint32_t kSnapshotMagic = 0x314C5446;  // "FTL1"
+
+  // Remaps between wear leveling checks.
+  static constexpr int kWearLevelCheckInterval = 64;
+
+  enum class State : uint8_t {
+    // Free, and ready to be programmed.
+    kErased,
+    // Free, but needs an erase before reuse.
+    kReleased,
+    kMapped,
+    kLog,
+  };
+
+  // Appended to the current log sector for each remap.
+  struct Record {
+    uint16_t logical;
+    uint16_t physical;
+    uint32_t sequence;
+    // Erase count of the physical sector.
+    uint32_t erase_count;
+    uint32_t checksum;
+  };
+  static_assert(sizeof(Record) == 16);
+
+  // Starts each log sector. Followed by the map (one uint16_t per logical
+  // sector) and the erase counts (one uint32_t per physical sector), then
+  // padded to a whole number of pages.
+  struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t logical_count;
+    uint16_t physical_count;
+    // Covers the whole snapshot, with this field set to 0.
+    uint32_t checksum;
+  };
+
+  void Mount();
+
+  // Returns whether the log sector holds a valid snapshot, and if so, loads it
+  // into the map and erase counts.
+  bool LoadSnapshot(int log_sector, uint32_t min_sequence);
+
+  // Applies the records that follow the current snapshot.
+  void ReplayRecords();
+
+  // Writes a snapshot of the current state to the next log sector, making it
+  // the current one.
+  void WriteSnapshot();
+
+  // Persists the current mapping of the given logical sectors, programming
+  // each log page once.
+  void AppendRecords(std::span<const uint16_t> logicals);
+
+  // Persists the pending trims and releases their physical sectors.
+  void FlushTrims();
+  // Releases the physical sectors of pending trims, once the log has recorded
+  // them.
+  void ReleaseTrims();
+
+  // Writes the payload to a newly allocated physical sector and points the
+  // logical sector at it.
+  void Remap(int logical, std::span<const std::byte> payload,
+             bool most_worn = false);
+
+  // Returns an erased physical sector with the lowest (or highest) erase count
+  // among the free ones, erasing it first if needed.
+  int Allocate(bool most_worn);
+
+  void Erase(int physical);
+
+  // Moves the data on the least-erased mapped sector, if it has fallen too far
+  // behind the most-erased one.
+  void LevelWear();
+
+  std::size_t SnapshotSize();
+  int RecordCapacity();
+  void CheckInRange(int i);
+
+  FlashDisk& flash_;
+
+  // A trimmed sector whose unmapping isn't in the log yet. Its physical sector
+  // stays kMapped until then, since after a power loss it would be again.
+  struct PendingTrim {
+    uint16_t logical;
+    uint16_t physical;
+  };
+
+  // Indexed by logical sector.
+  std::vector<uint16_t> map_;
+  // Indexed by physical sector.
+  std::vector<uint32_t> erase_counts_;
+  std::vector<State> states_;
+  std::vector<PendingTrim> pending_trims_;
+
+  int log_sector_ = kLogSectors - 1;
+  int log_records_ = 0;
+  uint32_t sequence_ = 0;
+  int remaps_since_wear_check_ = 0;
+};
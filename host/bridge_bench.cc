@@ -0,0 +1,268 @@
+// Drives simulated traffic patterns through the bridge and reports throughput,
+// latency and loss per direction. Runs entirely on simulated time, so results
+// are deterministic. Exits with failure if a scenario that should be lossless
+// lost data.
+//
+//   bridge_bench [scenario...]
+
+#include <fmt/core.h>
+#include <pico/time.h>
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bridge_rig.h"
+#include "sim.h"
+#include "stats.h"
+
+namespace {
+struct Scenario {
+  std::string_view name;
+  std::string_view description;
+  std::vector<BridgeRig::ChannelConfig> channels;
+  uint64_t duration_us;
+  // Called every 100 us of simulated time to generate traffic.
+  std::function<void(BridgeRig&, uint64_t now_us)> traffic;
+  bool lossless = true;
+};
+
+constexpr uint64_t kTickUs = 100;
+// How much a host application keeps queued in the OS for a port it streams
+// to.
+constexpr std::size_t kHostWindow = 4096;
+
+// Keeps the far end of the UART busy.
+void SaturateUart(BridgeRig& rig, int channel) {
+  if (rig.GetChannel(channel).uart->FarEndPending() < 256) {
+    rig.UartSend(channel, 256);
+  }
+}
+
+void SaturateUsb(BridgeRig& rig, int channel) {
+  if (rig.UsbSendPending(channel) < kHostWindow) {
+    rig.UsbSend(channel, kHostWindow);
+  }
+}
+
+std::vector<BridgeRig::ChannelConfig> Channels(int count, uint32_t baud_rate) {
+  return std::vector<BridgeRig::ChannelConfig>(count, {.baud_rate = baud_rate});
+}
+
+std::vector<Scenario> Scenarios() {
+  return {
+      {
+          .name = "burst",
+          .description = "2 KB bursts each way every 100 ms at 921600 baud",
+          .channels = Channels(1, 921'600),
+          .duration_us = 1'000'000,
+          .traffic =
+              [](BridgeRig& rig, uint64_t now) {
+                if (now % 100'000 == 0) {
+                  rig.UartSend(0, 2048);
+                }
+                if (now % 100'000 == 50'000) {
+                  rig.UsbSend(0, 2048);
+                }
+              },
+      },
+      {
+          .name = "full_duplex",
+          .description = "Both directions saturated at 921600 baud",
+          .channels = Channels(1, 921'600),
+          .duration_us = 1'000'000,
+          .traffic =
+              [](BridgeRig& rig, uint64_t now) {
+                SaturateUart(rig, 0);
+                SaturateUsb(rig, 0);
+              },
+      },
+      {
+          .name = "interactive",
+          .description = "8-byte packets each way every 20 ms at 115200 baud",
+          .channels = Channels(1, 115'200),
+          .duration_us = 1'000'000,
+          .traffic =
+              [](BridgeRig& rig, uint64_t now) {
+                if (now % 20'000 == 0) {
+                  rig.UartSend(0, 8);
+                }
+                if (now % 20'000 == 10'000) {
+                  rig.UsbSend(0, 8);
+                }
+              },
+      },
+      {
+          .name = "mixed",
+          .description = "Channel 0 saturated both ways at 921600, 8-byte "
+                         "packets every 20 ms on 1-3 at 115200",
+          .channels = {{.baud_rate = 921'600},
+                       {.baud_rate = 115'200},
+                       {.baud_rate = 115'200},
+                       {.baud_rate = 115'200}},
+          .duration_us = 1'000'000,
+          .traffic =
+              [](BridgeRig& rig, uint64_t now) {
+                SaturateUart(rig, 0);
+                SaturateUsb(rig, 0);
+                for (int i = 1; i < rig.ChannelCount(); ++i) {
+                  if (now % 20'000 == 0) {
+                    rig.UartSend(i, 8);
+                    rig.UsbSend(i, 8);
+                  }
+                }
+              },
+      },
+      {
+          .name = "saturating",
+          .description = "UART to USB saturated on all 4 channels at 921600",
+          .channels = Channels(4, 921'600),
+          .duration_us = 1'000'000,
+          .traffic =
+              [](BridgeRig& rig, uint64_t now) {
+                for (int i = 0; i < rig.ChannelCount(); ++i) {
+                  SaturateUart(rig, i);
+                }
+              },
+      },
+      {
+          .name = "bus_limited",
+          .description = "UART to USB saturated on all 4 channels at 3M baud "
+                         "with RTS/CTS, more than the bus carries",
+          .channels = std::vector<BridgeRig::ChannelConfig>(
+              4, {.baud_rate = 3'000'000,
+                  .flow_control = FlowControl::kHardware}),
+          .duration_us = 1'000'000,
+          .traffic =
+              [](BridgeRig& rig, uint64_t now) {
+                for (int i = 0; i < rig.ChannelCount(); ++i) {
+                  SaturateUart(rig, i);
+                }
+              },
+      },
+      {
+          .name = "saturating_duplex",
+          .description =
+              "Both directions saturated on all 4 channels at 921600",
+          .channels = Channels(4, 921'600),
+          .duration_us = 1'000'000,
+          .traffic =
+              [](BridgeRig& rig, uint64_t now) {
+                for (int i = 0; i < rig.ChannelCount(); ++i) {
+                  SaturateUart(rig, i);
+                  SaturateUsb(rig, i);
+                }
+              },
+      },
+  };
+}
+
+void PrintDirection(std::string_view name, BridgeRig::Direction& direction,
+                    uint64_t duration_us) {
+  TrafficStream& stream = direction.stream;
+  fmt::print(
+      "  {:<12} {:>9} {:>9} {:>6} {:>9.1f} {:>8} {:>8} {:>8}\n", name,
+      stream.Sent(), stream.ReceivedBytes(),
+      stream.Lost() + stream.Unexpected(),
+      stream.ReceivedBytes() * 1e3 / duration_us,
+      stream.LatencyPercentileUs(50), stream.LatencyPercentileUs(99),
+      stream.LatencyPercentileUs(100));
+}
+
+// Total throughput of one direction over all channels, and how evenly the
+// channels shared it: Jain's fairness index, from 1/n when one channel got
+// everything up to 1 when all got the same.
+void PrintAggregate(BridgeRig& rig,
+                    BridgeRig::Direction BridgeRig::Channel::*direction,
+                    std::string_view name, uint64_t duration_us) {
+  double sum = 0;
+  double sum_of_squares = 0;
+  for (int i = 0; i < rig.ChannelCount(); ++i) {
+    const double received =
+        (rig.GetChannel(i).*direction).stream.ReceivedBytes();
+    sum += received;
+    sum_of_squares += received * received;
+  }
+  if (sum == 0) {
+    return;
+  }
+  fmt::print("  {:<12} {:>9.1f} KB/s, fairness {:.3f}\n",
+             fmt::format("all {}", name), sum * 1e3 / duration_us,
+             sum * sum / (rig.ChannelCount() * sum_of_squares));
+}
+
+// Runs the scenario, then lets traffic in flight drain. Returns whether it was
+// lossless, or didn't need to be.
+bool Run(const Scenario& scenario) {
+  Stats& stats = Stats::Global();
+  for (ChannelStats& channel : stats.channels) {
+    for (Counter* counter :
+         {&channel.usb_tx_full, &channel.rx_ring_overruns,
+          &channel.rx_ring_high_water, &channel.bridge_dropped_bytes}) {
+      counter->Set(0);
+    }
+  }
+
+  BridgeRig rig(scenario.channels);
+  for (uint64_t now = 0; now < scenario.duration_us; now += kTickUs) {
+    scenario.traffic(rig, now);
+    rig.RunUntil(now + kTickUs);
+  }
+  // Stop generating, but let what was sent arrive.
+  rig.RunFor(200'000);
+
+  fmt::print("{}: {}\n", scenario.name, scenario.description);
+  fmt::print("  {:<12} {:>9} {:>9} {:>6} {:>9} {:>8} {:>8} {:>8}\n", "", "sent",
+             "received", "lost", "KB/s", "p50 us", "p99 us", "max us");
+  uint64_t lost = 0;
+  for (int i = 0; i < rig.ChannelCount(); ++i) {
+    BridgeRig::Channel& channel = rig.GetChannel(i);
+    for (auto [name, direction] :
+         {std::pair{"usb->uart", &channel.usb_to_uart},
+          std::pair{"uart->usb", &channel.uart_to_usb}}) {
+      if (direction->stream.Sent() == 0) {
+        continue;
+      }
+      PrintDirection(fmt::format("{} {}", i, name), *direction,
+                     scenario.duration_us);
+      lost += direction->stream.Lost() + direction->stream.Outstanding() +
+              direction->stream.Unexpected();
+    }
+    const ChannelStats& channel_stats = stats.channels[i];
+    fmt::print(
+        "  {} usb_tx_full={} rx_ring_overruns={} rx_ring_high_water={} "
+        "bridge_dropped_bytes={}\n",
+        i, channel_stats.usb_tx_full.Get(),
+        channel_stats.rx_ring_overruns.Get(),
+        channel_stats.rx_ring_high_water.Get(),
+        channel_stats.bridge_dropped_bytes.Get());
+  }
+  if (rig.ChannelCount() > 1) {
+    PrintAggregate(rig, &BridgeRig::Channel::usb_to_uart, "usb->uart",
+                   scenario.duration_us);
+    PrintAggregate(rig, &BridgeRig::Channel::uart_to_usb, "uart->usb",
+                   scenario.duration_us);
+  }
+  fmt::print("  longest interrupts-off stretch: {} us\n\n",
+             Sim::Instance().MaxInterruptsOffUs());
+  return !scenario.lossless || lost == 0;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const std::vector<std::string_view> selected(argv + 1, argv + argc);
+  bool ok = true;
+  for (const Scenario& scenario : Scenarios()) {
+    if (!selected.empty() && std::ranges::find(selected, scenario.name) ==
+                                 selected.end()) {
+      continue;
+    }
+    if (!Run(scenario)) {
+      fmt::print("FAILED: {} lost data\n", scenario.name);
+      ok = false;
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+#include "bridge_rig.h"
+
+#include <fmt/core.h>
+#include <pico/time.h>
+
+#include "logging.h"
+#include "sim.h"
+#include "sim_usb.h"
+#include "stats.h"
+
+BridgeRig::BridgeRig(std::span<const ChannelConfig> configs, uint64_t loop_us)
+    : loop_us_(loop_us), bridge_(*this) {
+  Sim::Instance().Reset();
+  SimUsb::Instance().Reset();
+  usb_.AddCdc("Debug Console");
+  for (std::size_t i = 0; i < configs.size(); ++i) {
+    CdcDevice& cdc = usb_.AddCdc(fmt::format("RS232 Data {}", i));
+    Channel& channel = channels_.emplace_back(Channel{
+        .uart = std::make_unique<SimUart>(Stats::Global().channels[i],
+                                          configs[i].baud_rate,
+                                          configs[i].flow_control),
+        .cdc = &cdc,
+    });
+    if (configs[i].wrap_uart) {
+      channel.wrapped_uart = configs[i].wrap_uart(*channel.uart);
+    }
+    bridge_.AddChannel(
+        i, cdc,
+        channel.wrapped_uart ? *channel.wrapped_uart : *channel.uart,
+        configs[i].framer);
+  }
+  usb_.Install();
+  for (std::size_t i = 0; i < channels_.size(); ++i) {
+    Channel& channel = channels_[i];
+    SimUsb::Instance().Open(i + 1);
+    channel.uart->SetRxMonitor([&channel](char, uint64_t time_us) {
+      channel.uart_to_usb.stream.Started(time_us);
+    });
+    channel.uart->SetFarEndReceiver([&channel](char byte, uint64_t time_us) {
+      channel.usb_to_uart.stream.Received(byte, time_us);
+    });
+  }
+  SimUsb::Instance().SetReceiver(
+      [this](uint8_t itf, std::span<const char> data, uint64_t time_us) {
+        if (itf == 0) {
+          return;
+        }
+        for (char byte : data) {
+          channels_[itf - 1].uart_to_usb.stream.Received(byte, time_us);
+        }
+      });
+}
+
+BridgeRig::~BridgeRig() {
+  // Drops the USB timer, which refers to this rig's UsbDevice.
+  Sim::Instance().Reset();
+}
+
+void BridgeRig::UartSend(int channel, std::size_t size,
+                         uint64_t not_before_us) {
+  Channel& c = channels_[channel];
+  c.uart->FarEndSend(c.uart_to_usb.stream.Next(size), not_before_us);
+}
+
+void BridgeRig::UartSend(int channel, std::string_view data,
+                         uint64_t not_before_us) {
+  Channel& c = channels_[channel];
+  c.uart->FarEndSend(c.uart_to_usb.stream.Next(data), not_before_us);
+}
+
+void BridgeRig::UsbSend(int channel, std::size_t size) {
+  Channel& c = channels_[channel];
+  SimUsb::Instance().Send(channel + 1, c.usb_to_uart.stream.Next(size));
+  c.usb_to_uart.stream.Started(size, time_us_64());
+}
+
+std::size_t BridgeRig::UsbSendPending(int channel) {
+  return SimUsb::Instance().SendPending(channel + 1);
+}
+
+void BridgeRig::RunUntil(uint64_t time_us) {
+  while (time_us_64() < time_us) {
+    usb_.Task();
+    bridge_.Task();
+    DrainLog(log_);
+    log_.str({});
+    Sim::Instance().Advance(loop_us_);
+  }
+}
+
+void BridgeRig::RunFor(uint64_t us) { RunUntil(time_us_64() + us); }
+
+void BridgeRig::Record(int channel, CaptureDirection direction,
+                       std::span<const char> data, uint64_t time_us) {
+  Channel& c = channels_[channel];
+  (direction == CaptureDirection::kUsbToUart ? c.usb_to_uart : c.uart_to_usb)
+      .captured += data.size();
+}
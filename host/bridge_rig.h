@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+#include "bridge.h"
+#include "capture_sink.h"
+#include "framer.h"
+#include "sim_uart.h"
+#include "traffic.h"
+#include "uart_config.h"
+#include "usb_device.h"
+
+// The firmware's Bridge between the real CDC interfaces, on the simulated USB
+// stack, and simulated UARTs, wired as in main.cc: CDC interface 0 is the
+// console and data channel i uses interface i + 1. Each channel carries a
+// TrafficStream per direction.
+//
+// Only one rig may exist at a time, since it owns the simulated clock and
+// USB stack.
+class BridgeRig : public CaptureSink {
+ public:
+  struct ChannelConfig {
+    uint32_t baud_rate = 115'200;
+    FlowControl flow_control = FlowControl::kNone;
+    Framer framer = {};
+    // Stands in for the UART as the bridge sees it, e.g. to throttle it.
+    std::function<std::unique_ptr<SerialPort>(SerialPort& uart)> wrap_uart;
+  };
+
+  struct Direction {
+    TrafficStream stream;
+    // Bytes the bridge passed to the capture.
+    uint64_t captured = 0;
+  };
+
+  struct Channel {
+    std::unique_ptr<SimUart> uart;
+    std::unique_ptr<SerialPort> wrapped_uart;
+    CdcDevice* cdc;
+    Direction usb_to_uart;
+    Direction uart_to_usb;
+  };
+
+  // Each iteration of the main loop takes loop_us of simulated time.
+  explicit BridgeRig(std::span<const ChannelConfig> configs,
+                     uint64_t loop_us = 5);
+  ~BridgeRig();
+
+  Bridge& GetBridge() { return bridge_; }
+  Channel& GetChannel(int i) { return channels_[i]; }
+  int ChannelCount() { return channels_.size(); }
+
+  // Has the far end of the channel's UART send data.
+  void UartSend(int channel, std::size_t size, uint64_t not_before_us = 0);
+  void UartSend(int channel, std::string_view data,
+                uint64_t not_before_us = 0);
+
+  // Has the USB host write data to the channel's CDC interface.
+  void UsbSend(int channel, std::size_t size);
+
+  // Bytes the host has written that haven't gone out over USB yet.
+  std::size_t UsbSendPending(int channel);
+
+  // Runs the main loop.
+  void RunUntil(uint64_t time_us);
+  void RunFor(uint64_t us);
+
+  void Record(int channel, CaptureDirection direction,
+              std::span<const char> data, uint64_t time_us) override;
+
+ private:
+  uint64_t loop_us_;
+  UsbDevice usb_;
+  Bridge bridge_;
+  std::vector<Channel> channels_;
+  // Log output, discarded.
+  std::ostringstream log_;
+};
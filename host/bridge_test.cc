@@ -0,0 +1,190 @@
+#include "bridge.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "bridge_rig.h"
+#include "sim_usb.h"
+#include "stats.h"
+
+namespace {
+class NullCapture : public CaptureSink {
+ public:
+  void Record(int channel, CaptureDirection direction,
+              std::span<const char> data, uint64_t time_us) override {}
+};
+
+// Port with canned input that accepts at most `accepts` bytes per write,
+// whatever WriteAvailable() says.
+class FakePort : public SerialPort {
+ public:
+  std::span<char> Read(std::span<char> buffer) override {
+    const std::size_t size = std::min(buffer.size(), input.size());
+    std::copy_n(input.begin(), size, buffer.begin());
+    input.erase(input.begin(), input.begin() + size);
+    return buffer.first(size);
+  }
+
+  int WriteAvailable() override { return available; }
+
+  int Write(std::span<const char> data) override {
+    const std::size_t size = std::min<std::size_t>(data.size(), accepts);
+    output.append(data.data(), size);
+    return size;
+  }
+
+  std::deque<char> input;
+  std::string output;
+  int available = 1024;
+  int accepts = 1024;
+};
+
+// Hands the bridge at most one byte per read, as the bridge used to move
+// data.
+class OneByteReads : public SerialPort {
+ public:
+  explicit OneByteReads(SerialPort& port) : port_(port) {}
+
+  std::span<char> Read(std::span<char> buffer) override {
+    return port_.Read(buffer.first(std::min<std::size_t>(buffer.size(), 1)));
+  }
+  int WriteAvailable() override { return port_.WriteAvailable(); }
+  int Write(std::span<const char> data) override { return port_.Write(data); }
+
+ private:
+  SerialPort& port_;
+};
+
+struct Throughput {
+  uint64_t bytes;
+  uint64_t lost;
+  uint64_t packets;
+};
+
+// Streams UART traffic at 921600 baud to USB for a second, with a main loop
+// that takes 20 us per iteration.
+Throughput MeasureUartToUsb(BridgeRig::ChannelConfig config) {
+  config.baud_rate = 921'600;
+  BridgeRig rig(std::span(&config, 1), /*loop_us=*/20);
+  for (uint64_t now = 0; now < 1'000'000; now += 100) {
+    if (rig.GetChannel(0).uart->FarEndPending() < 256) {
+      rig.UartSend(0, 256);
+    }
+    rig.RunUntil(now + 100);
+  }
+  const TrafficStream& stream = rig.GetChannel(0).uart_to_usb.stream;
+  return {.bytes = stream.ReceivedBytes(),
+          .lost = stream.Lost(),
+          .packets = SimUsb::Instance().InPackets(1)};
+}
+
+TEST(BridgeTest, KeepsUpWithALineThatOutpacesTheMainLoop) {
+  const Throughput chunked = MeasureUartToUsb({});
+  const Throughput per_byte = MeasureUartToUsb({
+      .wrap_uart =
+          [](SerialPort& uart) {
+            return std::make_unique<OneByteReads>(uart);
+          },
+  });
+  RecordProperty("chunked_bytes_per_s", chunked.bytes);
+  RecordProperty("chunked_packets_per_s", chunked.packets);
+  RecordProperty("per_byte_bytes_per_s", per_byte.bytes);
+  RecordProperty("per_byte_packets_per_s", per_byte.packets);
+
+  // 921600 baud at 10 bits per byte, less what is still in flight.
+  EXPECT_GT(chunked.bytes, 90'000);
+  EXPECT_EQ(chunked.lost, 0);
+  // One byte per 20 us iteration can't keep up, and the RX ring overruns.
+  EXPECT_LE(per_byte.bytes, 50'000);
+  EXPECT_GT(per_byte.lost, 0);
+  // Both fill every bus slot, but chunks fill the packets better.
+  EXPECT_GT(chunked.bytes * per_byte.packets,
+            per_byte.bytes * chunked.packets);
+}
+
+TEST(BridgeTest, SharesTheBusFairlyBetweenSaturatedPorts) {
+  // Together more than the bus carries, so the ports compete for it.
+  const std::vector<BridgeRig::ChannelConfig> configs(
+      4, {.baud_rate = 3'000'000, .flow_control = FlowControl::kHardware});
+  BridgeRig rig(configs);
+  for (uint64_t now = 0; now < 1'000'000; now += 100) {
+    for (int i = 0; i < rig.ChannelCount(); ++i) {
+      if (rig.GetChannel(i).uart->FarEndPending() < 256) {
+        rig.UartSend(i, 256);
+      }
+    }
+    rig.RunUntil(now + 100);
+  }
+  uint64_t min = UINT64_MAX;
+  uint64_t max = 0;
+  uint64_t total = 0;
+  for (int i = 0; i < rig.ChannelCount(); ++i) {
+    const TrafficStream& stream = rig.GetChannel(i).uart_to_usb.stream;
+    EXPECT_EQ(stream.Lost(), 0);
+    min = std::min(min, stream.ReceivedBytes());
+    max = std::max(max, stream.ReceivedBytes());
+    total += stream.ReceivedBytes();
+  }
+  RecordProperty("aggregate_bytes_per_s", total);
+  RecordProperty("min_port_bytes_per_s", min);
+  // Most of the bus, split evenly.
+  EXPECT_GT(total, 900'000);
+  EXPECT_GT(min * 10, max * 9);
+}
+
+TEST(BridgeTest, SaturatedPortDoesNotStarveAnInteractiveOne) {
+  const std::vector<BridgeRig::ChannelConfig> configs = {
+      {.baud_rate = 921'600}, {.baud_rate = 115'200}};
+  BridgeRig rig(configs);
+  for (uint64_t now = 0; now < 1'000'000; now += 100) {
+    if (rig.GetChannel(0).uart->FarEndPending() < 256) {
+      rig.UartSend(0, 256);
+    }
+    if (rig.UsbSendPending(0) < 4096) {
+      rig.UsbSend(0, 4096);
+    }
+    if (now % 20'000 == 0) {
+      rig.UartSend(1, 8);
+      rig.UsbSend(1, 8);
+    }
+    rig.RunUntil(now + 100);
+  }
+  rig.RunFor(100'000);
+  for (TrafficStream* stream : {&rig.GetChannel(1).uart_to_usb.stream,
+                                &rig.GetChannel(1).usb_to_uart.stream}) {
+    EXPECT_EQ(stream->ReceivedBytes(), stream->Sent());
+    // Eight bytes at 115200 baud take 700 us on the wire; the rest is USB
+    // frames and the bridge.
+    EXPECT_LT(stream->LatencyPercentileUs(99), 3'000);
+  }
+}
+
+TEST(BridgeTest, CountsBytesTheSinkRefused) {
+  ChannelStats& stats = Stats::Global().channels[0];
+  stats.usb_to_uart_bytes.Set(0);
+  stats.bridge_dropped_bytes.Set(0);
+  NullCapture capture;
+  Bridge bridge(capture);
+  FakePort usb;
+  FakePort uart;
+  bridge.AddChannel(0, usb, uart);
+  usb.input.assign(100, 'x');
+  // Claims room for a whole chunk, then takes only part of it.
+  uart.available = 64;
+  uart.accepts = 10;
+
+  bridge.Task();
+
+  EXPECT_EQ(uart.output, std::string(10, 'x'));
+  EXPECT_EQ(stats.usb_to_uart_bytes.Get(), 10);
+  EXPECT_EQ(stats.bridge_dropped_bytes.Get(), 54);
+  EXPECT_EQ(usb.input.size(), 36);
+}
+}  // namespace
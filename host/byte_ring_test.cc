@@ -0,0 +1,90 @@
+#include "byte_ring.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace {
+using Ring = ByteRing<16>;
+
+// Stores bytes the way the RX DMA channel does: into the storage at its
+// write pointer, wrapping at the ring size, then reporting the new position.
+void DmaWrite(Ring& ring, std::string_view data) {
+  uint32_t head = ring.Head();
+  for (char c : data) {
+    *ring.At(head++) = c;
+  }
+  ring.SetHead(head);
+}
+
+std::string ReadAll(Ring& ring) {
+  std::array<char, 32> buffer;
+  const std::span<char> read = ring.Read(buffer);
+  return {read.begin(), read.end()};
+}
+
+TEST(ByteRingTest, ReadsWhatTheDmaWroteAcrossTheWrap) {
+  Ring ring;
+  DmaWrite(ring, "0123456789");
+  EXPECT_EQ(ReadAll(ring), "0123456789");
+  // Runs past the end of the storage.
+  DmaWrite(ring, "abcdefghijkl");
+  EXPECT_EQ(ring.Size(), 12);
+  EXPECT_EQ(ReadAll(ring), "abcdefghijkl");
+  EXPECT_EQ(ring.Overruns(), 0);
+}
+
+TEST(ByteRingTest, PartialReadsLeaveTheRest) {
+  Ring ring;
+  DmaWrite(ring, "abcdef");
+  std::array<char, 4> buffer;
+  EXPECT_EQ(std::string_view(ring.Read(buffer).data(), 4), "abcd");
+  EXPECT_EQ(ReadAll(ring), "ef");
+  EXPECT_TRUE(ring.Read(buffer).empty());
+}
+
+TEST(ByteRingTest, LappedBytesCountAsOverruns) {
+  Ring ring;
+  DmaWrite(ring, "0123456789");
+  // 26 unread bytes in a 16-byte ring: the oldest 10 were overwritten.
+  DmaWrite(ring, "abcdefghijklmnop");
+  EXPECT_EQ(ring.Size(), 26);
+  EXPECT_EQ(ring.Free(), 0);
+  EXPECT_EQ(ReadAll(ring), "abcdefghijklmnop");
+  EXPECT_EQ(ring.Overruns(), 10);
+}
+
+TEST(ByteRingTest, PositionsWrapAround32Bits) {
+  Ring ring;
+  ring.SetHead(UINT32_MAX - 3);
+  ring.SetTail(UINT32_MAX - 3);
+  DmaWrite(ring, "abcdefgh");
+  EXPECT_EQ(ring.Size(), 8);
+  EXPECT_EQ(ReadAll(ring), "abcdefgh");
+}
+
+TEST(ByteRingTest, CpuWritesStopWhenFull) {
+  Ring ring;
+  const std::string data(20, 'x');
+  EXPECT_EQ(ring.Write(data), 16);
+  EXPECT_EQ(ring.Free(), 0);
+  EXPECT_EQ(ring.Write(data), 0);
+  ReadAll(ring);
+  EXPECT_EQ(ring.Write(std::string_view("abcdefghij")), 10);
+  EXPECT_EQ(ReadAll(ring), "abcdefghij");
+}
+
+TEST(ByteRingTest, StorageIsAlignedWithoutPaddingTheRing) {
+  constexpr std::size_t kSize = 4096;
+  ByteRing<kSize> ring;
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ring.At(0)) % kSize, 0);
+  EXPECT_EQ(ring.At(kSize), ring.At(0));
+  // The positions don't share the storage's alignment.
+  static_assert(sizeof(ByteRing<kSize>) <= 32);
+}
+}  // namespace
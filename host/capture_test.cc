@@ -0,0 +1,107 @@
+#include "capture.h"
+
+#include <gtest/gtest.h>
+#include <pico/time.h>
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "capture_format.h"
+#include "flash.h"
+#include "fs.h"
+#include "ram_disk.h"
+#include "sector_cache.h"
+#include "sim.h"
+#include "temp_path.h"
+
+namespace {
+TEST(CaptureTest, KeepsUpWithADuplexChannel) {
+  Sim::Instance().Reset();
+  TempPath image("capture.img");
+  FlashDisk flash(256, image.path());
+  SectorCache cache(flash);
+  FileSystem fs(cache);
+  fs.Install();
+  CaptureRecorder capture(fs);
+
+  // 115200 baud each way, forwarded in 64-byte chunks by a 20 us main loop.
+  constexpr uint64_t kChunkIntervalUs = 5'556;
+  constexpr uint64_t kDurationUs = 10'000'000;
+  std::array<char, 64> chunk;
+  chunk.fill('x');
+  uint64_t recorded = 0;
+  uint64_t next_chunk_us = 0;
+  while (time_us_64() < kDurationUs) {
+    if (time_us_64() >= next_chunk_us) {
+      capture.Record(0, CaptureDirection::kUsbToUart, chunk);
+      capture.Record(0, CaptureDirection::kUartToUsb, chunk);
+      recorded += 2 * chunk.size();
+      next_chunk_us += kChunkIntervalUs;
+    }
+    capture.Task();
+    Sim::Instance().Advance(20);
+  }
+  // Let the last sync happen.
+  Sim::Instance().Advance(CaptureRecorder::kSyncIntervalUs);
+  capture.Task();
+  RecordProperty("bytes_per_s", recorded * 1'000'000 / kDurationUs);
+  RecordProperty("flash_erases", flash.EraseCount());
+  RecordProperty("flash_busy_us", flash.ModeledBusyUs());
+  EXPECT_EQ(capture.DroppedBytes(), 0);
+
+  const std::string contents =
+      fs.OpenFile(capture.Path(), {.read = true}).ReadAll();
+  std::span<const std::byte> input = std::as_bytes(std::span(contents));
+  ASSERT_GE(input.size(), kCaptureMagic.size());
+  EXPECT_EQ(contents.substr(0, kCaptureMagic.size()), kCaptureMagic);
+  input = input.subspan(kCaptureMagic.size());
+  uint64_t payload = 0;
+  while (const std::optional<CaptureHeader> header =
+             CaptureHeader::Decode(input)) {
+    ASSERT_LE(header->length, input.size());
+    EXPECT_EQ(header->channel, 0);
+    payload += header->length;
+    input = input.subspan(header->length);
+  }
+  EXPECT_TRUE(input.empty());
+  EXPECT_EQ(payload, recorded);
+}
+
+TEST(CaptureTest, StartsANewFileIfTheHostDeletedTheDirectory) {
+  Sim::Instance().Reset();
+  RamDisk disk(256);
+  FileSystem fs(disk);
+  fs.Install();
+  CaptureRecorder capture(fs);
+  const std::string old_path = capture.Path();
+  capture.Record(0, CaptureDirection::kUsbToUart, std::string_view("ab"));
+  Sim::Instance().Advance(CaptureRecorder::kSyncIntervalUs);
+  capture.Task();
+
+  // As the host would over MSC.
+  ASSERT_EQ(f_unlink(old_path.c_str()), FR_OK);
+  ASSERT_EQ(f_unlink("/captures"), FR_OK);
+  fs.Remount();
+  capture.Reopen();
+  EXPECT_NE(capture.Path(), old_path);
+
+  capture.Record(0, CaptureDirection::kUartToUsb, std::string_view("cd"));
+  Sim::Instance().Advance(CaptureRecorder::kSyncIntervalUs);
+  capture.Task();
+  const std::string contents =
+      fs.OpenFile(capture.Path(), {.read = true}).ReadAll();
+  ASSERT_EQ(contents.substr(0, kCaptureMagic.size()), kCaptureMagic);
+  std::span<const std::byte> input =
+      std::as_bytes(std::span(contents)).subspan(kCaptureMagic.size());
+  const std::optional<CaptureHeader> header = CaptureHeader::Decode(input);
+  ASSERT_TRUE(header);
+  EXPECT_EQ(header->direction, CaptureDirection::kUartToUsb);
+  ASSERT_EQ(header->length, 2);
+  EXPECT_EQ(contents.substr(contents.size() - 2), "cd");
+  EXPECT_EQ(input.size(), 2);
+}
+}  // namespace
@@ -0,0 +1,179 @@
+#include "flash.h"
+
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <stdexcept>
+
+#include "sim.h"
+#include "temp_path.h"
+
+namespace {
+constexpr int kPageSize = FlashDisk::kPageSize;
+
+// Word-aligned, and one byte off, so that both of PlanWrite()'s comparison
+// paths are covered.
+class Payload {
+ public:
+  explicit Payload(bool aligned) : offset_(aligned ? 0 : 1) { Fill(0xFF); }
+
+  void Fill(int value) { std::ranges::fill(Data(), std::byte(value)); }
+  std::span<std::byte> Data() {
+    return std::span(storage_).subspan(offset_, BlockDevice::kSectorSize);
+  }
+  std::span<std::byte> Page(int page) {
+    return Data().subspan(page * kPageSize, kPageSize);
+  }
+
+ private:
+  int offset_;
+  alignas(uint32_t) std::array<std::byte, BlockDevice::kSectorSize + 1>
+      storage_;
+};
+
+class PlanWriteTest : public testing::TestWithParam<bool> {
+ protected:
+  PlanWriteTest() : payload_(GetParam()) {}
+
+  TempPath image_{"flash_plan.img"};
+  FlashDisk flash_{4, image_.path()};
+  Payload payload_;
+};
+
+TEST_P(PlanWriteTest, SkipsUnchangedContents) {
+  // Erased, as is the new image.
+  EXPECT_EQ(flash_.PlanWrite(0, payload_.Data()), std::nullopt);
+}
+
+TEST_P(PlanWriteTest, ProgramsOnlyChangedPagesWhenBitsOnlyClear) {
+  std::ranges::fill(payload_.Page(2), std::byte(0xF0));
+  std::ranges::fill(payload_.Page(9), std::byte(0x00));
+  const std::optional<FlashDisk::WritePlan> plan =
+      flash_.PlanWrite(0, payload_.Data());
+  ASSERT_TRUE(plan);
+  EXPECT_FALSE(plan->erase);
+  EXPECT_EQ(plan->pages.count(), 2);
+  EXPECT_TRUE(plan->pages[2]);
+  EXPECT_TRUE(plan->pages[9]);
+
+  flash_.WriteSector(0, payload_.Data());
+  EXPECT_EQ(flash_.EraseCount(), 0);
+  EXPECT_EQ(flash_.ProgramCount(), 2);
+  // Clearing more bits of a programmed page is still program-only.
+  payload_.Page(2)[7] = std::byte(0x30);
+  const std::optional<FlashDisk::WritePlan> again =
+      flash_.PlanWrite(0, payload_.Data());
+  ASSERT_TRUE(again);
+  EXPECT_FALSE(again->erase);
+  EXPECT_EQ(again->pages.count(), 1);
+}
+
+TEST_P(PlanWriteTest, ErasesToSetBitsAndReprogramsNonBlankPages) {
+  std::ranges::fill(payload_.Page(0), std::byte(0x00));
+  std::ranges::fill(payload_.Page(5), std::byte(0x00));
+  flash_.WriteSector(1, payload_.Data());
+  // Page 0 goes back to a value with bits set, page 5 is unchanged.
+  std::ranges::fill(payload_.Page(0), std::byte(0x01));
+  const std::optional<FlashDisk::WritePlan> plan =
+      flash_.PlanWrite(1, payload_.Data());
+  ASSERT_TRUE(plan);
+  EXPECT_TRUE(plan->erase);
+  // The erase wipes page 5 too, while the blank pages need nothing.
+  EXPECT_EQ(plan->pages.count(), 2);
+  EXPECT_TRUE(plan->pages[0]);
+  EXPECT_TRUE(plan->pages[5]);
+
+  flash_.WriteSector(1, payload_.Data());
+  EXPECT_TRUE(std::ranges::equal(flash_.ReadSector(1), payload_.Data()));
+}
+
+TEST_P(PlanWriteTest, RejectsPayloadsOfTheWrongSize) {
+  EXPECT_THROW(flash_.PlanWrite(0, payload_.Data().first(kPageSize)),
+               std::length_error);
+  EXPECT_THROW(flash_.PlanWrite(4, payload_.Data()), std::out_of_range);
+}
+
+INSTANTIATE_TEST_SUITE_P(Alignment, PlanWriteTest, testing::Bool(),
+                         [](const testing::TestParamInfo<bool>& info) {
+                           return info.param ? "Aligned" : "Unaligned";
+                         });
+
+TEST(FlashDiskTest, ImageKeepsItsContentsAcrossReopening) {
+  TempPath image("flash_reopen.img");
+  Payload payload(/*aligned=*/true);
+  payload.Fill(0x42);
+  {
+    FlashDisk flash(4, image.path());
+    flash.WriteSector(2, payload.Data());
+  }
+  FlashDisk flash(4, image.path());
+  EXPECT_TRUE(std::ranges::equal(flash.ReadSector(2), payload.Data()));
+  // The rest is still erased.
+  EXPECT_EQ(flash.ReadSector(3)[0], std::byte{0xFF});
+}
+
+TEST(FlashDiskTest, ClosesTheImageIfSettingUpFails) {
+  // A FIFO opens, but can't be resized.
+  TempPath fifo("flash_fifo.img");
+  ASSERT_EQ(mkfifo(fifo.path().c_str(), 0644), 0);
+  const auto open_files = [] {
+    return std::distance(std::filesystem::directory_iterator("/proc/self/fd"),
+                         {});
+  };
+  const auto before = open_files();
+  EXPECT_THROW(FlashDisk(4, fifo.path()), std::filesystem::filesystem_error);
+  EXPECT_EQ(open_files(), before);
+}
+
+TEST(FlashDiskTest, RejectsProgramsThatSetBits) {
+  TempPath image("flash_nor.img");
+  FlashDisk flash(1, image.path());
+  std::array<std::byte, kPageSize> page;
+  page.fill(std::byte{0x0F});
+  flash.ProgramPages(0, 0, page);
+  // Padding with 0xFF over programmed bytes would need an erase too.
+  page.fill(std::byte{0xFF});
+  page[0] = std::byte{0x0F};
+  EXPECT_THROW(flash.ProgramPages(0, 0, page), std::logic_error);
+  // Clearing more bits is fine.
+  page.fill(std::byte{0x03});
+  flash.ProgramPages(0, 0, page);
+  EXPECT_EQ(flash.ReadSector(0)[0], std::byte{0x03});
+}
+
+TEST(FlashDiskTest, OperationsTakeTheirTimeWithInterruptsOff) {
+  Sim::Instance().Reset();
+  TempPath image("flash_timing.img");
+  FlashDisk flash(1, image.path());
+  flash.EraseSector(0);
+  EXPECT_EQ(Sim::Instance().Now(), FlashDisk::kEraseUs);
+  std::array<std::byte, 2 * kPageSize> pages{};
+  flash.ProgramPages(0, 0, pages);
+  EXPECT_EQ(Sim::Instance().Now(),
+            FlashDisk::kEraseUs + 2 * FlashDisk::kProgramPageUs);
+  EXPECT_EQ(Sim::Instance().MaxInterruptsOffUs(), FlashDisk::kEraseUs);
+  EXPECT_EQ(flash.ModeledBusyUs(), Sim::Instance().Now());
+  EXPECT_EQ(flash.MaxBlackoutUs(), FlashDisk::kEraseUs);
+}
+
+TEST(FlashDiskTest, PowerCutLeavesAHalfDoneOperation) {
+  TempPath image("flash_power.img");
+  FlashDisk flash(1, image.path());
+  std::array<std::byte, 2 * kPageSize> pages{};
+  flash.CutPowerAfter(0);
+  EXPECT_THROW(flash.ProgramPages(0, 0, pages), FlashDisk::PowerCut);
+  EXPECT_EQ(flash.ReadSector(0)[kPageSize - 1], std::byte{0x00});
+  EXPECT_EQ(flash.ReadSector(0)[kPageSize], std::byte{0xFF});
+  // Power is back for the next operation.
+  flash.EraseSector(0);
+  EXPECT_EQ(flash.ReadSector(0)[0], std::byte{0xFF});
+}
+}  // namespace
@@ -0,0 +1,337 @@
+#include "flash_writer.h"
+
+#include <gtest/gtest.h>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "flash.h"
+#include "sim.h"
+#include "stats.h"
+#include "temp_path.h"
+
+namespace {
+using SectorData = std::array<std::byte, BlockDevice::kSectorSize>;
+
+SectorData Filled(int value) {
+  SectorData data;
+  data.fill(std::byte(value));
+  return data;
+}
+
+SectorData Random(std::minstd_rand& random) {
+  SectorData data;
+  std::ranges::generate(data, [&] { return std::byte(random()); });
+  return data;
+}
+
+class FlashWriterTest : public testing::Test {
+ protected:
+  FlashWriterTest() { Sim::Instance().Reset(); }
+
+  // Flash busy time taken by a write of the sector, from staging to Sync().
+  uint64_t WriteLatencyUs(int sector, const SectorData& data) {
+    const uint64_t busy_us = flash_.ModeledBusyUs();
+    writer_.WriteSector(sector, data);
+    writer_.Sync();
+    return flash_.ModeledBusyUs() - busy_us;
+  }
+
+  TempPath image_{"flash_writer.img"};
+  TempPath journal_image_{"flash_writer_journal.img"};
+  FlashDisk flash_{32, image_.path()};
+  FlashDisk journal_{FlashWriter::kJournalSectors, journal_image_.path()};
+  FlashWriter writer_{flash_, journal_};
+};
+
+TEST_F(FlashWriterTest, PreErasedSectorsOnlyNeedProgramming) {
+  // File data, which skips the journal, so only the target's own erase and
+  // programs count.
+  writer_.MarkDataOnly(0, 8);
+  for (int i = 0; i < 8; ++i) {
+    writer_.WriteSector(i, Filled(0x5A));
+  }
+  writer_.Sync();
+  writer_.Trim(0, 4);
+  for (int i = 0; i < FlashWriter::kErasedPoolSize; ++i) {
+    writer_.Task();
+  }
+  const uint32_t erases = flash_.EraseCount();
+  const uint64_t preerased_writes =
+      Stats::Global().flash_preerased_writes.Get();
+
+  const uint64_t preerased_us = WriteLatencyUs(0, Filled(0xA5));
+  EXPECT_EQ(flash_.EraseCount(), erases);
+  EXPECT_EQ(Stats::Global().flash_preerased_writes.Get(),
+            preerased_writes + 1);
+  EXPECT_EQ(preerased_us,
+            FlashDisk::kPagesPerSector * FlashDisk::kProgramPageUs);
+
+  const uint64_t dirty_us = WriteLatencyUs(5, Filled(0xA5));
+  EXPECT_EQ(flash_.EraseCount(), erases + 1);
+  EXPECT_EQ(dirty_us, FlashDisk::kEraseUs + FlashDisk::kPagesPerSector *
+                                               FlashDisk::kProgramPageUs);
+  RecordProperty("preerased_write_us", preerased_us);
+  RecordProperty("dirty_write_us", dirty_us);
+}
+
+TEST_F(FlashWriterTest, ErasesAheadOnlyTrimmedSectorsOnceWritesAreDone) {
+  writer_.MarkDataOnly(0, 11);
+  for (int i = 0; i < 11; ++i) {
+    writer_.WriteSector(i, Filled(0x5A));
+  }
+  writer_.Sync();
+  writer_.Trim(0, 8);
+  // The pending write, which needs an erase, goes first.
+  int erased_ahead_before_write = -1;
+  writer_.Enqueue(10, Filled(0x11), [&] {
+    const auto counts = flash_.SectorEraseCounts();
+    erased_ahead_before_write = std::count(counts.begin(), counts.begin() + 8,
+                                           uint32_t{1});
+  });
+  while (!writer_.Idle()) {
+    writer_.Task();
+  }
+  EXPECT_EQ(erased_ahead_before_write, 0);
+  EXPECT_EQ(flash_.SectorEraseCounts()[10], 1);
+
+  for (int i = 0; i < 2 * FlashWriter::kErasedPoolSize; ++i) {
+    writer_.Task();
+  }
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(flash_.SectorEraseCounts()[i], i < 8 ? 1 : 0) << i;
+  }
+}
+
+TEST_F(FlashWriterTest, WritingATrimmedSectorTakesItOutOfThePool) {
+  writer_.MarkDataOnly(0, 8);
+  writer_.WriteSector(3, Filled(0x5A));
+  writer_.Sync();
+  writer_.Trim(3, 1);
+  writer_.WriteSector(3, Filled(0x77));
+  writer_.Sync();
+  const uint32_t erases = flash_.EraseCount();
+  for (int i = 0; i < FlashWriter::kErasedPoolSize; ++i) {
+    writer_.Task();
+  }
+  EXPECT_EQ(flash_.EraseCount(), erases);
+  EXPECT_EQ(writer_.ReadSector(3)[0], std::byte(0x77));
+}
+
+TEST_F(FlashWriterTest, DataOnlyMarksLastUntilTrimmedOrCleared) {
+  Stats& stats = Stats::Global();
+  const auto journaled = [&](int sector) {
+    const uint64_t before = stats.flash_journaled_writes.Get();
+    writer_.WriteSector(sector, Filled(sector));
+    writer_.Sync();
+    return stats.flash_journaled_writes.Get() > before;
+  };
+  writer_.MarkDataOnly(0, 4);
+  EXPECT_FALSE(journaled(0));
+  EXPECT_FALSE(journaled(0));
+  // Freed, then reused for a directory.
+  writer_.Trim(1, 1);
+  EXPECT_TRUE(journaled(1));
+  writer_.ClearDataOnly(2, 2);
+  EXPECT_TRUE(journaled(2));
+  EXPECT_TRUE(journaled(3));
+  EXPECT_FALSE(journaled(0));
+  EXPECT_TRUE(journaled(4));
+}
+
+// Writes through a FlashWriter with power cut partway, then powers up again
+// on the same images.
+class PowerCutTest : public testing::Test {
+ protected:
+  static constexpr int kSectors = 8;
+
+  PowerCutTest() { Sim::Instance().Reset(); }
+
+  // Writes `before` to the sector, then `after` with power cut once `steps`
+  // more operations on the flash or the journal have completed. Returns
+  // whether power was cut before the second write was done.
+  bool WriteWithCut(int sector, const SectorData& before,
+                    const SectorData& after, bool cut_journal, int steps) {
+    std::filesystem::remove(image_.path());
+    std::filesystem::remove(journal_image_.path());
+    FlashDisk flash(kSectors, image_.path());
+    FlashDisk journal(FlashWriter::kJournalSectors, journal_image_.path());
+    FlashWriter writer(flash, journal);
+    // So that some cuts land while the full record sector is erased.
+    std::minstd_rand random(steps);
+    for (int i = (steps * 7) % 140; i > 0; --i) {
+      writer.WriteSector(sector + 1, Random(random));
+      writer.Sync();
+    }
+    writer.WriteSector(sector, before);
+    writer.Sync();
+    (cut_journal ? journal : flash).CutPowerAfter(steps);
+    writer.WriteSector(sector, after);
+    try {
+      writer.Sync();
+    } catch (const FlashDisk::PowerCut&) {
+      return true;
+    }
+    return false;
+  }
+
+  TempPath image_{"power_cut.img"};
+  TempPath journal_image_{"power_cut_journal.img"};
+};
+
+TEST_F(PowerCutTest, SectorWriteIsAtomicWhereverPowerIsCut) {
+  std::minstd_rand random(1);
+  const SectorData before = Random(random);
+  // Needs an erase, and needs only programming.
+  SectorData cleared = before;
+  for (std::size_t i = 0; i < cleared.size(); i += 3) {
+    cleared[i] &= std::byte{0x5A};
+  }
+  for (const SectorData& after : {Random(random), cleared}) {
+    for (const bool cut_journal : {false, true}) {
+      // Recovery may itself be cut short.
+      for (const int recovery_steps : {-1, 0, 1, 5}) {
+        for (int steps = 0;
+             WriteWithCut(3, before, after, cut_journal, steps); ++steps) {
+          SCOPED_TRACE(fmt::format("journal {}, steps {}, recovery steps {}",
+                                   cut_journal, steps, recovery_steps));
+          if (recovery_steps >= 0) {
+            FlashDisk flash(kSectors, image_.path());
+            FlashDisk journal(FlashWriter::kJournalSectors,
+                              journal_image_.path());
+            flash.CutPowerAfter(recovery_steps);
+            try {
+              FlashWriter writer(flash, journal);
+            } catch (const FlashDisk::PowerCut&) {
+            }
+          }
+          FlashDisk flash(kSectors, image_.path());
+          FlashDisk journal(FlashWriter::kJournalSectors,
+                            journal_image_.path());
+          FlashWriter writer(flash, journal);
+          const std::span<const std::byte> contents = flash.ReadSector(3);
+          EXPECT_TRUE(std::ranges::equal(contents, before) ||
+                      std::ranges::equal(contents, after));
+          // Recovery leaves the writer usable.
+          writer.WriteSector(3, Filled(0x11));
+          writer.Sync();
+          EXPECT_EQ(flash.ReadSector(3)[0], std::byte(0x11));
+          if (HasFailure()) {
+            return;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(PowerCutTest, JournalSurvivesACutShortRecordSectorErase) {
+  // Whether the first and the last of the 32-byte records in the journal's
+  // first sector are blank.
+  const auto first_blank = [](FlashDisk& journal) {
+    return journal.ReadSector(0).front() == std::byte{0xFF};
+  };
+  const auto last_blank = [](FlashDisk& journal) {
+    return journal.ReadSector(0)[BlockDevice::kSectorSize - 32] ==
+           std::byte{0xFF};
+  };
+  std::minstd_rand random(3);
+  int torn_erases = 0;
+  for (int steps = 0; steps < 40; ++steps) {
+    SCOPED_TRACE(fmt::format("steps {}", steps));
+    std::filesystem::remove(image_.path());
+    std::filesystem::remove(journal_image_.path());
+    {
+      FlashDisk flash(kSectors, image_.path());
+      FlashDisk journal(FlashWriter::kJournalSectors, journal_image_.path());
+      FlashWriter writer(flash, journal);
+      // Fills the record sector, so the next write has to erase it.
+      while (last_blank(journal)) {
+        writer.WriteSector(1, Random(random));
+        writer.Sync();
+      }
+      journal.CutPowerAfter(steps);
+      writer.WriteSector(2, Random(random));
+      try {
+        writer.Sync();
+      } catch (const FlashDisk::PowerCut&) {
+      }
+      torn_erases += first_blank(journal) && !last_blank(journal);
+    }
+    FlashDisk flash(kSectors, image_.path());
+    FlashDisk journal(FlashWriter::kJournalSectors, journal_image_.path());
+    FlashWriter writer(flash, journal);
+    // Enough appends to reach where the old records were left.
+    for (int i = 0; i < 100; ++i) {
+      const SectorData data = Random(random);
+      writer.WriteSector(3, data);
+      writer.Sync();
+      ASSERT_TRUE(std::ranges::equal(flash.ReadSector(3), data)) << i;
+    }
+  }
+  EXPECT_GT(torn_erases, 0);
+}
+
+TEST_F(PowerCutTest, RandomWritesSurvivePowerCuts) {
+  constexpr int kWritten = 4;
+  std::minstd_rand random(7);
+  for (int trial = 0; trial < 100; ++trial) {
+    SCOPED_TRACE(fmt::format("trial {}", trial));
+    std::filesystem::remove(image_.path());
+    std::filesystem::remove(journal_image_.path());
+    // Every version of each sector, starting erased.
+    std::vector<std::vector<SectorData>> versions(kWritten, {Filled(0xFF)});
+    bool cut = false;
+    {
+      FlashDisk flash(kSectors, image_.path());
+      FlashDisk journal(FlashWriter::kJournalSectors, journal_image_.path());
+      FlashWriter writer(flash, journal);
+      (random() % 2 ? flash : journal).CutPowerAfter(random() % 400);
+      try {
+        for (int i = 0; i < 200; ++i) {
+          const int sector = random() % kWritten;
+          SectorData data = versions[sector].back();
+          if (random() % 3 != 0) {
+            data = Random(random);
+          } else {
+            data[random() % data.size()] &= std::byte{0xF0};
+          }
+          versions[sector].push_back(data);
+          writer.WriteSector(sector, data);
+          for (int tasks = random() % 4; tasks > 0; --tasks) {
+            writer.Task();
+          }
+        }
+        writer.Sync();
+      } catch (const FlashDisk::PowerCut&) {
+        cut = true;
+      }
+    }
+    FlashDisk flash(kSectors, image_.path());
+    FlashDisk journal(FlashWriter::kJournalSectors, journal_image_.path());
+    FlashWriter writer(flash, journal);
+    for (int sector = 0; sector < kWritten; ++sector) {
+      const std::span<const std::byte> contents = flash.ReadSector(sector);
+      const auto holds = [&](const SectorData& data) {
+        return std::ranges::equal(contents, data);
+      };
+      if (cut) {
+        EXPECT_TRUE(std::ranges::any_of(versions[sector], holds)) << sector;
+      } else {
+        EXPECT_TRUE(holds(versions[sector].back())) << sector;
+      }
+    }
+    if (HasFailure()) {
+      return;
+    }
+  }
+}
+}  // namespace
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <pico/time.h>
+
+#include <cstdint>
+#include <span>
+
+#include "bridge_rig.h"
+#include "sim_usb.h"
+#include "stats.h"
+#include "uart_config.h"
+
+namespace {
+struct Result {
+  uint64_t sent;
+  uint64_t received;
+  uint64_t lost;
+  uint64_t flow_stops;
+};
+
+// The far end streams at 115200 baud for a second to a host application that
+// takes one IN packet per 10 ms, about half the line rate. Then the host
+// catches up.
+Result StreamToSlowHost(FlowControl flow_control) {
+  const BridgeRig::ChannelConfig config = {.baud_rate = 115'200,
+                                           .flow_control = flow_control};
+  BridgeRig rig(std::span(&config, 1));
+  ChannelStats& stats = Stats::Global().channels[0];
+  const uint64_t flow_stops = stats.rx_flow_stops.Get();
+  SimUsb::Instance().SetInIntervalUs(1, 10'000);
+  for (uint64_t now = 0; now < 1'000'000; now += 100) {
+    if (rig.GetChannel(0).uart->FarEndPending() < 64) {
+      rig.UartSend(0, 64);
+    }
+    rig.RunUntil(now + 100);
+  }
+  SimUsb::Instance().SetInIntervalUs(1, 0);
+  rig.RunFor(2'000'000);
+  const TrafficStream& stream = rig.GetChannel(0).uart_to_usb.stream;
+  return {.sent = stream.Sent(),
+          .received = stream.ReceivedBytes(),
+          .lost = stream.Lost(),
+          .flow_stops = stats.rx_flow_stops.Get() - flow_stops};
+}
+
+TEST(FlowControlTest, HardwareFlowControlHoldsOffTheFarEnd) {
+  const Result result = StreamToSlowHost(FlowControl::kHardware);
+  EXPECT_GT(result.flow_stops, 0);
+  EXPECT_EQ(result.lost, 0);
+  EXPECT_EQ(result.received, result.sent);
+  // Roughly the rate the host took packets at, rather than the line rate.
+  EXPECT_LT(result.sent, 9'000);
+}
+
+TEST(FlowControlTest, SoftwareFlowControlHoldsOffTheFarEnd) {
+  const Result result = StreamToSlowHost(FlowControl::kSoftware);
+  EXPECT_GT(result.flow_stops, 0);
+  EXPECT_EQ(result.lost, 0);
+  EXPECT_EQ(result.received, result.sent);
+}
+
+TEST(FlowControlTest, WithoutFlowControlTheRxRingOverruns) {
+  const Result result = StreamToSlowHost(FlowControl::kNone);
+  EXPECT_GT(result.lost, 0);
+}
+
+TEST(FlowControlTest, SlowUartHoldsOffTheHost) {
+  const BridgeRig::ChannelConfig config = {.baud_rate = 57'600};
+  BridgeRig rig(std::span(&config, 1));
+  Counter& dropped = Stats::Global().channels[0].bridge_dropped_bytes;
+  const uint64_t dropped_before = dropped.Get();
+  // Over a second at 57600 baud.
+  rig.UsbSend(0, 8192);
+  rig.RunFor(500'000);
+  // The OUT endpoint stays NAKed while the UART drains.
+  EXPECT_GT(rig.UsbSendPending(0), 0);
+  EXPECT_EQ(dropped.Get(), dropped_before);
+
+  rig.RunFor(1'500'000);
+  const TrafficStream& stream = rig.GetChannel(0).usb_to_uart.stream;
+  EXPECT_EQ(stream.ReceivedBytes(), 8192);
+  EXPECT_EQ(stream.Lost(), 0);
+}
+}  // namespace
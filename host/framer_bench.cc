@@ -0,0 +1,157 @@
+// Streams protocol traffic from the UART side through the bridge, once with
+// the matching framer and once unframed, and reports how many USB IN packets
+// each frame took and the per-byte latency. Framing should deliver each frame
+// in one packet where it fits, at the cost of holding bytes until the frame
+// ends.
+//
+//   framer_bench [framer...]
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bridge_rig.h"
+#include "framer.h"
+#include "sim_usb.h"
+
+namespace {
+constexpr uint32_t kBaudRate = 115'200;
+constexpr uint64_t kDurationUs = 1'000'000;
+
+struct Protocol {
+  std::string_view name;
+  Framer framer;
+  // Time from the start of one frame to the start of the next.
+  uint64_t period_us;
+  std::function<std::string(std::minstd_rand&)> frame;
+};
+
+// Random bytes other than the ones listed.
+std::string Payload(std::minstd_rand& random, std::size_t size,
+                    std::string_view excluded = {}) {
+  std::string payload;
+  while (payload.size() < size) {
+    const char byte = static_cast<char>(random());
+    if (excluded.find(byte) == std::string_view::npos) {
+      payload.push_back(byte);
+    }
+  }
+  return payload;
+}
+
+std::size_t Between(std::minstd_rand& random, std::size_t min,
+                    std::size_t max) {
+  return min + random() % (max - min + 1);
+}
+
+std::vector<Protocol> Protocols() {
+  return {
+      {
+          .name = "newline",
+          .framer = FrameBuffer(DelimiterFraming::Newline()),
+          .period_us = 8'000,
+          .frame =
+              [](std::minstd_rand& random) {
+                std::string line;
+                for (std::size_t i = Between(random, 16, 80); i > 0; --i) {
+                  line.push_back(' ' + random() % 95);
+                }
+                return line + "\r\n";
+              },
+      },
+      {
+          .name = "slip",
+          .framer = FrameBuffer(DelimiterFraming::Slip()),
+          .period_us = 10'000,
+          .frame =
+              [](std::minstd_rand& random) {
+                return Payload(random, Between(random, 8, 100), "\xC0") +
+                       "\xC0";
+              },
+      },
+      {
+          .name = "cobs",
+          .framer = FrameBuffer(DelimiterFraming::Cobs()),
+          .period_us = 10'000,
+          .frame =
+              [](std::minstd_rand& random) {
+                return Payload(random, Between(random, 8, 100),
+                               std::string_view("\0", 1)) +
+                       '\0';
+              },
+      },
+      {
+          // Type, length, payload, then a 16-bit CRC.
+          .name = "length",
+          .framer = FrameBuffer(LengthFraming{
+              .header_size = 2, .length_offset = 1, .trailer_size = 2}),
+          .period_us = 10'000,
+          .frame =
+              [](std::minstd_rand& random) {
+                const std::size_t length = Between(random, 4, 96);
+                return std::string{'\x10', static_cast<char>(length)} +
+                       Payload(random, length + 2);
+              },
+      },
+      {
+          // Requests of up to 16 bytes, separated only by silence.
+          .name = "modbus",
+          .framer = FrameBuffer(IdleFraming::ModbusRtu(kBaudRate)),
+          .period_us = 5'000,
+          .frame =
+              [](std::minstd_rand& random) {
+                return Payload(random, Between(random, 8, 16));
+              },
+      },
+  };
+}
+
+void Run(const Protocol& protocol, bool framed) {
+  const BridgeRig::ChannelConfig config = {
+      .baud_rate = kBaudRate,
+      .framer = framed ? protocol.framer : Framer(),
+  };
+  BridgeRig rig(std::span(&config, 1));
+  std::minstd_rand random(1);
+  int frames = 0;
+  for (uint64_t start = 0; start < kDurationUs; start += protocol.period_us) {
+    rig.UartSend(0, protocol.frame(random), start);
+    ++frames;
+  }
+  // Lets the last frame's idle gap pass too.
+  rig.RunUntil(kDurationUs + 100'000);
+
+  TrafficStream& stream = rig.GetChannel(0).uart_to_usb.stream;
+  const uint64_t packets = SimUsb::Instance().InPackets(1);
+  fmt::print("{:<8} {:<8} {:>7} {:>8} {:>8} {:>9.2f} {:>8} {:>8} {:>6}\n",
+             protocol.name, framed ? "framed" : "raw", frames,
+             stream.ReceivedBytes(), packets,
+             static_cast<double>(packets) / frames,
+             stream.LatencyPercentileUs(50), stream.LatencyPercentileUs(99),
+             stream.Lost() + stream.Outstanding());
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const std::vector<std::string_view> selected(argv + 1, argv + argc);
+  fmt::print("UART to USB at {} baud for {} ms\n", kBaudRate,
+             kDurationUs / 1000);
+  fmt::print("{:<8} {:<8} {:>7} {:>8} {:>8} {:>9} {:>8} {:>8} {:>6}\n", "",
+             "", "frames", "bytes", "packets", "pkt/frame", "p50 us",
+             "p99 us", "lost");
+  for (const Protocol& protocol : Protocols()) {
+    if (!selected.empty() &&
+        std::ranges::find(selected, protocol.name) == selected.end()) {
+      continue;
+    }
+    Run(protocol, /*framed=*/false);
+    Run(protocol, /*framed=*/true);
+  }
+}
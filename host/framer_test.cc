@@ -0,0 +1,109 @@
+#include "framer.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace {
+std::string_view AsString(std::span<const char> data) {
+  return {data.data(), data.size()};
+}
+
+template <typename Policy>
+int Push(FrameBuffer<Policy>& framer, std::string_view data,
+         uint64_t now_us = 0) {
+  return framer.Push(data, {}, now_us);
+}
+
+TEST(FramerTest, DelimiterEndsAFrame) {
+  FrameBuffer framer(DelimiterFraming::Newline());
+  EXPECT_EQ(Push(framer, "abc"), 0);
+  EXPECT_TRUE(framer.Ready().empty());
+  EXPECT_EQ(Push(framer, "d\nef\ngh"), 2);
+  EXPECT_EQ(AsString(framer.Ready()), "abcd\nef\n");
+  framer.Consume(5);
+  EXPECT_EQ(AsString(framer.Ready()), "ef\n");
+  framer.Consume(3);
+  EXPECT_TRUE(framer.Ready().empty());
+  EXPECT_EQ(framer.Free(), FrameBuffer<DelimiterFraming>::kCapacity - 2);
+}
+
+TEST(FramerTest, IdleGapEndsAPartialFrame) {
+  FrameBuffer framer(DelimiterFraming::Slip());
+  Push(framer, "abc", 1'000);
+  EXPECT_EQ(framer.Poll(1'000 + 19'999), 0);
+  EXPECT_EQ(framer.Poll(1'000 + 20'000), 1);
+  EXPECT_EQ(AsString(framer.Ready()), "abc");
+}
+
+TEST(FramerTest, LengthFieldGivesTheFrameSize) {
+  // 2-byte header with the length in the second byte, then a 2-byte CRC.
+  FrameBuffer framer(LengthFraming{
+      .header_size = 2, .length_offset = 1, .trailer_size = 2});
+  EXPECT_EQ(Push(framer, std::string_view("\x01\x03" "abc", 5)), 0);
+  EXPECT_EQ(Push(framer, "CRx"), 1);
+  EXPECT_EQ(AsString(framer.Ready()), std::string_view("\x01\x03" "abcCR", 7));
+}
+
+TEST(FramerTest, LittleEndianTwoByteLength) {
+  FrameBuffer framer(LengthFraming{
+      .header_size = 2, .length_size = 2, .big_endian = false});
+  const std::string frame = std::string("\x03\x00", 2) + "abc";
+  EXPECT_EQ(Push(framer, frame), 1);
+  EXPECT_EQ(AsString(framer.Ready()), frame);
+}
+
+TEST(FramerTest, ModbusFramesAreSeparatedBySilence) {
+  FrameBuffer framer(IdleFraming::ModbusRtu(9600));
+  // 3.5 characters of 11 bits at 9600 baud.
+  const uint64_t gap = 38'500'000 / 9600;
+  EXPECT_EQ(Push(framer, "first", 0), 0);
+  EXPECT_EQ(Push(framer, "second", gap), 1);
+  EXPECT_EQ(AsString(framer.Ready()), "first");
+  EXPECT_EQ(IdleFraming::ModbusRtu(115'200).idle_gap_us, 1750);
+}
+
+TEST(FramerTest, PartialFrameWaitsForRoomRatherThanSplitting) {
+  FrameBuffer framer(DelimiterFraming::Newline());
+  constexpr std::size_t kCapacity = FrameBuffer<DelimiterFraming>::kCapacity;
+  Push(framer, std::string(kCapacity - 11, 'a') + "\n");
+  Push(framer, "0123456789");
+  EXPECT_EQ(framer.Free(), 0);
+  EXPECT_EQ(framer.Ready().size(), kCapacity - 10);
+  framer.Consume(framer.Ready().size());
+  EXPECT_EQ(Push(framer, "\n"), 1);
+  EXPECT_EQ(AsString(framer.Ready()), "0123456789\n");
+}
+
+TEST(FramerTest, OversizedFrameIsSentInPiecesAndResyncs) {
+  constexpr std::size_t kCapacity = FrameBuffer<LengthFraming>::kCapacity;
+  FrameBuffer framer(LengthFraming{.header_size = 2, .length_size = 2});
+  // A 402-byte frame, then a 3-byte one.
+  const std::string big =
+      std::string("\x01\x90", 2) + std::string(0x190, 'x');
+  const std::string small = std::string("\x00\x01", 2) + "y";
+  EXPECT_EQ(Push(framer, big.substr(0, kCapacity)), 1);
+  EXPECT_EQ(framer.Ready().size(), kCapacity);
+  framer.Consume(kCapacity);
+  // The rest of it passes through unparsed, so its 'x's aren't taken for a
+  // header.
+  EXPECT_EQ(Push(framer, big.substr(kCapacity) + small), 2);
+  EXPECT_EQ(AsString(framer.Ready()), big.substr(kCapacity) + small);
+}
+
+TEST(FramerTest, UsesTimestampsOfEachByte) {
+  FrameBuffer framer(IdleFraming{.idle_gap_us = 100});
+  const std::array<TimestampedByte, 3> times = {{
+      {.time_us = 0, .byte = 'a'},
+      {.time_us = 50, .byte = 'b'},
+      {.time_us = 200, .byte = 'c'},
+  }};
+  // Read late, but the bytes' own times show the gap before 'c'.
+  EXPECT_EQ(framer.Push(std::string_view("abc"), times, 1'000), 1);
+  EXPECT_EQ(AsString(framer.Ready()), "ab");
+}
+}  // namespace
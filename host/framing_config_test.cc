@@ -0,0 +1,58 @@
+#include "framing_config.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace {
+TEST(FramingConfigTest, ParsesEachFraming) {
+  std::vector<ChannelFraming> channels = ParseFramingConfig(
+      "# Rack 2\n"
+      "0 newline\n"
+      "\n"
+      "1 length 3 1 2 little 2\r\n"
+      "  2\tmodbus 9600\n"
+      "3 delimiter 7e\n");
+  ASSERT_EQ(channels.size(), 4);
+  EXPECT_EQ(channels[0].channel, 0);
+  EXPECT_TRUE(std::holds_alternative<FrameBuffer<DelimiterFraming>>(
+      channels[0].framer));
+  EXPECT_EQ(channels[1].channel, 1);
+  EXPECT_TRUE(
+      std::holds_alternative<FrameBuffer<LengthFraming>>(channels[1].framer));
+  EXPECT_EQ(channels[2].channel, 2);
+  EXPECT_TRUE(
+      std::holds_alternative<FrameBuffer<IdleFraming>>(channels[2].framer));
+
+  // The configured delimiter ends a frame.
+  auto& framer = std::get<FrameBuffer<DelimiterFraming>>(channels[3].framer);
+  EXPECT_EQ(framer.Push(std::string_view("ab~c"), {}, 0), 1);
+  EXPECT_EQ(framer.Ready().size(), 3);
+}
+
+TEST(FramingConfigTest, NoneIsUnframed) {
+  const std::vector<ChannelFraming> channels = ParseFramingConfig("1 none");
+  ASSERT_EQ(channels.size(), 1);
+  EXPECT_TRUE(std::holds_alternative<std::monostate>(channels[0].framer));
+}
+
+TEST(FramingConfigTest, RejectsMalformedLines) {
+  for (const char* text : {
+           "0",
+           "0 frobnicate",
+           "0 newline extra",
+           "x newline",
+           "9 newline",
+           "0 delimiter zz",
+           "0 length 1 1 1 big",
+           "0 length 2 0 3 big",
+           "0 length 2 0 1 middle",
+           "0 modbus 0",
+       }) {
+    EXPECT_THROW(ParseFramingConfig(text), std::invalid_argument) << text;
+  }
+}
+}  // namespace
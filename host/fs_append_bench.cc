@@ -0,0 +1,69 @@
+// Appends small records to a file through FatFS, syncing every few records as
+// the capture recorder does, with and without the sector cache in front of
+// the flash. Reports the flash work each took.
+
+#include <fmt/core.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include "flash.h"
+#include "fs.h"
+#include "sector_cache.h"
+#include "sim.h"
+
+namespace {
+constexpr int kRecords = 4096;
+constexpr int kRecordSize = 64;
+constexpr int kRecordsPerSync = 16;
+
+void Run(bool cached, const std::filesystem::path& image) {
+  Sim::Instance().Reset();
+  std::filesystem::remove(image);
+  FlashDisk flash(256, image);
+  std::optional<SectorCache> cache;
+  if (cached) {
+    cache.emplace(flash);
+  }
+  BlockDevice& disk = cache ? static_cast<BlockDevice&>(*cache) : flash;
+  FileSystem fs(disk);
+  fs.Install();
+  // Leave out formatting.
+  const uint32_t erases = flash.EraseCount();
+  const uint32_t pages = flash.ProgramCount();
+  const uint64_t busy_us = flash.ModeledBusyUs();
+
+  File file = fs.OpenFile("/append.bin", {.write = true, .create_always = true});
+  std::array<std::byte, kRecordSize> record;
+  for (int i = 0; i < kRecords; ++i) {
+    record.fill(std::byte(i));
+    file.Write(record);
+    if (i % kRecordsPerSync == kRecordsPerSync - 1) {
+      file.Sync();
+    }
+  }
+  file.Close();
+  disk.Sync();
+
+  fmt::print("{:<8} {:>8} {:>8} {:>10} {:>10}\n",
+             cached ? "cached" : "uncached", flash.EraseCount() - erases,
+             flash.ProgramCount() - pages,
+             (flash.ModeledBusyUs() - busy_us) / 1000,
+             cache ? cache->Hits() : 0);
+  std::filesystem::remove(image);
+}
+}  // namespace
+
+int main() {
+  const std::filesystem::path image =
+      std::filesystem::temp_directory_path() / "fs_append_bench.img";
+  fmt::print("{} records of {} bytes, synced every {}\n", kRecords, kRecordSize,
+             kRecordsPerSync);
+  fmt::print("{:<8} {:>8} {:>8} {:>10} {:>10}\n", "", "erases", "pages",
+             "busy ms", "hits");
+  Run(false, image);
+  Run(true, image);
+}
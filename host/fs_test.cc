@@ -0,0 +1,31 @@
+#include "fs.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+
+#include "ram_disk.h"
+
+namespace {
+TEST(FileSystemTest, MarksOnlyRegularFileContentsDataOnly) {
+  RamDisk disk(256);
+  FileSystem fs(disk);
+  fs.Install();
+  EXPECT_EQ(std::ranges::count(disk.data_only, true), 0);
+
+  fs.CreateDirectory("logs");
+  File file =
+      fs.OpenFile("logs/a.txt", {.write = true, .create_always = true});
+  file.Write(std::string(3 * BlockDevice::kSectorSize - 1, 'x'));
+  file.Sync();
+  // The file's three clusters, and not the FATs or either directory.
+  EXPECT_EQ(std::ranges::count(disk.data_only, true), 3);
+  EXPECT_TRUE(disk.data_only[file.FirstSector()]);
+  file.Close();
+
+  // The host may have rewritten anything.
+  fs.Remount();
+  EXPECT_EQ(std::ranges::count(disk.data_only, true), 0);
+}
+}  // namespace
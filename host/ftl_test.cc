@@ -0,0 +1,100 @@
+#include "ftl.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+#include "flash.h"
+#include "stats.h"
+#include "temp_path.h"
+
+namespace {
+using SectorData = std::vector<std::byte>;
+
+SectorData Zeroes() { return SectorData(BlockDevice::kSectorSize); }
+
+// Random writes, trims and background steps, checked against a model of the
+// logical contents, and again after remounting.
+TEST(FtlTest, MatchesModelAcrossRemount) {
+  TempPath image("ftl.img");
+  FlashDisk flash(64, image.path());
+  std::mt19937 rng(1);
+  std::vector<SectorData> model;
+  {
+    FlashTranslationLayer ftl(flash);
+    model.assign(ftl.SectorCount(), Zeroes());
+    const int count = model.size();
+    for (int step = 0; step < 5000; ++step) {
+      const int op = rng() % 10;
+      const int i = rng() % count;
+      if (op < 6) {
+        SectorData data(BlockDevice::kSectorSize);
+        std::ranges::generate(data, [&] { return std::byte(rng()); });
+        ftl.WriteSector(i, data);
+        model[i] = data;
+      } else if (op < 8) {
+        const int trimmed = std::min<int>(1 + rng() % 8, count - i);
+        ftl.Trim(i, trimmed);
+        std::fill_n(model.begin() + i, trimmed, Zeroes());
+      } else {
+        ftl.Task();
+      }
+      if (step % 97 == 0) {
+        for (int j = 0; j < count; ++j) {
+          ASSERT_TRUE(std::ranges::equal(ftl.ReadSector(j), model[j]))
+              << "sector " << j << " at step " << step;
+        }
+      }
+    }
+    // Persist the pending trims.
+    ftl.Task();
+  }
+  FlashTranslationLayer remounted(flash);
+  for (int j = 0; j < static_cast<int>(model.size()); ++j) {
+    EXPECT_TRUE(std::ranges::equal(remounted.ReadSector(j), model[j]))
+        << "sector " << j;
+  }
+}
+
+TEST(FtlTest, PacksTrimRecordsIntoFewPagePrograms) {
+  TempPath image("ftl_trim.img");
+  FlashDisk flash(64, image.path());
+  FlashTranslationLayer ftl(flash);
+  for (int i = 0; i < 32; ++i) {
+    ftl.WriteSector(i, Zeroes());
+  }
+  const uint32_t programs = flash.ProgramCount();
+  const uint32_t trimmed = Stats::Global().flash_trimmed_sectors.Get();
+  ftl.Trim(0, 32);
+  // Nothing reaches the flash until Task().
+  EXPECT_EQ(flash.ProgramCount(), programs);
+  ftl.Task();
+  // 32 16-byte records fill two 256-byte pages, plus one more if the log
+  // page in use was partly full.
+  EXPECT_LE(flash.ProgramCount() - programs, 3);
+  EXPECT_EQ(Stats::Global().flash_trimmed_sectors.Get() - trimmed, 32);
+}
+
+TEST(FtlTest, SpreadsRewritesOfOneSectorAcrossTheFlash) {
+  TempPath image("ftl_wear.img");
+  FlashDisk flash(64, image.path());
+  FlashTranslationLayer ftl(flash);
+  for (int i = 0; i < static_cast<int>(ftl.SectorCount()); ++i) {
+    ftl.WriteSector(i, Zeroes());
+  }
+  SectorData data = Zeroes();
+  for (int step = 0; step < 20'000; ++step) {
+    // Rewriting the same contents is skipped.
+    data[0] = std::byte(step);
+    data[1] = std::byte(step >> 8);
+    ftl.WriteSector(0, data);
+    ftl.Task();
+  }
+  EXPECT_GT(ftl.MeanEraseCount(), 100);
+  EXPECT_LE(ftl.MaxEraseCount() - ftl.MinEraseCount(),
+            2 * FlashTranslationLayer::kWearLevelThreshold);
+}
+}  // namespace
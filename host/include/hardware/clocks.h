@@ -0,0 +1,32 @@
+#pragma once
+
+// Host stand-in, reporting the clocks the firmware runs at.
+
+#include <cstdint>
+
+enum clock_index {
+  clk_gpout0 = 0,
+  clk_gpout1,
+  clk_gpout2,
+  clk_gpout3,
+  clk_ref,
+  clk_sys,
+  clk_peri,
+  clk_usb,
+  clk_adc,
+  clk_rtc,
+};
+
+inline uint32_t clock_get_hz(enum clock_index clk_index) {
+  switch (clk_index) {
+    case clk_usb:
+    case clk_adc:
+      return 48'000'000;
+    case clk_ref:
+      return 12'000'000;
+    case clk_rtc:
+      return 46'875;
+    default:
+      return 125'000'000;
+  }
+}
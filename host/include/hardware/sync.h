@@ -0,0 +1,12 @@
+#pragma once
+
+// Host stand-in for interrupt masking. While masked, the simulated clock still
+// advances but alarms and timers are held until the mask is lifted.
+
+#include <cstdint>
+
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+
+inline void __dmb() {}
+inline void __compiler_memory_barrier() {}
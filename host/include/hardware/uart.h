@@ -0,0 +1,6 @@
+#pragma once
+
+// Host stand-in with only enough to declare Uart, so that the simulated UART
+// can share its constants.
+
+typedef struct uart_inst uart_inst_t;
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host stand-in; counted by the simulator instead of rebooting.
+
+#include <cstdint>
+
+void reset_usb_boot(uint32_t gpio_activity_pin_mask,
+                    uint32_t disable_interface_mask);
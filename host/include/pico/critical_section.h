@@ -0,0 +1,20 @@
+#pragma once
+
+// Host stand-in; the simulation is single-threaded, so a critical section only
+// needs to hold off simulated interrupts.
+
+#include <hardware/sync.h>
+
+#include <cstdint>
+
+typedef struct {
+  uint32_t save;
+} critical_section_t;
+
+inline void critical_section_init(critical_section_t*) {}
+inline void critical_section_enter_blocking(critical_section_t* crit_sec) {
+  crit_sec->save = save_and_disable_interrupts();
+}
+inline void critical_section_exit(critical_section_t* crit_sec) {
+  restore_interrupts(crit_sec->save);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// Host stand-in for the Pico SDK's time and alarm API, running on the
+// simulated clock (sim.h). Alarms and repeating timers fire from Sim::Advance()
+// as if from the timer interrupt.
+
+#include <cstdint>
+
+typedef uint64_t absolute_time_t;
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void* user_data);
+
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t* rt);
+
+struct repeating_timer {
+  int64_t delay_us;
+  alarm_id_t alarm_id;
+  repeating_timer_callback_t callback;
+  void* user_data;
+};
+
+uint64_t time_us_64();
+uint32_t time_us_32();
+
+inline absolute_time_t get_absolute_time() { return time_us_64(); }
+inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+
+void busy_wait_us(uint64_t delay_us);
+inline void busy_wait_us_32(uint32_t delay_us) { busy_wait_us(delay_us); }
+inline void sleep_us(uint64_t delay_us) { busy_wait_us(delay_us); }
+inline void sleep_ms(uint32_t delay_ms) { busy_wait_us(delay_ms * 1000ull); }
+
+// As in the SDK, a callback returning a positive value is rescheduled that
+// many us after it returns, a negative one that many us after the time it was
+// due, and zero is not rescheduled.
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback,
+                        void* user_data, bool fire_if_past);
+inline alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback,
+                                  void* user_data, bool fire_if_past) {
+  return add_alarm_at(time_us_64() + us, callback, user_data, fire_if_past);
+}
+bool cancel_alarm(alarm_id_t alarm_id);
+
+// A positive delay is between one callback returning and the next starting; a
+// negative one is between the starts.
+bool add_repeating_timer_us(int64_t delay_us,
+                            repeating_timer_callback_t callback,
+                            void* user_data, repeating_timer_t* out);
+inline bool add_repeating_timer_ms(int32_t delay_ms,
+                                   repeating_timer_callback_t callback,
+                                   void* user_data, repeating_timer_t* out) {
+  return add_repeating_timer_us(delay_ms * int64_t{1000}, callback, user_data,
+                                out);
+}
+bool cancel_repeating_timer(repeating_timer_t* timer);
@@ -0,0 +1,167 @@
+#pragma once
+
+// Host stand-in for the parts of TinyUSB's device stack the firmware uses. The
+// stack itself is simulated (sim_usb.h), down to packet scheduling, and calls
+// the firmware's callbacks just as TinyUSB would.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "tusb_config.h"
+
+#define TU_U16_LOW(u16) ((uint8_t)((u16) & 0x00FF))
+#define TU_U16_HIGH(u16) ((uint8_t)(((u16) >> 8) & 0x00FF))
+#define U16_TO_U8S_LE(u16) TU_U16_LOW(u16), TU_U16_HIGH(u16)
+
+#ifndef CFG_TUD_ENDPOINT0_SIZE
+#define CFG_TUD_ENDPOINT0_SIZE 64
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+  TUSB_DESC_DEVICE = 0x01,
+  TUSB_DESC_CONFIGURATION = 0x02,
+  TUSB_DESC_STRING = 0x03,
+  TUSB_DESC_INTERFACE = 0x04,
+  TUSB_DESC_ENDPOINT = 0x05,
+  TUSB_DESC_INTERFACE_ASSOCIATION = 0x0B,
+  TUSB_DESC_CS_INTERFACE = 0x24,
+};
+
+enum {
+  TUSB_CLASS_CDC = 2,
+  TUSB_CLASS_MSC = 8,
+  TUSB_CLASS_CDC_DATA = 10,
+  TUSB_CLASS_MISC = 0xEF,
+};
+
+enum {
+  MISC_SUBCLASS_COMMON = 2,
+  MISC_PROTOCOL_IAD = 1,
+};
+
+enum {
+  TUSB_XFER_BULK = 2,
+  TUSB_XFER_INTERRUPT = 3,
+};
+
+typedef struct __attribute__((packed)) {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint16_t bcdUSB;
+  uint8_t bDeviceClass;
+  uint8_t bDeviceSubClass;
+  uint8_t bDeviceProtocol;
+  uint8_t bMaxPacketSize0;
+  uint16_t idVendor;
+  uint16_t idProduct;
+  uint16_t bcdDevice;
+  uint8_t iManufacturer;
+  uint8_t iProduct;
+  uint8_t iSerialNumber;
+  uint8_t bNumConfigurations;
+} tusb_desc_device_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t bit_rate;
+  // 0: 1 stop bit, 1: 1.5 stop bits, 2: 2 stop bits
+  uint8_t stop_bits;
+  // 0: none, 1: odd, 2: even, 3: mark, 4: space
+  uint8_t parity;
+  // 5, 6, 7, 8 or 16
+  uint8_t data_bits;
+} cdc_line_coding_t;
+
+#define TUD_CONFIG_DESC_LEN (9)
+
+// Config number, interface count, string index, total length, attribute,
+// power in mA.
+#define TUD_CONFIG_DESCRIPTOR(config_num, _itfcount, _stridx, _total_len, \
+                              _attribute, _power_ma)                      \
+  9, TUSB_DESC_CONFIGURATION, U16_TO_U8S_LE(_total_len), _itfcount,       \
+      config_num, _stridx, (uint8_t)(0x80 | (_attribute)), (_power_ma) / 2
+
+#define TUD_CDC_DESC_LEN (8 + 9 + 5 + 5 + 4 + 5 + 7 + 9 + 7 + 7)
+
+// Interface association, control interface with its header, call management,
+// ACM and union functional descriptors and notification endpoint, then the
+// data interface and its two bulk endpoints.
+#define TUD_CDC_DESCRIPTOR(_itfnum, _stridx, _ep_notif, _ep_notif_size,      \
+                           _epout, _epin, _epsize)                           \
+  8, TUSB_DESC_INTERFACE_ASSOCIATION, _itfnum, 2, TUSB_CLASS_CDC, 2, 0, 0,   \
+      9, TUSB_DESC_INTERFACE, _itfnum, 0, 1, TUSB_CLASS_CDC, 2, 0, _stridx,  \
+      5, TUSB_DESC_CS_INTERFACE, 0x00, U16_TO_U8S_LE(0x0120), 5,             \
+      TUSB_DESC_CS_INTERFACE, 0x01, 0, (uint8_t)((_itfnum) + 1), 4,          \
+      TUSB_DESC_CS_INTERFACE, 0x02, 6, 5, TUSB_DESC_CS_INTERFACE, 0x06,      \
+      _itfnum, (uint8_t)((_itfnum) + 1), 7, TUSB_DESC_ENDPOINT, _ep_notif,   \
+      TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_ep_notif_size), 16, 9,             \
+      TUSB_DESC_INTERFACE, (uint8_t)((_itfnum) + 1), 0, 2,                   \
+      TUSB_CLASS_CDC_DATA, 0, 0, 0, 7, TUSB_DESC_ENDPOINT, _epout,           \
+      TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0, 7, TUSB_DESC_ENDPOINT,      \
+      _epin, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0
+
+#define TUD_MSC_DESC_LEN (9 + 7 + 7)
+
+// SCSI transparent command set over bulk-only transport.
+#define TUD_MSC_DESCRIPTOR(_itfnum, _stridx, _epout, _epin, _epsize)         \
+  9, TUSB_DESC_INTERFACE, _itfnum, 0, 2, TUSB_CLASS_MSC, 0x06, 0x50,         \
+      _stridx, 7, TUSB_DESC_ENDPOINT, _epout, TUSB_XFER_BULK,                \
+      U16_TO_U8S_LE(_epsize), 0, 7, TUSB_DESC_ENDPOINT, _epin,               \
+      TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0
+
+enum {
+  SCSI_SENSE_NONE = 0x00,
+  SCSI_SENSE_NOT_READY = 0x02,
+  SCSI_SENSE_MEDIUM_ERROR = 0x03,
+  SCSI_SENSE_ILLEGAL_REQUEST = 0x05,
+  SCSI_SENSE_UNIT_ATTENTION = 0x06,
+  SCSI_SENSE_DATA_PROTECT = 0x07,
+};
+
+bool tud_init(uint8_t rhport);
+void tud_task(void);
+
+bool tud_cdc_n_connected(uint8_t itf);
+uint32_t tud_cdc_n_available(uint8_t itf);
+int32_t tud_cdc_n_read_char(uint8_t itf);
+uint32_t tud_cdc_n_read(uint8_t itf, void* buffer, uint32_t bufsize);
+uint32_t tud_cdc_n_write_char(uint8_t itf, char ch);
+uint32_t tud_cdc_n_write(uint8_t itf, const void* buffer, uint32_t bufsize);
+uint32_t tud_cdc_n_write_available(uint8_t itf);
+uint32_t tud_cdc_n_write_flush(uint8_t itf);
+
+bool tud_msc_set_sense(uint8_t lun, uint8_t sense_key, uint8_t add_sense_code,
+                       uint8_t add_sense_qualifier);
+
+// Implemented by the firmware.
+
+const uint8_t* tud_descriptor_device_cb(void);
+const uint8_t* tud_descriptor_configuration_cb(uint8_t index);
+const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid);
+
+void tud_cdc_line_coding_cb(uint8_t itf, const cdc_line_coding_t* coding);
+void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts);
+void tud_cdc_send_break_cb(uint8_t itf, uint16_t duration_ms);
+
+bool tud_msc_test_unit_ready_cb(uint8_t lun);
+void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8],
+                        uint8_t product_id[16], uint8_t product_rev[4]);
+void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count,
+                         uint16_t* block_size);
+bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start,
+                           bool load_eject);
+int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset,
+                          void* buffer, uint32_t bufsize);
+bool tud_msc_is_writeable_cb(uint8_t lun);
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset,
+                           uint8_t* buffer, uint32_t bufsize);
+void tud_msc_write10_complete_cb(uint8_t lun);
+int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer,
+                        uint16_t bufsize);
+
+#ifdef __cplusplus
+}
+#endif
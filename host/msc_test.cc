@@ -0,0 +1,156 @@
+#include "msc_device.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "ram_disk.h"
+#include "sim.h"
+#include "sim_usb.h"
+#include "usb_device.h"
+
+namespace {
+constexpr int kSectorSize = BlockDevice::kSectorSize;
+
+std::vector<std::byte> Pattern(int sectors, int seed) {
+  std::vector<std::byte> data(sectors * kSectorSize);
+  for (std::size_t i = 0; i < data.size(); ++i) {
+    data[i] = std::byte((i * 7 + seed) >> 3);
+  }
+  return data;
+}
+
+// A writable MSC volume over a RamDisk, with the host at the other end of
+// SimUsb.
+class MscTest : public testing::Test {
+ protected:
+  MscTest() {
+    Sim::Instance().Reset();
+    SimUsb::Instance().Reset();
+    msc_->SetReady();
+    msc_->SetWritable();
+    usb_.Install();
+  }
+
+  ~MscTest() override {
+    // Drops the USB timer before the device it refers to.
+    Sim::Instance().Reset();
+  }
+
+  // Runs the main loop until the host's commands are done, taking loop_us per
+  // iteration. The USB timer polls TinyUSB in between.
+  void RunUntilIdle(uint64_t loop_us = 10) {
+    while (!SimUsb::Instance().MscIdle()) {
+      usb_.Task();
+      msc_->Task();
+      Sim::Instance().Advance(loop_us);
+    }
+    // Whatever the last callback handed over.
+    msc_->Task();
+  }
+
+  std::vector<std::byte> Read(uint32_t lba, uint32_t blocks) {
+    std::vector<std::byte> read;
+    SimUsb::Instance().MscRead(
+        0, lba, blocks, [&](bool ok, std::span<const std::byte> data) {
+          EXPECT_TRUE(ok);
+          read.assign(data.begin(), data.end());
+        });
+    RunUntilIdle();
+    return read;
+  }
+
+  RamDisk disk_{32};
+  UsbDevice usb_;
+  MscDevice* msc_ = &usb_.AddMsc("Storage", disk_);
+};
+
+TEST_F(MscTest, WritesEachSectorOfASequentialWriteOnce) {
+  const std::vector<std::byte> data = Pattern(16, 1);
+  bool done = false;
+  SimUsb::Instance().MscWrite(0, 4, data, [&](bool ok, auto) { done = ok; });
+  RunUntilIdle();
+  ASSERT_TRUE(done);
+
+  std::vector<int> expected(16);
+  std::iota(expected.begin(), expected.end(), 4);
+  EXPECT_EQ(disk_.writes, expected);
+  // Whole sectors need no read-modify-write.
+  EXPECT_EQ(disk_.reads, 0);
+  EXPECT_EQ(Read(4, 16), data);
+}
+
+TEST_F(MscTest, DefersToTheMainLoopWhenItIsBusy) {
+  const std::vector<std::byte> data = Pattern(8, 2);
+  // A main loop slower than the USB timer, which then gets to TinyUSB first
+  // and has its write callbacks put off.
+  SimUsb::Instance().MscWrite(0, 0, data);
+  RunUntilIdle(/*loop_us=*/3'000);
+
+  EXPECT_GT(SimUsb::Instance().MscRetries(), 0);
+  EXPECT_EQ(disk_.writes.size(), 8);
+  EXPECT_EQ(Read(0, 8), data);
+}
+
+TEST_F(MscTest, ServesReadsOfSectorsNotWrittenOutYet) {
+  const std::vector<std::byte> data = Pattern(1, 3);
+  SimUsb::Instance().MscWrite(0, 9, data);
+  // Only TinyUSB runs, so the sector stays in MscDevice's buffers.
+  while (!SimUsb::Instance().MscIdle()) {
+    usb_.Task();
+    Sim::Instance().Advance(10);
+  }
+  EXPECT_TRUE(disk_.writes.empty());
+
+  std::vector<std::byte> read;
+  SimUsb::Instance().MscRead(0, 9, 1, [&](bool ok, auto sector) {
+    read.assign(sector.begin(), sector.end());
+  });
+  while (!SimUsb::Instance().MscIdle()) {
+    usb_.Task();
+    Sim::Instance().Advance(10);
+  }
+  EXPECT_EQ(read, data);
+}
+
+TEST_F(MscTest, TrimsUnmappedSectorsAfterEarlierWrites) {
+  SimUsb::Instance().MscWrite(0, 2, Pattern(1, 4));
+  SimUsb::Instance().MscUnmap(0, 2, 3);
+  RunUntilIdle();
+  EXPECT_EQ(disk_.writes, std::vector{2});
+  EXPECT_EQ(disk_.trims, (std::vector<std::pair<int, int>>{{2, 3}}));
+}
+
+TEST_F(MscTest, WriteAfterAnUnmapIsNotTrimmed) {
+  // As when the host deletes a file and reuses its clusters.
+  const std::vector<std::byte> data = Pattern(1, 6);
+  SimUsb::Instance().MscUnmap(0, 4, 4);
+  SimUsb::Instance().MscWrite(0, 5, data);
+  // Nothing runs the main loop until both have arrived.
+  while (!SimUsb::Instance().MscIdle()) {
+    usb_.Task();
+    Sim::Instance().Advance(10);
+  }
+  RunUntilIdle();
+  EXPECT_EQ(disk_.writes, std::vector{5});
+  EXPECT_EQ(disk_.trims, (std::vector<std::pair<int, int>>{{4, 1}, {6, 2}}));
+  EXPECT_EQ(Read(5, 1), data);
+}
+
+TEST_F(MscTest, ReportsHostChangesOnceWritesSettle) {
+  SimUsb::Instance().MscWrite(0, 0, Pattern(1, 5));
+  RunUntilIdle();
+  EXPECT_TRUE(msc_->HostWriting());
+  EXPECT_FALSE(msc_->TakeHostChanges());
+
+  Sim::Instance().Advance(MscDevice::kHostQuietUs);
+  EXPECT_FALSE(msc_->HostWriting());
+  EXPECT_TRUE(msc_->TakeHostChanges());
+  EXPECT_FALSE(msc_->TakeHostChanges());
+}
+}  // namespace
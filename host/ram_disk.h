@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "block_device.h"
+
+// BlockDevice in RAM that logs the operations done on it.
+class RamDisk : public BlockDevice {
+ public:
+  explicit RamDisk(std::size_t sector_count)
+      : data_only(sector_count), sectors_(sector_count * kSectorSize) {}
+
+  std::span<const std::byte> ReadSector(int i) override {
+    ++reads;
+    return std::span(sectors_).subspan(i * kSectorSize, kSectorSize);
+  }
+
+  void WriteSector(int i, std::span<const std::byte> payload) override {
+    writes.push_back(i);
+    std::ranges::copy(payload, sectors_.begin() + i * kSectorSize);
+  }
+
+  std::size_t SectorCount() override { return sectors_.size() / kSectorSize; }
+
+  void Trim(int first, int count) override { trims.push_back({first, count}); }
+
+  void MarkDataOnly(int first, int count) override {
+    std::fill_n(data_only.begin() + first, count, true);
+  }
+
+  void ClearDataOnly(int first, int count) override {
+    std::fill_n(data_only.begin() + first, count, false);
+  }
+
+  void Sync() override { ++syncs; }
+
+  int reads = 0;
+  // Sectors written, in order.
+  std::vector<int> writes;
+  std::vector<std::pair<int, int>> trims;
+  // Indexed by sector.
+  std::vector<bool> data_only;
+  int syncs = 0;
+
+ private:
+  std::vector<std::byte> sectors_;
+};
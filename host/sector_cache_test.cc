@@ -0,0 +1,99 @@
+#include "sector_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "ram_disk.h"
+#include "stats.h"
+
+namespace {
+using Sector = std::array<std::byte, BlockDevice::kSectorSize>;
+
+Sector Filled(int value) {
+  Sector sector;
+  sector.fill(std::byte(value));
+  return sector;
+}
+
+TEST(SectorCacheTest, CoalescesRewritesOfASector) {
+  RamDisk disk(8);
+  SectorCache cache(disk);
+  for (int i = 0; i < 10; ++i) {
+    cache.WriteSector(3, Filled(i));
+  }
+  EXPECT_TRUE(disk.writes.empty());
+  EXPECT_EQ(cache.ReadSector(3)[0], std::byte(9));
+
+  cache.Sync();
+  EXPECT_EQ(disk.writes, std::vector{3});
+  EXPECT_EQ(disk.ReadSector(3)[0], std::byte(9));
+  EXPECT_EQ(disk.syncs, 1);
+  EXPECT_EQ(cache.Writebacks(), 1);
+  // Clean now.
+  cache.Sync();
+  EXPECT_EQ(disk.writes.size(), 1);
+}
+
+TEST(SectorCacheTest, CountsHitsAndMisses) {
+  const Stats& stats = Stats::Global();
+  const uint32_t hits = stats.sector_cache_hits.Get();
+  const uint32_t misses = stats.sector_cache_misses.Get();
+  const uint32_t writebacks = stats.sector_cache_writebacks.Get();
+  RamDisk disk(8);
+  SectorCache cache(disk);
+  cache.ReadSector(1);
+  cache.WriteSector(1, Filled(1));
+  cache.ReadSector(1);
+  cache.WriteSector(1, Filled(2));
+  cache.Sync();
+  EXPECT_EQ(cache.Misses(), 2);
+  EXPECT_EQ(cache.Hits(), 2);
+  EXPECT_EQ(cache.Writebacks(), 1);
+  // Reported on the device too.
+  EXPECT_EQ(stats.sector_cache_hits.Get() - hits, 2);
+  EXPECT_EQ(stats.sector_cache_misses.Get() - misses, 2);
+  EXPECT_EQ(stats.sector_cache_writebacks.Get() - writebacks, 1);
+}
+
+TEST(SectorCacheTest, EvictsUnreferencedEntriesFirst) {
+  RamDisk disk(8);
+  SectorCache cache(disk, /*entry_count=*/2);
+  cache.WriteSector(0, Filled(0));
+  cache.WriteSector(1, Filled(1));
+  // Both are referenced, so the hand clears both and comes back to sector 0.
+  cache.WriteSector(2, Filled(2));
+  EXPECT_EQ(disk.writes, std::vector{0});
+  // Sector 1 lost its reference bit; touching sector 2 keeps it.
+  cache.ReadSector(2);
+  cache.WriteSector(3, Filled(3));
+  EXPECT_EQ(disk.writes, (std::vector{0, 1}));
+  EXPECT_EQ(disk.ReadSector(1)[0], std::byte(1));
+}
+
+TEST(SectorCacheTest, SyncWritesBackInSectorOrder) {
+  RamDisk disk(8);
+  SectorCache cache(disk);
+  for (int i : {5, 2, 7, 0}) {
+    cache.WriteSector(i, Filled(i));
+  }
+  cache.Sync();
+  EXPECT_EQ(disk.writes, (std::vector{0, 2, 5, 7}));
+}
+
+TEST(SectorCacheTest, TrimDropsDirtyEntries) {
+  RamDisk disk(8);
+  SectorCache cache(disk);
+  cache.WriteSector(2, Filled(2));
+  cache.WriteSector(3, Filled(3));
+  cache.Trim(2, 1);
+  cache.Sync();
+  EXPECT_EQ(disk.writes, std::vector{3});
+  EXPECT_EQ(disk.trims, (std::vector<std::pair<int, int>>{{2, 1}}));
+}
+}  // namespace
@@ -0,0 +1,154 @@
+#include "sim.h"
+
+#include <hardware/sync.h>
+#include <pico/bootrom.h>
+
+#include <algorithm>
+
+Sim& Sim::Instance() {
+  static Sim sim;
+  return sim;
+}
+
+void Sim::Reset() { *this = Sim(); }
+
+void Sim::Advance(uint64_t us) { AdvanceTo(now_us_ + us); }
+
+void Sim::AdvanceTo(uint64_t time_us) {
+  RunDue(time_us);
+  now_us_ = std::max(now_us_, time_us);
+}
+
+uint32_t Sim::DisableInterrupts() {
+  const uint32_t status = interrupts_enabled_;
+  if (interrupts_enabled_) {
+    interrupts_enabled_ = false;
+    interrupts_off_since_us_ = now_us_;
+  }
+  return status;
+}
+
+void Sim::RestoreInterrupts(uint32_t status) {
+  if (!status || interrupts_enabled_) {
+    return;
+  }
+  max_interrupts_off_us_ =
+      std::max(max_interrupts_off_us_, now_us_ - interrupts_off_since_us_);
+  interrupts_enabled_ = true;
+  // Anything that came due meanwhile was pending all along.
+  RunDue(now_us_);
+}
+
+alarm_id_t Sim::AddAlarm(uint64_t time_us, alarm_callback_t callback,
+                         void* user_data, bool fire_if_past) {
+  if (time_us <= now_us_ && !fire_if_past) {
+    return 0;
+  }
+  const alarm_id_t id = next_id_++;
+  alarms_.push_back({.id = id,
+                     .due_us = time_us,
+                     .callback = callback,
+                     .user_data = user_data,
+                     .timer = nullptr});
+  return id;
+}
+
+bool Sim::CancelAlarm(alarm_id_t id) {
+  if (id == firing_) {
+    firing_cancelled_ = true;
+    return true;
+  }
+  return std::erase_if(alarms_, [&](const Alarm& a) { return a.id == id; }) > 0;
+}
+
+bool Sim::AddRepeatingTimer(int64_t delay_us,
+                            repeating_timer_callback_t callback,
+                            void* user_data, repeating_timer_t* out) {
+  const alarm_id_t id = next_id_++;
+  *out = {.delay_us = delay_us,
+          .alarm_id = id,
+          .callback = callback,
+          .user_data = user_data};
+  alarms_.push_back({.id = id,
+                     .due_us = now_us_ + (delay_us < 0 ? -delay_us : delay_us),
+                     .callback = nullptr,
+                     .user_data = nullptr,
+                     .timer = out});
+  return true;
+}
+
+void Sim::RunDue(uint64_t until_us) {
+  while (interrupts_enabled_) {
+    const auto next = std::ranges::min_element(alarms_, {}, &Alarm::due_us);
+    if (next == alarms_.end() || next->due_us > until_us) {
+      return;
+    }
+    const Alarm alarm = *next;
+    alarms_.erase(next);
+    now_us_ = std::max(now_us_, alarm.due_us);
+    Fire(alarm);
+  }
+}
+
+void Sim::Fire(Alarm alarm) {
+  const uint32_t interrupts = DisableInterrupts();
+  firing_ = alarm.id;
+  firing_cancelled_ = false;
+  int64_t reschedule_us;
+  if (alarm.timer) {
+    const int64_t delay_us = alarm.timer->delay_us;
+    reschedule_us = alarm.timer->callback(alarm.timer) ? delay_us : 0;
+  } else {
+    reschedule_us = alarm.callback(alarm.id, alarm.user_data);
+  }
+  firing_ = 0;
+  if (reschedule_us != 0 && !firing_cancelled_) {
+    alarm.due_us = reschedule_us > 0 ? now_us_ + reschedule_us
+                                     : alarm.due_us - reschedule_us;
+    alarms_.push_back(alarm);
+  }
+  // Leaves interrupts on for RunDue()'s loop to fire the next alarm.
+  interrupts_enabled_ = interrupts;
+  if (interrupts) {
+    max_interrupts_off_us_ =
+        std::max(max_interrupts_off_us_, now_us_ - interrupts_off_since_us_);
+  }
+}
+
+uint64_t time_us_64() { return Sim::Instance().Now(); }
+
+uint32_t time_us_32() { return Sim::Instance().Now(); }
+
+void busy_wait_us(uint64_t delay_us) { Sim::Instance().Advance(delay_us); }
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback,
+                        void* user_data, bool fire_if_past) {
+  return Sim::Instance().AddAlarm(time, callback, user_data, fire_if_past);
+}
+
+bool cancel_alarm(alarm_id_t alarm_id) {
+  return Sim::Instance().CancelAlarm(alarm_id);
+}
+
+bool add_repeating_timer_us(int64_t delay_us,
+                            repeating_timer_callback_t callback,
+                            void* user_data, repeating_timer_t* out) {
+  return Sim::Instance().AddRepeatingTimer(delay_us, callback, user_data, out);
+}
+
+bool cancel_repeating_timer(repeating_timer_t* timer) {
+  return Sim::Instance().CancelAlarm(timer->alarm_id);
+}
+
+uint32_t save_and_disable_interrupts() {
+  return Sim::Instance().DisableInterrupts();
+}
+
+void restore_interrupts(uint32_t status) {
+  Sim::Instance().RestoreInterrupts(status);
+}
+
+void reset_usb_boot(uint32_t gpio_activity_pin_mask,
+                    uint32_t disable_interface_mask) {
+  Sim::Instance().CountUsbBootReset();
+}
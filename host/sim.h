@@ -0,0 +1,72 @@
+#pragma once
+
+#include <pico/time.h>
+
+#include <cstdint>
+#include <vector>
+
+// Simulated microsecond clock behind the host's pico/time.h, with alarms and
+// repeating timers standing in for the timer interrupt. Nothing moves on its
+// own: harnesses advance the clock to model time spent in the main loop, and
+// busy waits (e.g. modeled flash operations) advance it too.
+//
+// Alarms that come due fire during Advance(), unless interrupts are disabled,
+// in which case they fire as soon as they are re-enabled. They run with
+// interrupts disabled, as on the device.
+class Sim {
+ public:
+  static Sim& Instance();
+
+  // Back to time zero with no alarms, e.g. between tests.
+  void Reset();
+
+  uint64_t Now() { return now_us_; }
+
+  // Moves the clock forward, firing the alarms that come due on the way at
+  // the times they are due.
+  void Advance(uint64_t us);
+  void AdvanceTo(uint64_t time_us);
+
+  bool InterruptsEnabled() { return interrupts_enabled_; }
+  uint32_t DisableInterrupts();
+  void RestoreInterrupts(uint32_t status);
+
+  // Longest stretch of simulated time with interrupts disabled since Reset().
+  uint64_t MaxInterruptsOffUs() { return max_interrupts_off_us_; }
+
+  // Number of reset_usb_boot() calls since Reset().
+  int UsbBootResets() { return usb_boot_resets_; }
+
+  // pico/time.h and pico/bootrom.h glue.
+  alarm_id_t AddAlarm(uint64_t time_us, alarm_callback_t callback,
+                      void* user_data, bool fire_if_past);
+  bool CancelAlarm(alarm_id_t id);
+  bool AddRepeatingTimer(int64_t delay_us, repeating_timer_callback_t callback,
+                         void* user_data, repeating_timer_t* out);
+  void CountUsbBootReset() { ++usb_boot_resets_; }
+
+ private:
+  struct Alarm {
+    alarm_id_t id;
+    uint64_t due_us;
+    alarm_callback_t callback;
+    void* user_data;
+    // Set for repeating timers, whose callback is called instead.
+    repeating_timer_t* timer;
+  };
+
+  // Fires alarms due by the given time, in order.
+  void RunDue(uint64_t until_us);
+  void Fire(Alarm alarm);
+
+  uint64_t now_us_ = 0;
+  bool interrupts_enabled_ = true;
+  uint64_t interrupts_off_since_us_ = 0;
+  uint64_t max_interrupts_off_us_ = 0;
+  std::vector<Alarm> alarms_;
+  alarm_id_t next_id_ = 1;
+  // Alarm whose callback is running, and whether it cancelled itself.
+  alarm_id_t firing_ = 0;
+  bool firing_cancelled_ = false;
+  int usb_boot_resets_ = 0;
+};
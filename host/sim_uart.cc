@@ -0,0 +1,116 @@
+#include "sim_uart.h"
+
+#include <pico/time.h>
+
+#include <algorithm>
+
+#include "uart.h"
+
+SimUart::SimUart(ChannelStats& stats, uint32_t baud_rate,
+                 FlowControl flow_control)
+    : stats_(stats), flow_control_(flow_control) {
+  config_.baud_rate = baud_rate;
+}
+
+std::span<char> SimUart::Read(std::span<char> buffer) {
+  Update();
+  stats_.rx_ring_high_water.RecordMax(rx_.Size());
+  const std::span<char> data = rx_.Read(buffer);
+  stats_.rx_ring_overruns.Set(rx_.Overruns());
+  UpdateRxFlow();
+  return data;
+}
+
+int SimUart::WriteAvailable() {
+  Update();
+  return pending_config_ ? 0 : tx_.Free();
+}
+
+int SimUart::Write(std::span<const char> data) {
+  Update();
+  if (tx_.Size() == 0) {
+    // The line has been idle.
+    tx_line_ns_ = std::max(tx_line_ns_, time_us_64() * 1000);
+  }
+  const int written = tx_.Write(data);
+  stats_.tx_ring_high_water.RecordMax(tx_.Size());
+  return written;
+}
+
+void SimUart::SetConfig(const UartConfig& config) {
+  pending_config_ = config;
+  Update();
+}
+
+void SimUart::FarEndSend(std::span<const char> data, uint64_t not_before_us) {
+  Update();
+  // Anything earlier would have been sent already.
+  not_before_us = std::max(not_before_us, time_us_64());
+  for (char byte : data) {
+    far_end_tx_.push_back({.byte = byte, .not_before_us = not_before_us});
+  }
+}
+
+std::size_t SimUart::FarEndPending() {
+  Update();
+  return far_end_tx_.size();
+}
+
+uint64_t SimUart::CharacterNs() {
+  const int bits = 1 + config_.data_bits +
+                   (config_.parity == UartConfig::Parity::kNone ? 0 : 1) +
+                   config_.stop_bits;
+  return uint64_t{1'000'000'000} * bits / config_.baud_rate;
+}
+
+void SimUart::Update() {
+  const uint64_t now_ns = time_us_64() * 1000;
+  const uint64_t character_ns = CharacterNs();
+  while (!far_end_tx_.empty() && (!rx_stopped_ || stop_allowance_ > 0)) {
+    const Pending& next = far_end_tx_.front();
+    const uint64_t end_ns =
+        std::max(rx_line_ns_, next.not_before_us * 1000) + character_ns;
+    if (end_ns > now_ns) {
+      break;
+    }
+    // DMA stores the byte whether or not there is room.
+    const uint32_t head = rx_.Head();
+    *rx_.At(head) = next.byte;
+    rx_.SetHead(head + 1);
+    rx_line_ns_ = end_ns;
+    if (rx_monitor_) {
+      rx_monitor_(next.byte, end_ns / 1000);
+    }
+    if (rx_stopped_) {
+      --stop_allowance_;
+    }
+    far_end_tx_.pop_front();
+  }
+  while (tx_.Size() > 0 && tx_line_ns_ + character_ns <= now_ns) {
+    char byte;
+    tx_.Read(std::span(&byte, 1));
+    tx_line_ns_ += character_ns;
+    if (far_end_receiver_) {
+      far_end_receiver_(byte, tx_line_ns_ / 1000);
+    }
+  }
+  if (pending_config_ && tx_.Size() == 0) {
+    config_ = *pending_config_;
+    pending_config_.reset();
+  }
+}
+
+void SimUart::UpdateRxFlow() {
+  const std::size_t level = rx_.Size();
+  if (!rx_stopped_ && level >= Uart::kRxStopLevel) {
+    stats_.rx_flow_stops.Add();
+    if (flow_control_ != FlowControl::kNone) {
+      rx_stopped_ = true;
+      stop_allowance_ = stop_latency_bytes_;
+    }
+  } else if (rx_stopped_ && level <= Uart::kRxResumeLevel) {
+    rx_stopped_ = false;
+    // The far end picks up from now, not from when it stopped.
+    rx_line_ns_ = std::max(rx_line_ns_, time_us_64() * 1000);
+  }
+}
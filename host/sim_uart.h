@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <span>
+
+#include "byte_ring.h"
+#include "dma_stream.h"
+#include "serial_port.h"
+#include "stats.h"
+#include "uart_config.h"
+
+// SerialPort model of the DMA-driven Uart (uart.h), and of the device at the
+// far end of its line. Bytes take their real time on the wire for the line
+// settings. Received bytes land in a ring the size of DmaStream's, which the
+// DMA channel fills whether or not the main loop keeps up, so a slow reader
+// loses the oldest bytes as overruns. Flow control stops the far end at the
+// Uart's ring levels, after it has sent a few more bytes.
+//
+// The line is brought up to date with the simulated clock lazily, on each
+// call.
+class SimUart : public SerialPort {
+ public:
+  // Called with a byte and the time its stop bit ended.
+  using Monitor = std::function<void(char byte, uint64_t time_us)>;
+
+  SimUart(ChannelStats& stats, uint32_t baud_rate,
+          FlowControl flow_control = FlowControl::kNone);
+
+  std::span<char> Read(std::span<char> buffer) override;
+  // Zero while a config change waits for queued data to go out, as for Uart.
+  int WriteAvailable() override;
+  int Write(std::span<const char> data) override;
+  // Takes effect once everything queued has been sent.
+  void SetConfig(const UartConfig& config) override;
+
+  const UartConfig& Config() { return config_; }
+
+  // Far end.
+
+  // Queues bytes for the far end to send, no earlier than the given time and
+  // after anything it has queued already.
+  void FarEndSend(std::span<const char> data, uint64_t not_before_us = 0);
+  std::size_t FarEndPending();
+
+  // Bytes the far end still sends after being told to stop, e.g. from its own
+  // transmit FIFO.
+  void SetFarEndStopLatency(int bytes) { stop_latency_bytes_ = bytes; }
+  bool FarEndStopped() { return rx_stopped_; }
+
+  // Each byte from the far end, as the UART receives it.
+  void SetRxMonitor(Monitor monitor) { rx_monitor_ = std::move(monitor); }
+  // Each byte sent to the far end, as it arrives there.
+  void SetFarEndReceiver(Monitor receiver) {
+    far_end_receiver_ = std::move(receiver);
+  }
+
+ private:
+  struct Pending {
+    char byte;
+    uint64_t not_before_us;
+  };
+
+  // Moves both directions of the line up to the current time.
+  void Update();
+  // Time one character takes on the wire, in ns.
+  uint64_t CharacterNs();
+  // As Uart::UpdateRxFlow().
+  void UpdateRxFlow();
+
+  ChannelStats& stats_;
+  FlowControl flow_control_;
+  UartConfig config_;
+  std::optional<UartConfig> pending_config_;
+
+  ByteRing<DmaStream::kRxRingSize> rx_;
+  ByteRing<DmaStream::kTxRingSize> tx_;
+  // When each direction of the line is next free, in ns.
+  uint64_t rx_line_ns_ = 0;
+  uint64_t tx_line_ns_ = 0;
+
+  std::deque<Pending> far_end_tx_;
+  bool rx_stopped_ = false;
+  int stop_latency_bytes_ = 2;
+  // Bytes the far end may still send while stopped.
+  int stop_allowance_ = 0;
+
+  Monitor rx_monitor_;
+  Monitor far_end_receiver_;
+};
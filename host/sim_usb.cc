@@ -0,0 +1,328 @@
+#include "sim_usb.h"
+
+#include <pico/time.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+void WriteBigEndian(uint8_t* out, uint64_t value, int size) {
+  for (int i = size - 1; i >= 0; --i) {
+    out[i] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+std::size_t PacketCount(std::size_t bytes) {
+  return (bytes + SimUsb::kPacketSize - 1) / SimUsb::kPacketSize;
+}
+}  // namespace
+
+SimUsb& SimUsb::Instance() {
+  static SimUsb usb;
+  return usb;
+}
+
+void SimUsb::Reset() { *this = SimUsb(); }
+
+void SimUsb::Open(uint8_t itf, bool dtr) { cdc_[itf].pending_dtr = dtr; }
+
+void SimUsb::SetLineCoding(uint8_t itf, const cdc_line_coding_t& coding) {
+  cdc_[itf].pending_coding = coding;
+}
+
+void SimUsb::Send(uint8_t itf, std::span<const char> data) {
+  cdc_[itf].host_tx.insert(cdc_[itf].host_tx.end(), data.begin(), data.end());
+}
+
+void SimUsb::MscRead(uint8_t lun, uint32_t lba, uint32_t blocks,
+                     MscDone done) {
+  msc_queue_.push_back({.op = MscCommand::Op::kRead,
+                        .lun = lun,
+                        .lba = lba,
+                        .blocks = blocks,
+                        .done = std::move(done)});
+}
+
+void SimUsb::MscWrite(uint8_t lun, uint32_t lba,
+                      std::span<const std::byte> data, MscDone done) {
+  msc_queue_.push_back({.op = MscCommand::Op::kWrite,
+                        .lun = lun,
+                        .lba = lba,
+                        .data = {data.begin(), data.end()},
+                        .done = std::move(done)});
+}
+
+void SimUsb::MscUnmap(uint8_t lun, uint32_t lba, uint32_t blocks,
+                      MscDone done) {
+  msc_queue_.push_back({.op = MscCommand::Op::kUnmap,
+                        .lun = lun,
+                        .lba = lba,
+                        .blocks = blocks,
+                        .done = std::move(done)});
+}
+
+void SimUsb::Task() {
+  for (uint8_t itf = 0; itf < cdc_.size(); ++itf) {
+    Cdc& cdc = cdc_[itf];
+    if (cdc.pending_dtr) {
+      cdc.dtr = *std::exchange(cdc.pending_dtr, std::nullopt);
+      tud_cdc_line_state_cb(itf, cdc.dtr, false);
+    }
+    if (cdc.pending_coding) {
+      const cdc_line_coding_t coding = *cdc.pending_coding;
+      cdc.pending_coding.reset();
+      tud_cdc_line_coding_cb(itf, &coding);
+    }
+  }
+  // The host takes turns between endpoints a packet at a time, carrying on
+  // where it left off so that none is favored when the frame runs out.
+  const int endpoints = cdc_.size() + 1;
+  bool moved = true;
+  while (moved) {
+    moved = false;
+    for (int i = 0; i < endpoints; ++i) {
+      const int endpoint = (first_endpoint_ + i) % endpoints;
+      moved |= endpoint < cdc_.size() ? MoveCdcPacket(cdc_[endpoint], endpoint)
+                                      : MscStep();
+    }
+    first_endpoint_ = (first_endpoint_ + 1) % endpoints;
+  }
+}
+
+int SimUsb::BusBudget() {
+  const uint64_t frame = time_us_64() / 1000;
+  if (frame != frame_) {
+    frame_ = frame;
+    budget_ = kPacketsPerFrame;
+  }
+  return budget_;
+}
+
+bool SimUsb::MoveCdcPacket(Cdc& cdc, uint8_t itf) {
+  bool moved = false;
+  // TinyUSB only arms the OUT endpoint while the RX FIFO can take a whole
+  // packet.
+  if (!cdc.host_tx.empty() &&
+      CFG_TUD_CDC_RX_BUFSIZE - cdc.rx_fifo.size() >= kPacketSize &&
+      BusBudget() > 0) {
+    const std::size_t size =
+        std::min<std::size_t>(kPacketSize, cdc.host_tx.size());
+    cdc.rx_fifo.insert(cdc.rx_fifo.end(), cdc.host_tx.begin(),
+                       cdc.host_tx.begin() + size);
+    cdc.host_tx.erase(cdc.host_tx.begin(), cdc.host_tx.begin() + size);
+    --budget_;
+    ++cdc.out_packets;
+    moved = true;
+  }
+  if (!cdc.in_packet.empty() && time_us_64() >= cdc.next_in_us &&
+      BusBudget() > 0) {
+    cdc.next_in_us = time_us_64() + cdc.in_interval_us;
+    --budget_;
+    ++cdc.in_packets;
+    if (receiver_) {
+      // The host controller reports completions at the end of the frame.
+      receiver_(itf, cdc.in_packet, (frame_ + 1) * 1000);
+    }
+    cdc.in_packet.clear();
+    // As TinyUSB's completion handler does, send whatever queued up meanwhile.
+    Flush(itf);
+    moved = true;
+  }
+  return moved;
+}
+
+uint32_t SimUsb::Read(uint8_t itf, std::span<char> buffer) {
+  std::deque<char>& fifo = cdc_[itf].rx_fifo;
+  const std::size_t size = std::min(buffer.size(), fifo.size());
+  std::copy_n(fifo.begin(), size, buffer.begin());
+  fifo.erase(fifo.begin(), fifo.begin() + size);
+  return size;
+}
+
+uint32_t SimUsb::WriteAvailable(uint8_t itf) {
+  const Cdc& cdc = cdc_[itf];
+  // Without a terminal attached, TinyUSB lets writes overwrite the FIFO.
+  return cdc.dtr ? CFG_TUD_CDC_TX_BUFSIZE - cdc.tx_fifo.size()
+                 : CFG_TUD_CDC_TX_BUFSIZE;
+}
+
+uint32_t SimUsb::Write(uint8_t itf, std::span<const char> data) {
+  Cdc& cdc = cdc_[itf];
+  if (!cdc.dtr) {
+    return data.size();
+  }
+  const std::size_t size =
+      std::min<std::size_t>(data.size(), WriteAvailable(itf));
+  cdc.tx_fifo.insert(cdc.tx_fifo.end(), data.begin(), data.begin() + size);
+  if (cdc.tx_fifo.size() >= kPacketSize) {
+    Flush(itf);
+  }
+  return size;
+}
+
+uint32_t SimUsb::Flush(uint8_t itf) {
+  Cdc& cdc = cdc_[itf];
+  if (!cdc.dtr || !cdc.in_packet.empty() || cdc.tx_fifo.empty()) {
+    return 0;
+  }
+  const std::size_t size =
+      std::min<std::size_t>(kPacketSize, cdc.tx_fifo.size());
+  cdc.in_packet.assign(cdc.tx_fifo.begin(), cdc.tx_fifo.begin() + size);
+  cdc.tx_fifo.erase(cdc.tx_fifo.begin(), cdc.tx_fifo.begin() + size);
+  return size;
+}
+
+bool SimUsb::MscStep() {
+  if (msc_queue_.empty()) {
+    return false;
+  }
+  MscCommand& command = msc_queue_.front();
+  uint32_t block_count;
+  uint16_t block_size;
+  tud_msc_capacity_cb(command.lun, &block_count, &block_size);
+  switch (command.op) {
+    case MscCommand::Op::kUnmap: {
+      // 8-byte parameter list header, then one block descriptor.
+      std::array<uint8_t, 24> params = {};
+      WriteBigEndian(params.data(), params.size() - 2, 2);
+      WriteBigEndian(params.data() + 2, 16, 2);
+      WriteBigEndian(params.data() + 8, command.lba, 8);
+      WriteBigEndian(params.data() + 16, command.blocks, 4);
+      std::array<uint8_t, 16> cdb = {0x42};
+      MscFinish(tud_msc_scsi_cb(command.lun, cdb.data(), params.data(),
+                                params.size()) >= 0);
+      return false;
+    }
+    case MscCommand::Op::kWrite: {
+      if (command.chunk_size == 0) {
+        command.chunk_size = std::min<std::size_t>(
+            CFG_TUD_MSC_EP_BUFSIZE, command.data.size() - command.done_bytes);
+        command.chunk_packets = 0;
+        command.chunk_consumed = 0;
+      }
+      if (command.chunk_packets < PacketCount(command.chunk_size)) {
+        if (BusBudget() == 0) {
+          return false;
+        }
+        --budget_;
+        ++command.chunk_packets;
+        return true;
+      }
+      // The whole chunk is in TinyUSB's buffer; offer it to the firmware
+      // until it has taken all of it.
+      while (command.chunk_consumed < command.chunk_size) {
+        const std::size_t position =
+            command.done_bytes + command.chunk_consumed;
+        const int32_t consumed = tud_msc_write10_cb(
+            command.lun, command.lba + position / block_size,
+            position % block_size,
+            reinterpret_cast<uint8_t*>(command.data.data() + position),
+            command.chunk_size - command.chunk_consumed);
+        if (consumed < 0) {
+          MscFinish(false);
+          return false;
+        }
+        if (consumed == 0) {
+          ++msc_retries_;
+          return false;
+        }
+        command.chunk_consumed += consumed;
+      }
+      command.done_bytes += std::exchange(command.chunk_size, 0);
+      if (command.done_bytes == command.data.size()) {
+        tud_msc_write10_complete_cb(command.lun);
+        MscFinish(true);
+      }
+      return true;
+    }
+    case MscCommand::Op::kRead: {
+      command.data.resize(std::size_t{command.blocks} * block_size);
+      if (command.chunk_size == 0) {
+        const std::size_t position = command.done_bytes;
+        const int32_t size = tud_msc_read10_cb(
+            command.lun, command.lba + position / block_size,
+            position % block_size, command.data.data() + position,
+            std::min<std::size_t>(CFG_TUD_MSC_EP_BUFSIZE,
+                                  command.data.size() - position));
+        if (size < 0) {
+          MscFinish(false);
+          return false;
+        }
+        if (size == 0) {
+          ++msc_retries_;
+          return false;
+        }
+        command.chunk_size = size;
+        command.chunk_packets = 0;
+      }
+      if (command.chunk_packets < PacketCount(command.chunk_size)) {
+        if (BusBudget() == 0) {
+          return false;
+        }
+        --budget_;
+        ++command.chunk_packets;
+        return true;
+      }
+      command.done_bytes += std::exchange(command.chunk_size, 0);
+      if (command.done_bytes == command.data.size()) {
+        MscFinish(true);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void SimUsb::MscFinish(bool ok) {
+  MscCommand command = std::move(msc_queue_.front());
+  msc_queue_.pop_front();
+  if (command.done) {
+    command.done(ok, command.data);
+  }
+}
+
+bool tud_init(uint8_t rhport) { return true; }
+
+void tud_task() { SimUsb::Instance().Task(); }
+
+bool tud_cdc_n_connected(uint8_t itf) {
+  return SimUsb::Instance().Connected(itf);
+}
+
+uint32_t tud_cdc_n_available(uint8_t itf) {
+  return SimUsb::Instance().Available(itf);
+}
+
+int32_t tud_cdc_n_read_char(uint8_t itf) {
+  char c;
+  return SimUsb::Instance().Read(itf, std::span(&c, 1)) == 1 ? c : -1;
+}
+
+uint32_t tud_cdc_n_read(uint8_t itf, void* buffer, uint32_t bufsize) {
+  return SimUsb::Instance().Read(
+      itf, std::span(static_cast<char*>(buffer), bufsize));
+}
+
+uint32_t tud_cdc_n_write_char(uint8_t itf, char ch) {
+  return SimUsb::Instance().Write(itf, std::span(&ch, 1));
+}
+
+uint32_t tud_cdc_n_write(uint8_t itf, const void* buffer, uint32_t bufsize) {
+  return SimUsb::Instance().Write(
+      itf, std::span(static_cast<const char*>(buffer), bufsize));
+}
+
+uint32_t tud_cdc_n_write_available(uint8_t itf) {
+  return SimUsb::Instance().WriteAvailable(itf);
+}
+
+uint32_t tud_cdc_n_write_flush(uint8_t itf) {
+  return SimUsb::Instance().Flush(itf);
+}
+
+bool tud_msc_set_sense(uint8_t lun, uint8_t sense_key, uint8_t add_sense_code,
+                       uint8_t add_sense_qualifier) {
+  SimUsb::Instance().SetSense(sense_key);
+  return true;
+}
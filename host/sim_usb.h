@@ -0,0 +1,145 @@
+#pragma once
+
+#include <tusb.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Host-side TinyUSB: the device stack's CDC and MSC classes, plus the USB host
+// at the other end of the cable. Transfers happen in tud_task(), within a
+// full-speed bus budget of bulk packets per 1 ms frame shared by every
+// endpoint, so a chatty CDC port slows the others and MSC down as it would on
+// a real bus.
+//
+// The CDC FIFOs have TinyUSB's sizes and semantics: an IN packet goes out once
+// a full packet is queued or the firmware flushes, and an OUT endpoint is only
+// re-armed once the RX FIFO has room for a whole packet.
+class SimUsb {
+ public:
+  static constexpr int kPacketSize = 64;
+  // Bulk packets a full-speed host typically schedules per frame.
+  static constexpr int kPacketsPerFrame = 19;
+
+  // Called with each IN packet as it reaches the host application, at the end
+  // of the frame it was sent in.
+  using Receiver =
+      std::function<void(uint8_t itf, std::span<const char> data,
+                         uint64_t time_us)>;
+
+  // Callback for a finished MSC command, with the data read if it was a read.
+  // ok is false if the device failed the command.
+  using MscDone = std::function<void(bool ok, std::span<const std::byte> data)>;
+
+  static SimUsb& Instance();
+
+  // Disconnected and idle, e.g. between tests.
+  void Reset();
+
+  // Host side of the CDC interfaces.
+
+  // Sets DTR, as a terminal program does when it opens the port; reported to
+  // the firmware by the next tud_task().
+  void Open(uint8_t itf, bool dtr = true);
+
+  // SET_LINE_CODING, reported by the next tud_task().
+  void SetLineCoding(uint8_t itf, const cdc_line_coding_t& coding);
+
+  // Queues data for the device; it goes out as bus time and the device's RX
+  // FIFO allow.
+  void Send(uint8_t itf, std::span<const char> data);
+  std::size_t SendPending(uint8_t itf) { return cdc_[itf].host_tx.size(); }
+
+  void SetReceiver(Receiver receiver) { receiver_ = std::move(receiver); }
+
+  // Has the host application take an IN packet no more often than this, as a
+  // slow consumer would. The device's TX FIFO backs up meanwhile.
+  void SetInIntervalUs(uint8_t itf, uint64_t interval_us) {
+    cdc_[itf].in_interval_us = interval_us;
+  }
+
+  uint64_t InPackets(uint8_t itf) { return cdc_[itf].in_packets; }
+  uint64_t OutPackets(uint8_t itf) { return cdc_[itf].out_packets; }
+
+  // Host side of the MSC interface. Commands run one at a time, in order.
+
+  void MscRead(uint8_t lun, uint32_t lba, uint32_t blocks, MscDone done);
+  void MscWrite(uint8_t lun, uint32_t lba, std::span<const std::byte> data,
+                MscDone done = {});
+  void MscUnmap(uint8_t lun, uint32_t lba, uint32_t blocks, MscDone done = {});
+  bool MscIdle() { return msc_queue_.empty(); }
+
+  // Callbacks that returned 0 and were retried on a later tud_task().
+  uint64_t MscRetries() { return msc_retries_; }
+
+  // Last sense data set by the firmware.
+  uint8_t SenseKey() { return sense_key_; }
+
+  // Device stack, behind tusb.h.
+  void Task();
+  bool Connected(uint8_t itf) { return cdc_[itf].dtr; }
+  uint32_t Available(uint8_t itf) { return cdc_[itf].rx_fifo.size(); }
+  uint32_t Read(uint8_t itf, std::span<char> buffer);
+  uint32_t WriteAvailable(uint8_t itf);
+  uint32_t Write(uint8_t itf, std::span<const char> data);
+  uint32_t Flush(uint8_t itf);
+  void SetSense(uint8_t key) { sense_key_ = key; }
+
+ private:
+  struct Cdc {
+    // Host side.
+    std::deque<char> host_tx;
+    bool dtr = false;
+    std::optional<bool> pending_dtr;
+    std::optional<cdc_line_coding_t> pending_coding;
+    // Device side.
+    std::deque<char> rx_fifo;
+    std::deque<char> tx_fifo;
+    // IN transfer in flight, if not empty.
+    std::vector<char> in_packet;
+    uint64_t in_interval_us = 0;
+    uint64_t next_in_us = 0;
+    uint64_t in_packets = 0;
+    uint64_t out_packets = 0;
+  };
+
+  struct MscCommand {
+    enum class Op { kRead, kWrite, kUnmap };
+    Op op;
+    uint8_t lun;
+    uint32_t lba;
+    uint32_t blocks;
+    std::vector<std::byte> data;
+    MscDone done;
+    // Progress through data, and through the chunk TinyUSB's endpoint buffer
+    // holds: packets moved over the bus, and bytes the callbacks took.
+    std::size_t done_bytes = 0;
+    std::size_t chunk_size = 0;
+    std::size_t chunk_packets = 0;
+    std::size_t chunk_consumed = 0;
+  };
+
+  // Packets the host has left in the current frame.
+  int BusBudget();
+  bool MoveCdcPacket(Cdc& cdc, uint8_t itf);
+  // Advances the MSC command at the head of the queue. Returns whether it
+  // moved a packet, in which case it can go on.
+  bool MscStep();
+  void MscFinish(bool ok);
+
+  std::array<Cdc, CFG_TUD_CDC> cdc_;
+  Receiver receiver_;
+  uint64_t frame_ = 0;
+  int budget_ = kPacketsPerFrame;
+  // Endpoint, in cdc_ order then MSC, that the host polls first next time.
+  int first_endpoint_ = 0;
+
+  std::deque<MscCommand> msc_queue_;
+  uint64_t msc_retries_ = 0;
+  uint8_t sense_key_ = SCSI_SENSE_NONE;
+};
@@ -0,0 +1,116 @@
+#include "small_sector_disk.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "ram_disk.h"
+
+namespace {
+constexpr int kSmall = SmallSectorDisk::kSmallSectorSize;
+constexpr int kSplit = SmallSectorDisk::kSplit;
+
+using SmallSector = std::array<std::byte, kSmall>;
+
+SmallSector Filled(int value) {
+  SmallSector sector;
+  sector.fill(std::byte(value));
+  return sector;
+}
+
+// Bytes written to the underlying device per byte written to the small
+// sectors.
+double WriteAmplification(const RamDisk& disk, int small_writes) {
+  return static_cast<double>(disk.writes.size() * BlockDevice::kSectorSize) /
+         (small_writes * kSmall);
+}
+
+TEST(SmallSectorDiskTest, SequentialWritesBecomeOneSectorWrite) {
+  RamDisk disk(4);
+  SmallSectorDisk small(disk);
+  for (int i = 0; i < 2 * kSplit; ++i) {
+    small.WriteSector(i, Filled(i));
+  }
+  small.Sync();
+  EXPECT_EQ(disk.writes, (std::vector{0, 1}));
+  // Whole sectors need nothing read back.
+  EXPECT_EQ(disk.reads, 0);
+  EXPECT_EQ(disk.syncs, 1);
+  EXPECT_EQ(WriteAmplification(disk, 2 * kSplit), 1.0);
+  for (int i = 0; i < 2 * kSplit; ++i) {
+    EXPECT_EQ(small.ReadSector(i)[0], std::byte(i)) << i;
+  }
+}
+
+TEST(SmallSectorDiskTest, PartialSectorIsMergedWithTheDevicesContents) {
+  RamDisk disk(2);
+  SmallSectorDisk small(disk);
+  for (int i = 0; i < kSplit; ++i) {
+    small.WriteSector(i, Filled(0x10 + i));
+  }
+  small.Sync();
+  small.WriteSector(3, Filled(0x77));
+  // Read back before it reaches the device.
+  EXPECT_EQ(small.ReadSector(3)[0], std::byte(0x77));
+  small.Sync();
+  EXPECT_EQ(disk.writes, (std::vector{0, 0}));
+  for (int i = 0; i < kSplit; ++i) {
+    EXPECT_EQ(disk.ReadSector(0)[i * kSmall],
+              std::byte(i == 3 ? 0x77 : 0x10 + i))
+        << i;
+  }
+}
+
+TEST(SmallSectorDiskTest, WriteAmplificationOfScatteredWrites) {
+  RamDisk disk(64);
+  SmallSectorDisk small(disk);
+  std::minstd_rand random(1);
+  constexpr int kWrites = 1000;
+  for (int i = 0; i < kWrites; ++i) {
+    small.WriteSector(random() % small.SectorCount(), Filled(i));
+  }
+  small.Sync();
+  const double amplification = WriteAmplification(disk, kWrites);
+  RecordProperty("scattered_write_amplification",
+                 testing::PrintToString(amplification));
+  // Almost every write lands in a different underlying sector than the last.
+  EXPECT_GT(amplification, kSplit * 0.9);
+  EXPECT_LE(amplification, kSplit);
+}
+
+TEST(SmallSectorDiskTest, WriteAmplificationOfAFatStyleAppend) {
+  // Appending to a file a small sector at a time, updating the FAT and the
+  // directory entry every 8 data sectors, as a sync would.
+  RamDisk disk(64);
+  SmallSectorDisk small(disk);
+  constexpr int kDataStart = 2 * kSplit;
+  int writes = 0;
+  for (int i = 0; i < 32 * kSplit; ++i) {
+    small.WriteSector(kDataStart + i, Filled(i));
+    ++writes;
+    if (i % 8 == 7) {
+      small.WriteSector(0, Filled(i));
+      small.WriteSector(kSplit, Filled(i));
+      writes += 2;
+    }
+  }
+  small.Sync();
+  const double amplification = WriteAmplification(disk, writes);
+  RecordProperty("append_write_amplification",
+                 testing::PrintToString(amplification));
+  // Each sync costs the data sector being assembled, the FAT and the
+  // directory.
+  EXPECT_LT(amplification, 3.0);
+}
+
+TEST(SmallSectorDiskTest, PassesOnlyWholeSectorTrims) {
+  RamDisk disk(4);
+  SmallSectorDisk small(disk);
+  small.Trim(kSplit - 2, kSplit + 4);
+  EXPECT_EQ(disk.trims, (std::vector<std::pair<int, int>>{{1, 1}}));
+}
+}  // namespace
@@ -0,0 +1,91 @@
+#include "spsc_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace {
+TEST(SpscQueueTest, PartialPushesAndPopsAcrossTheWrap) {
+  SpscQueue<int, 8> queue;
+  std::array<int, 16> values;
+  for (int i = 0; i < 16; ++i) {
+    values[i] = i;
+  }
+  std::array<int, 16> out;
+  EXPECT_EQ(queue.Push(std::span(values).first(6)), 6);
+  EXPECT_EQ(queue.Pop(std::span(out).first(5)).size(), 5);
+  EXPECT_EQ(queue.Size(), 1);
+
+  // Only 7 fit, the last 5 of them after the wrap.
+  EXPECT_EQ(queue.Free(), 7);
+  EXPECT_EQ(queue.Push(std::span(values).subspan(6)), 7);
+  EXPECT_EQ(queue.Free(), 0);
+  EXPECT_EQ(queue.Push(std::span(values).subspan(13)), 0);
+
+  // A pop larger than what is queued returns what there is.
+  const std::span<int> popped = queue.Pop(out);
+  ASSERT_EQ(popped.size(), 8);
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(popped[i], 5 + i) << i;
+  }
+  EXPECT_TRUE(queue.Pop(out).empty());
+}
+
+TEST(SpscQueueTest, ProducerAndConsumerThreadsAgreeOnEveryElement) {
+  // Two words, so that a torn element shows up as a mismatch.
+  struct Element {
+    uint32_t sequence;
+    uint32_t check;
+  };
+  constexpr uint32_t kCount = 2'000'000;
+  SpscQueue<Element, 64> queue;
+
+  // Chunks of random sizes, larger than the queue at times, so that pushes
+  // and pops are often partial and straddle the wrap point.
+  std::thread producer([&] {
+    std::minstd_rand random(1);
+    std::vector<Element> chunk;
+    uint32_t next = 0;
+    while (next < kCount) {
+      chunk.clear();
+      for (uint32_t i = random() % 100; i > 0 && next < kCount; --i) {
+        chunk.push_back({.sequence = next, .check = ~next});
+        ++next;
+      }
+      std::span<const Element> pending(chunk);
+      while (!pending.empty()) {
+        const std::size_t pushed = queue.Push(pending);
+        if (pushed == 0) {
+          std::this_thread::yield();
+        }
+        pending = pending.subspan(pushed);
+      }
+    }
+  });
+
+  std::minstd_rand random(2);
+  std::array<Element, 100> buffer;
+  uint32_t expected = 0;
+  uint32_t mismatches = 0;
+  while (expected < kCount) {
+    const std::size_t size = 1 + random() % buffer.size();
+    const std::span<Element> popped = queue.Pop(std::span(buffer).first(size));
+    if (popped.empty()) {
+      std::this_thread::yield();
+    }
+    for (const Element& element : popped) {
+      mismatches +=
+          element.sequence != expected || element.check != ~expected;
+      ++expected;
+    }
+  }
+  producer.join();
+  EXPECT_EQ(mismatches, 0);
+  EXPECT_EQ(queue.Size(), 0);
+}
+}  // namespace
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string_view>
+
+// A file in the test's temporary directory, deleted on destruction.
+class TempPath {
+ public:
+  explicit TempPath(std::string_view name)
+      : path_(std::filesystem::path(testing::TempDir()) / name) {
+    std::filesystem::remove(path_);
+  }
+  ~TempPath() { std::filesystem::remove(path_); }
+
+  TempPath(const TempPath&) = delete;
+  TempPath& operator=(const TempPath&) = delete;
+
+  const std::filesystem::path& path() const { return path_; }
+
+ private:
+  std::filesystem::path path_;
+};
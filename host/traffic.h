@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One direction of a channel's test traffic: pseudo-random bytes, or data
+// shaped by the caller, checked at the receiving end for loss and order, with
+// the latency of each byte from when it entered the bridge's input to when it
+// left the output.
+//
+// Received bytes are matched greedily against what was sent, so bytes that
+// went missing are counted as lost; after a loss, a random byte can match
+// early, making the count approximate. Without loss it is exact.
+class TrafficStream {
+ public:
+  // The next `size` bytes of the stream.
+  std::string Next(std::size_t size) {
+    std::string data;
+    for (std::size_t i = 0; i < size; ++i) {
+      data.push_back(Byte(sent_.size() + i));
+    }
+    sent_ += data;
+    return data;
+  }
+
+  // Makes `data` the next bytes of the stream instead, e.g. protocol frames.
+  std::string_view Next(std::string_view data) {
+    sent_ += data;
+    return std::string_view(sent_).substr(sent_.size() - data.size());
+  }
+
+  // The next byte given by Next() has entered the bridge's input.
+  void Started(uint64_t time_us) { start_us_.push_back(time_us); }
+  void Started(std::size_t count, uint64_t time_us) {
+    start_us_.insert(start_us_.end(), count, time_us);
+  }
+
+  void Received(char byte, uint64_t time_us) {
+    std::size_t position = matched_;
+    while (position < start_us_.size() && sent_[position] != byte) {
+      ++position;
+    }
+    if (position == start_us_.size()) {
+      ++unexpected_;
+      return;
+    }
+    lost_ += position - matched_;
+    latencies_us_.push_back(time_us - start_us_[position]);
+    matched_ = position + 1;
+    ++received_;
+  }
+
+  uint64_t Sent() const { return start_us_.size(); }
+  uint64_t ReceivedBytes() const { return received_; }
+  // Bytes skipped over by later ones, plus ones still outstanding.
+  uint64_t Lost() const { return lost_; }
+  uint64_t Outstanding() const { return start_us_.size() - matched_; }
+  // Bytes that match nothing that was sent.
+  uint64_t Unexpected() const { return unexpected_; }
+
+  // Latency at the given percentile (0-100) of the bytes received.
+  uint64_t LatencyPercentileUs(double percentile) {
+    if (latencies_us_.empty()) {
+      return 0;
+    }
+    const std::size_t index = std::min(
+        latencies_us_.size() - 1,
+        static_cast<std::size_t>(percentile / 100 * latencies_us_.size()));
+    std::ranges::nth_element(latencies_us_, latencies_us_.begin() + index);
+    return latencies_us_[index];
+  }
+
+ private:
+  static char Byte(uint64_t position) {
+    uint64_t x = position * 0x9E3779B97F4A7C15ull;
+    x ^= x >> 29;
+    return static_cast<char>(x * 0xBF58476D1CE4E5B9ull >> 56);
+  }
+
+  std::string sent_;
+  std::vector<uint64_t> start_us_;
+  std::size_t matched_ = 0;
+  uint64_t received_ = 0;
+  uint64_t lost_ = 0;
+  uint64_t unexpected_ = 0;
+  std::vector<uint64_t> latencies_us_;
+};
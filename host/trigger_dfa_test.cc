@@ -0,0 +1,90 @@
+#include "trigger_dfa.h"
+
+#include <fmt/core.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+// Offsets of the bytes of the stream that complete a match.
+std::vector<int> Matches(std::string_view patterns, std::string_view stream) {
+  const TriggerDfa dfa(ParsePatterns(patterns));
+  std::vector<int> matches;
+  TriggerDfa::State state = TriggerDfa::kStart;
+  for (std::size_t i = 0; i < stream.size(); ++i) {
+    state = dfa.Step(state, static_cast<uint8_t>(stream[i]));
+    if (dfa.Accepting(state)) {
+      matches.push_back(i);
+    }
+  }
+  return matches;
+}
+
+// 01, n wildcards, then 02.
+std::string Wildcards(int n) {
+  std::string pattern = "01";
+  for (int i = 0; i < n; ++i) {
+    pattern += " ??";
+  }
+  return pattern + " 02";
+}
+
+TEST(ParsePatternsTest, ParsesBytesWildcardsAndStrings) {
+  const std::vector<BytePattern> patterns = ParsePatterns(
+      "# Login prompts\n"
+      "\n"
+      "  41 ?? \"ok\"\r\n"
+      "\t0a\n");
+  ASSERT_EQ(patterns.size(), 2);
+  EXPECT_EQ(patterns[0],
+            (BytePattern{0x41, std::nullopt, uint8_t{'o'}, uint8_t{'k'}}));
+  EXPECT_EQ(patterns[1], (BytePattern{0x0A}));
+}
+
+TEST(ParsePatternsTest, RejectsMalformedLines) {
+  for (const char* text : {"4", "4g", "414", "41?", "\"ok", "41 \"ok\" ?"}) {
+    EXPECT_THROW(ParsePatterns(text), std::invalid_argument) << text;
+  }
+}
+
+TEST(TriggerDfaTest, RejectsMissingOrEmptyPatterns) {
+  EXPECT_THROW(TriggerDfa({}), std::invalid_argument);
+  const std::vector<BytePattern> empty = {{0x41}, {}};
+  EXPECT_THROW(TriggerDfa{empty}, std::invalid_argument);
+}
+
+TEST(TriggerDfaTest, FindsOverlappingMatches) {
+  EXPECT_EQ(Matches("\"aa\"", "aaaa"), (std::vector{1, 2, 3}));
+  // One pattern's match starts inside the other's.
+  EXPECT_EQ(Matches("\"abc\"\n\"bcd\"", "xabcdabc"), (std::vector{3, 4, 7}));
+  // A failed partial match still lets a later one start within it.
+  EXPECT_EQ(Matches("\"aab\"", "aaab"), (std::vector{3}));
+}
+
+TEST(TriggerDfaTest, WildcardsMatchAnyByte) {
+  // Including bytes no pattern names.
+  EXPECT_EQ(Matches("01 ?? 03", "\x01\x02\x03\x01\x01\x03\x01\xff\x03"),
+            (std::vector{2, 5, 8}));
+  EXPECT_EQ(Matches("01 ?? 03", "\x01\x03\x02"), std::vector<int>{});
+}
+
+TEST(TriggerDfaTest, LimitsTheTableSizeRatherThanTheStateCount) {
+  // Telling which of the last n bytes were 01 takes 2^n states.
+  const TriggerDfa dfa(ParsePatterns(Wildcards(7)));
+  EXPECT_GE(dfa.StateCount(), 128);
+  EXPECT_THROW(TriggerDfa(ParsePatterns(Wildcards(14))), std::length_error);
+
+  // As few states over 257 byte classes are over the limit too.
+  std::string every_byte;
+  for (int byte = 0; byte < 256; ++byte) {
+    every_byte += fmt::format("{:02x} ", byte);
+  }
+  EXPECT_THROW(TriggerDfa(ParsePatterns(Wildcards(7) + "\n" + every_byte)),
+               std::length_error);
+}
+}  // namespace
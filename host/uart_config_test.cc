@@ -0,0 +1,96 @@
+#include "uart_config.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <optional>
+
+#include "bridge_rig.h"
+#include "sim.h"
+#include "sim_usb.h"
+
+namespace {
+constexpr uint32_t kClockHz = 125'000'000;
+
+TEST(UartConfigTest, MapsLineCodingFields) {
+  EXPECT_EQ(UartConfig::FromLineCoding(9600, /*stop_bits=*/2, /*parity=*/2,
+                                       /*data_bits=*/7, kClockHz),
+            (UartConfig{.baud_rate = 9600,
+                        .data_bits = 7,
+                        .stop_bits = 2,
+                        .parity = UartConfig::Parity::kEven}));
+  EXPECT_EQ(UartConfig::FromLineCoding(115'200, 0, 1, 5, kClockHz),
+            (UartConfig{.baud_rate = 115'200,
+                        .data_bits = 5,
+                        .stop_bits = 1,
+                        .parity = UartConfig::Parity::kOdd}));
+  EXPECT_EQ(UartConfig::FromLineCoding(115'200, 0, 0, 8, kClockHz),
+            UartConfig{});
+}
+
+TEST(UartConfigTest, RejectsSettingsTheUartCantProduce) {
+  // 1.5 stop bits.
+  EXPECT_EQ(UartConfig::FromLineCoding(9600, 1, 0, 8, kClockHz), std::nullopt);
+  // Mark and space parity.
+  EXPECT_EQ(UartConfig::FromLineCoding(9600, 0, 3, 8, kClockHz), std::nullopt);
+  EXPECT_EQ(UartConfig::FromLineCoding(9600, 0, 4, 8, kClockHz), std::nullopt);
+  EXPECT_EQ(UartConfig::FromLineCoding(9600, 0, 0, 4, kClockHz), std::nullopt);
+  EXPECT_EQ(UartConfig::FromLineCoding(9600, 0, 0, 16, kClockHz),
+            std::nullopt);
+}
+
+TEST(UartConfigTest, LimitsBaudRateToWhatTheClockCanGenerate) {
+  const uint32_t max = BaudDivisor::MaxBaudRate(kClockHz);
+  const uint32_t min = BaudDivisor::MinBaudRate(kClockHz);
+  EXPECT_EQ(max, 7'812'500);
+  EXPECT_EQ(min, 119);
+  EXPECT_NE(UartConfig::FromLineCoding(max, 0, 0, 8, kClockHz), std::nullopt);
+  EXPECT_EQ(UartConfig::FromLineCoding(max + 1, 0, 0, 8, kClockHz),
+            std::nullopt);
+  EXPECT_NE(UartConfig::FromLineCoding(min, 0, 0, 8, kClockHz), std::nullopt);
+  EXPECT_EQ(UartConfig::FromLineCoding(min - 1, 0, 0, 8, kClockHz),
+            std::nullopt);
+}
+
+TEST(UartConfigTest, DivisorBaudRate) {
+  // The SDK's divisor for 115200 baud at 125 MHz.
+  EXPECT_EQ((BaudDivisor{.integer = 67, .fraction = 52}.BaudRate(kClockHz)),
+            115'207);
+}
+
+TEST(UartConfigTest, AppliesTheDataPortsLineCodingToItsUart) {
+  const std::array configs = {BridgeRig::ChannelConfig{.baud_rate = 115'200}};
+  BridgeRig rig(configs);
+  SimUart& uart = *rig.GetChannel(0).uart;
+
+  SimUsb::Instance().SetLineCoding(
+      1, {.bit_rate = 9600, .stop_bits = 2, .parity = 1, .data_bits = 7});
+  rig.RunFor(10'000);
+  EXPECT_EQ(uart.Config(), (UartConfig{.baud_rate = 9600,
+                                       .data_bits = 7,
+                                       .stop_bits = 2,
+                                       .parity = UartConfig::Parity::kOdd}));
+
+  // Unsupported settings leave the UART as it was.
+  SimUsb::Instance().SetLineCoding(
+      1, {.bit_rate = 9600, .stop_bits = 1, .parity = 0, .data_bits = 8});
+  rig.RunFor(10'000);
+  EXPECT_EQ(uart.Config().stop_bits, 2);
+}
+
+TEST(UartConfigTest, OnlyTheConsoleResetsToTheBootloaderAt1200Baud) {
+  const std::array configs = {BridgeRig::ChannelConfig{.baud_rate = 115'200}};
+  BridgeRig rig(configs);
+  const cdc_line_coding_t touch = {
+      .bit_rate = 1200, .stop_bits = 0, .parity = 0, .data_bits = 8};
+
+  SimUsb::Instance().SetLineCoding(1, touch);
+  rig.RunFor(10'000);
+  EXPECT_EQ(Sim::Instance().UsbBootResets(), 0);
+  EXPECT_EQ(rig.GetChannel(0).uart->Config().baud_rate, 1200);
+
+  SimUsb::Instance().SetLineCoding(0, touch);
+  rig.RunFor(10'000);
+  EXPECT_EQ(Sim::Instance().UsbBootResets(), 1);
+}
+}  // namespace
@@ -0,0 +1,117 @@
+// Replays a capture-like write pattern against the flash, straight onto its
+// sectors and through the flash translation layer, and compares how evenly
+// each wears the flash. FatFS rewrites its FAT and directory sectors on every
+// sync, while the file data they describe is written once.
+//
+// Usage: wear_sim [writes]. Exits 1 if the translation layer lets the spread
+// of erase counts grow past twice its wear-leveling threshold.
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <span>
+#include <string>
+
+#include "flash.h"
+#include "ftl.h"
+#include "sim.h"
+
+namespace {
+constexpr int kPhysicalSectors = 128;
+// The first sectors FatFS would put its FAT and root directory in.
+constexpr int kHotSectors = 4;
+// One in this many writes is file data; the rest update the metadata.
+constexpr int kDataEvery = 4;
+
+struct Wear {
+  uint32_t min;
+  uint32_t max;
+  uint32_t mean;
+};
+
+Wear WearOf(std::span<const uint32_t> counts) {
+  const auto [min, max] = std::ranges::minmax(counts);
+  return {.min = min,
+          .max = max,
+          .mean = static_cast<uint32_t>(
+              std::accumulate(counts.begin(), counts.end(), uint64_t{0}) /
+              counts.size())};
+}
+
+// Writes `writes` sectors to `disk`, a quarter of them appending file data
+// that wraps around the data area and the rest rewriting metadata. Gives the
+// translation layer, if `disk` is one, its background turn after each.
+void Replay(BlockDevice& disk, int writes,
+            FlashTranslationLayer* ftl = nullptr) {
+  std::minstd_rand random(1);
+  std::array<std::byte, BlockDevice::kSectorSize> sector{};
+  const int data_sectors = disk.SectorCount() - kHotSectors;
+  int next_data = 0;
+  for (int i = 0; i < writes; ++i) {
+    // Every write differs, so none is skipped as a no-op.
+    sector[0] = std::byte(i);
+    sector[1] = std::byte(i >> 8);
+    sector[2] = std::byte(i >> 16);
+    if (i % kDataEvery == 0) {
+      disk.WriteSector(kHotSectors + next_data, sector);
+      next_data = (next_data + 1) % data_sectors;
+    } else {
+      disk.WriteSector(random() % kHotSectors, sector);
+    }
+    if (ftl != nullptr) {
+      ftl->Task();
+    }
+  }
+}
+
+void Print(const char* name, const Wear& wear) {
+  fmt::print("{:<6} {:>8} {:>8} {:>8}\n", name, wear.min, wear.max,
+             wear.mean);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int writes = argc > 1 ? std::stoi(argv[1]) : 1'000'000;
+  const std::filesystem::path image =
+      std::filesystem::temp_directory_path() / "wear_sim.img";
+  fmt::print("{} writes, {} hot sectors, 1 in {} writes is data\n", writes,
+             kHotSectors, kDataEvery);
+  fmt::print("{:<6} {:>8} {:>8} {:>8}\n", "", "min", "max", "mean");
+
+  Wear raw;
+  {
+    Sim::Instance().Reset();
+    std::filesystem::remove(image);
+    FlashDisk flash(kPhysicalSectors, image);
+    Replay(flash, writes);
+    raw = WearOf(flash.SectorEraseCounts());
+  }
+  Print("raw", raw);
+
+  Wear ftl_wear;
+  {
+    Sim::Instance().Reset();
+    std::filesystem::remove(image);
+    FlashDisk flash(kPhysicalSectors, image);
+    FlashTranslationLayer ftl(flash);
+    Replay(ftl, writes, &ftl);
+    ftl_wear = {.min = ftl.MinEraseCount(),
+                .max = ftl.MaxEraseCount(),
+                .mean = ftl.MeanEraseCount()};
+  }
+  Print("ftl", ftl_wear);
+  std::filesystem::remove(image);
+
+  if (ftl_wear.max - ftl_wear.min >
+      2 * FlashTranslationLayer::kWearLevelThreshold) {
+    fmt::print("Wear leveling fell behind\n");
+    return EXIT_FAILURE;
+  }
+}
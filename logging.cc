@@ -0,0 +1,170 @@
+#include "logging.h"
+
+#include <fmt/args.h>
+#include <fmt/format.h>
+#include <pico/critical_section.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+
+#include "stats.h"
+
+namespace {
+constexpr std::size_t kRingSize = 4096;
+
+struct EntryHeader {
+  // Including this header.
+  uint16_t size;
+  uint16_t format_size;
+  const char* format;
+};
+
+struct Ring {
+  Ring() { critical_section_init(&lock); }
+
+  std::array<std::byte, kRingSize> data;
+  // Free-running. Producers advance head under the lock; the drain advances
+  // tail without it, since producers only ever write beyond head.
+  std::atomic<uint32_t> head = 0;
+  std::atomic<uint32_t> tail = 0;
+  // Serializes producers, both between cores and against interrupts on the
+  // same core.
+  critical_section_t lock;
+};
+
+Ring g_ring;
+uint32_t g_reported_drops = 0;
+
+void CopyIn(uint32_t position, std::span<const std::byte> data) {
+  for (std::byte b : data) {
+    g_ring.data[position++ % kRingSize] = b;
+  }
+}
+
+void CopyOut(uint32_t position, std::span<std::byte> data) {
+  for (std::byte& b : data) {
+    b = g_ring.data[position++ % kRingSize];
+  }
+}
+}  // namespace
+
+namespace log_internal {
+void Encoder::PutString(std::string_view str) {
+  str = str.substr(0, kLogMaxStringSize);
+  if (size_ + 2 + str.size() > kMaxSize) {
+    return;
+  }
+  data_[size_++] = static_cast<std::byte>(ArgType::kString);
+  data_[size_++] = static_cast<std::byte>(str.size());
+  std::memcpy(&data_[size_], str.data(), str.size());
+  size_ += str.size();
+}
+
+bool Push(fmt::string_view format, std::span<const std::byte> args) {
+  const EntryHeader header = {
+      .size = static_cast<uint16_t>(sizeof(EntryHeader) + args.size()),
+      .format_size = static_cast<uint16_t>(format.size()),
+      .format = format.data(),
+  };
+  critical_section_enter_blocking(&g_ring.lock);
+  const uint32_t head = g_ring.head.load(std::memory_order_relaxed);
+  const uint32_t tail = g_ring.tail.load(std::memory_order_acquire);
+  const bool fits = kRingSize - (head - tail) >= header.size;
+  if (fits) {
+    CopyIn(head, std::as_bytes(std::span(&header, 1)));
+    CopyIn(head + sizeof(header), args);
+    g_ring.head.store(head + header.size, std::memory_order_release);
+  } else {
+    Stats::Global().log_dropped_messages.Add();
+  }
+  critical_section_exit(&g_ring.lock);
+  return fits;
+}
+}  // namespace log_internal
+
+void DrainLog(std::ostream& out, int max_messages) {
+  using log_internal::ArgType;
+  bool wrote = false;
+  const uint32_t drops = Stats::Global().log_dropped_messages.Get();
+  if (drops != g_reported_drops) {
+    out << fmt::format("({} log messages dropped)\n",
+                       drops - g_reported_drops);
+    g_reported_drops = drops;
+    wrote = true;
+  }
+  for (int i = 0; i < max_messages; ++i) {
+    const uint32_t tail = g_ring.tail.load(std::memory_order_relaxed);
+    if (g_ring.head.load(std::memory_order_acquire) == tail) {
+      break;
+    }
+    EntryHeader header;
+    CopyOut(tail, std::as_writable_bytes(std::span(&header, 1)));
+    std::array<std::byte, log_internal::Encoder::kMaxSize> args;
+    const std::span<std::byte> arg_data =
+        std::span(args).first(header.size - sizeof(header));
+    CopyOut(tail + sizeof(header), arg_data);
+    g_ring.tail.store(tail + header.size, std::memory_order_release);
+
+    fmt::dynamic_format_arg_store<fmt::format_context> store;
+    std::size_t offset = 0;
+    const auto take = [&]<typename T>(T& value) {
+      std::memcpy(&value, &arg_data[offset], sizeof(T));
+      offset += sizeof(T);
+    };
+    while (offset < arg_data.size()) {
+      const auto type = static_cast<ArgType>(arg_data[offset++]);
+      switch (type) {
+        case ArgType::kBool: {
+          bool value;
+          take(value);
+          store.push_back(value);
+          break;
+        }
+        case ArgType::kChar: {
+          char value;
+          take(value);
+          store.push_back(value);
+          break;
+        }
+        case ArgType::kInt: {
+          int64_t value;
+          take(value);
+          store.push_back(value);
+          break;
+        }
+        case ArgType::kUint: {
+          uint64_t value;
+          take(value);
+          store.push_back(value);
+          break;
+        }
+        case ArgType::kDouble: {
+          double value;
+          take(value);
+          store.push_back(value);
+          break;
+        }
+        case ArgType::kString: {
+          const auto size = std::to_integer<std::size_t>(arg_data[offset++]);
+          // Refers into args, which outlives the store.
+          store.push_back(std::string_view(
+              reinterpret_cast<const char*>(&arg_data[offset]), size));
+          offset += size;
+          break;
+        }
+      }
+    }
+    const fmt::string_view format(header.format, header.format_size);
+    try {
+      out << fmt::vformat(format, store) << '\n';
+    } catch (const fmt::format_error&) {
+      // Only if the arguments were truncated to fit.
+      out << std::string_view(format.data(), format.size()) << '\n';
+    }
+    wrote = true;
+  }
+  if (wrote) {
+    out.flush();
+  }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <fmt/core.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+// Deferred logging. Log() checks the format string against the arguments at
+// compile time, but only copies a pointer to the format string and the raw
+// argument values into a RAM ring; formatting and console output happen later
+// in DrainLog() from the main loop. Logging never allocates or blocks on USB,
+// so it is safe on hot paths and in interrupt handlers, and from either core.
+//
+// It is not lock-free, though: producers claim ring space under a critical
+// section, which disables interrupts on the calling core (and spins against
+// the other core) while the message is copied in.
+//
+//   Log("CDC{} line state change: dtr={}", itf, dtr);
+//
+// Arguments may be integers, floating point values or strings. Strings
+// are copied, truncated to kLogMaxStringSize bytes. Messages that don't fit in
+// the ring are dropped and counted in Stats::log_dropped_messages.
+
+inline constexpr std::size_t kLogMaxStringSize = 48;
+
+namespace log_internal {
+enum class ArgType : uint8_t {
+  kBool,
+  kChar,
+  kInt,
+  kUint,
+  kDouble,
+  kString,
+};
+
+// A message's encoded arguments, built on the stack before being copied into
+// the ring.
+class Encoder {
+ public:
+  static constexpr std::size_t kMaxSize = 160;
+
+  template <typename T>
+  void Put(const T& value) {
+    using U = std::remove_cvref_t<T>;
+    if constexpr (std::is_same_v<U, bool>) {
+      PutRaw(ArgType::kBool, value);
+    } else if constexpr (std::is_same_v<U, char>) {
+      PutRaw(ArgType::kChar, value);
+    } else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+      PutRaw(ArgType::kInt, int64_t{value});
+    } else if constexpr (std::is_integral_v<U>) {
+      PutRaw(ArgType::kUint, uint64_t{value});
+    } else if constexpr (std::is_floating_point_v<U>) {
+      PutRaw(ArgType::kDouble, double{value});
+    } else {
+      static_assert(std::is_convertible_v<const U&, std::string_view>,
+                    "Unsupported log argument type");
+      PutString(value);
+    }
+  }
+
+  std::span<const std::byte> Data() const {
+    return std::span(data_).first(size_);
+  }
+
+ private:
+  template <typename T>
+  void PutRaw(ArgType type, const T& value) {
+    if (size_ + 1 + sizeof(T) > kMaxSize) {
+      return;
+    }
+    data_[size_++] = static_cast<std::byte>(type);
+    std::memcpy(&data_[size_], &value, sizeof(T));
+    size_ += sizeof(T);
+  }
+
+  void PutString(std::string_view str);
+
+  std::byte data_[kMaxSize];
+  std::size_t size_ = 0;
+};
+
+// Copies a message into the ring. Returns false if it was dropped.
+bool Push(fmt::string_view format, std::span<const std::byte> args);
+}  // namespace log_internal
+
+template <typename... Args>
+void Log(fmt::format_string<Args...> format, const Args&... args) {
+  log_internal::Encoder encoder;
+  (encoder.Put(args), ...);
+  log_internal::Push(fmt::string_view(format), encoder.Data());
+}
+
+// Formats and prints up to max_messages queued messages, followed by a single
+// flush. Must only be called from the main loop on core0.
+void DrainLog(std::ostream& out, int max_messages = 8);
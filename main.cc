@@ -1,19 +1,56 @@
 #include <cxxabi.h>
+#include <fmt/core.h>
 #include <hardware/gpio.h>
 #include <hardware/timer.h>
 #include <hardware/uart.h>
 #include <pico/stdlib.h>
 
+#include <array>
 #include <iostream>
+#include <iterator>
 
 #include "bridge.h"
+#include "capture.h"
+#include "core1_uart.h"
+#include "flash.h"
+#include "flash_writer.h"
+#include "framing_config.h"
 #include "fs.h"
+#include "ftl.h"
+#include "logging.h"
+#include "pio_uart.h"
+#include "profile.h"
+#include "replay.h"
+#include "sector_cache.h"
+#include "small_sector_disk.h"
+#include "sniffer.h"
+#include "stats_file.h"
+#include "timestamp_self_test.h"
+#include "trigger.h"
+#include "uart.h"
 #include "usb_device.h"
 
 int main() {
   std::set_terminate(__gnu_cxx::__verbose_terminate_handler);
+#if RS232_PROFILE
+  ProfileHistogram::StartClock();
+#endif
 
-  FlashDisk disk(256);
+  FlashDisk flash(256);
+#if RS232_FTL
+  FlashTranslationLayer ftl(flash);
+  SectorCache cache(ftl);
+#else
+  // Just before the disk, so the volume stays where it was.
+  FlashDisk journal(FlashWriter::kJournalSectors, /*skip_sectors=*/256);
+  FlashWriter writer(flash, journal);
+  SectorCache cache(writer);
+#endif
+#if RS232_SMALL_SECTORS
+  SmallSectorDisk disk(cache);
+#else
+  BlockDevice& disk = cache;
+#endif
 
   UsbDevice usb;
   usb.SetVendorId(0xCAFE);
@@ -24,11 +61,15 @@ int main() {
   usb.SetSerialNumber("123456");
 
   CdcDevice& stdio_cdc = usb.AddCdc("Debug Console");
-  CdcDevice& data_cdc = usb.AddCdc("RS232 Data");
+  std::array<CdcDevice*, RS232_DATA_CHANNELS> data_cdcs;
+  for (int i = 0; i < RS232_DATA_CHANNELS; ++i) {
+    data_cdcs[i] = &usb.AddCdc(fmt::format("RS232 Data {}", i));
+  }
   MscDevice& msc = usb.AddMsc("RS232 Storage", disk);
   msc.SetVendorId("DIY");
   msc.SetProductId("RS232 Storage");
   msc.SetProductRev("1.0");
+  msc.SetWritable();
 
   usb.Install();
   stdio_usb_init();
@@ -39,16 +80,106 @@ int main() {
   std::cout << "====\nStartup" << std::endl;
   FileSystem fs(disk);
   fs.Install();
+  DrainLog(std::cout);
+  // Make the host re-read the volume whenever the firmware changes it.
+  fs.SetSyncCallback([&] { msc.NotifyMediaChanged(); });
   msc.SetReady();
 
-  uart_init(uart0, 38'400);
-  gpio_set_function(0, GPIO_FUNC_UART);
-  gpio_set_function(1, GPIO_FUNC_UART);
+  Stats& stats = Stats::Global();
+#if RS232_DUAL_CORE
+  Core1Uart uart0_port(*uart0, 38'400, stats.channels[0],
+                       FlowControl::kHardware);
+#else
+  Uart uart0_port(*uart0, 38'400, stats.channels[0], FlowControl::kHardware);
+#endif
+  // TX, RX, CTS, RTS. CTS is pulled low by default, so leaving it unconnected
+  // never blocks transmission.
+  for (int pin : {0, 1, 2, 3}) {
+    gpio_set_function(pin, GPIO_FUNC_UART);
+  }
+#if RS232_RX_TIMESTAMPS
+  Uart uart1_port(*uart1, 38'400, stats.channels[1], FlowControl::kNone,
+                  Uart::RxMode::kTimestamped);
+#else
+  Uart uart1_port(*uart1, 38'400, stats.channels[1]);
+#endif
+  for (int pin : {8, 9}) {
+    gpio_set_function(pin, GPIO_FUNC_UART);
+  }
+  // These set up their own pins.
+  PioUart pio_port0(pio0, /*tx_pin=*/10, /*rx_pin=*/11, 38'400,
+                    stats.channels[2]);
+  PioUart pio_port1(pio0, /*tx_pin=*/12, /*rx_pin=*/13, 38'400,
+                    stats.channels[3]);
+  SerialPort* const data_ports[] = {&uart0_port, &uart1_port, &pio_port0,
+                                    &pio_port1};
+  static_assert(std::size(data_ports) == RS232_DATA_CHANNELS);
 
-  Bridge bridge(data_cdc, *uart0, fs);
+  StatsFile stats_file(fs, msc);
+  CaptureRecorder capture(fs);
+  CaptureTrigger trigger(fs, capture);
+  Bridge bridge(trigger);
+  Replayer replayer(fs, bridge);
+#if RS232_SNIFFER
+  // Channels 1 and 2 only listen, on their RX pins, to the two directions of a
+  // link between other devices. The merged traffic goes out channel 1's CDC
+  // interface.
+  Sniffer sniffer(1, *data_ports[1], *data_ports[2], *data_cdcs[1], capture,
+                  38'400);
+  for (int i : {0, 3}) {
+    bridge.AddChannel(i, *data_cdcs[i], *data_ports[i]);
+  }
+#else
+  for (int i = 0; i < RS232_DATA_CHANNELS; ++i) {
+    bridge.AddChannel(i, *data_cdcs[i], *data_ports[i]);
+  }
+#endif
+  LoadFramingConfig(fs, bridge);
 
   while (true) {
     usb.Task();
+    msc.Task();
     bridge.Task();
+#if RS232_SNIFFER
+    sniffer.Task();
+#endif
+    // The host owns the volume while it is writing to it; afterwards our
+    // cached view of the filesystem is stale.
+    if (msc.TakeHostChanges()) {
+      replayer.Stop();
+      fs.Remount();
+      stats_file.Locate();
+      capture.Reopen();
+      trigger.Load();
+      LoadFramingConfig(fs, bridge);
+    } else if (!msc.HostWriting()) {
+      capture.Task();
+      replayer.Task();
+    }
+#if RS232_FTL
+    ftl.Task();
+#else
+    writer.Task();
+#endif
+    // Lowest priority: console output.
+    DrainLog(std::cout);
+    // Commands from the debug console.
+    const int command = getchar_timeout_us(0);
+    if (command == 'r') {
+      // Replays what the host sent on channel 1 in a capture file that the
+      // host copied to the volume.
+      replayer.Start("/REPLAY.BIN", 1, *data_ports[1]);
+    }
+#if RS232_PROFILE
+    if (command == 'p') {
+      ProfileHistogram::DumpAll(std::cout);
+    }
+#endif
+#if RS232_RX_TIMESTAMPS
+    // Needs channel 0's TX (GPIO 0) wired to channel 1's RX (GPIO 9).
+    if (command == 't') {
+      RunTimestampSelfTest(*data_ports[0], uart1_port, 38'400, std::cout);
+    }
+#endif
   }
 }
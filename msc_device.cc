@@ -1,14 +1,188 @@
 #include "msc_device.h"
 
 #include <fmt/core.h>
+#include <hardware/sync.h>
+#include <pico/time.h>
 
+#include <algorithm>
 #include <cstring>
-#include <iostream>
 
+#include "logging.h"
 #include "usb_device.h"
 
+namespace {
+uint64_t ReadBigEndian(const uint8_t* data, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+void WriteBigEndian(uint8_t* out, uint64_t value, int size) {
+  for (int i = size - 1; i >= 0; --i) {
+    out[i] = value & 0xFF;
+    value >>= 8;
+  }
+}
+}  // namespace
+
+MscDevice::MscDevice(uint8_t lun, BlockDevice& disk) : lun_(lun), disk_(disk) {}
+
+bool MscDevice::HostWriting() {
+  return time_us_64() - last_host_write_us_ < kHostQuietUs;
+}
+
+bool MscDevice::TakeHostChanges() {
+  if (!host_changes_ || HostWriting() || gathering_->lba != -1 ||
+      submitted_->lba != -1) {
+    return false;
+  }
+  host_changes_ = false;
+  return true;
+}
+
+void MscDevice::SetSynthesizedSector(
+    int lba, std::function<void(std::span<std::byte>)> generate) {
+  generate_ = std::move(generate);
+  synthesized_lba_ = lba;
+}
+
+std::span<const std::byte> MscDevice::ReadSector(uint32_t lba) {
+  const int sector_size = disk_.SectorSize();
+  const int synthesized_lba = synthesized_lba_;
+  const int part = static_cast<int>(lba) - synthesized_lba;
+  if (synthesized_lba >= 0 && part >= 0 &&
+      part < BlockDevice::kSectorSize / sector_size) {
+    if (part == 0) {
+      generate_(*synthesized_);
+    }
+    return std::span(*synthesized_).subspan(part * sector_size, sector_size);
+  }
+  // The host may read back a sector before Task() has written it out.
+  for (const SectorBuffer* buffer : {submitted_.get(), gathering_.get()}) {
+    if (buffer->lba == static_cast<int>(lba) && buffer->size == sector_size) {
+      return std::span(buffer->data).first(sector_size);
+    }
+  }
+  return disk_.ReadSector(lba);
+}
+
+int32_t MscDevice::Write(uint32_t lba, uint32_t offset,
+                         std::span<const std::byte> data) {
+  last_host_write_us_ = time_us_64();
+  host_changes_ = true;
+  write_complete_ = false;
+  const uint32_t sector_size = disk_.SectorSize();
+  data = data.first(std::min<std::size_t>(data.size(), sector_size - offset));
+  const bool continues_sector = gathering_->lba == static_cast<int>(lba) &&
+                                gathering_->size == offset;
+  if (gathering_->lba != -1 && !continues_sector && !Submit()) {
+    // Previous sector is still waiting to be written out.
+    return 0;
+  }
+  if (gathering_->lba == -1) {
+    DropUnmaps(lba);
+    gathering_->lba = lba;
+    gathering_->size = offset;
+    if (offset > 0) {
+      // Writes normally start at the beginning of a sector, but keep the
+      // gathered data a complete prefix of it regardless.
+      std::ranges::copy(disk_.ReadSector(lba).first(offset),
+                        gathering_->data.begin());
+    }
+  }
+  std::ranges::copy(data, gathering_->data.begin() + offset);
+  gathering_->size = offset + data.size();
+  if (gathering_->size == sector_size) {
+    // Whole sector received; hand it off now if possible, otherwise on the
+    // next call.
+    Submit();
+  }
+  return data.size();
+}
+
+bool MscDevice::Submit() {
+  if (submitted_->lba != -1) {
+    return false;
+  }
+  const uint32_t sector_size = disk_.SectorSize();
+  if (gathering_->size < sector_size) {
+    // Read-modify-write for the part of the sector the host did not send.
+    const std::span<const std::byte> old = disk_.ReadSector(gathering_->lba);
+    std::ranges::copy(old.subspan(gathering_->size),
+                      gathering_->data.begin() + gathering_->size);
+    gathering_->size = sector_size;
+  }
+  std::swap(gathering_, submitted_);
+  return true;
+}
+
+void MscDevice::Unmap(uint32_t lba, uint32_t count) {
+  // The host's view of the sectors changes as they are trimmed.
+  last_host_write_us_ = time_us_64();
+  host_changes_ = true;
+  if (unmap_count_ < kMaxUnmaps) {
+    unmaps_[unmap_count_] = {.lba = lba, .count = count};
+    unmap_count_ = unmap_count_ + 1;
+  }
+}
+
+void MscDevice::DropUnmaps(uint32_t lba) {
+  const uint32_t interrupts = save_and_disable_interrupts();
+  const int unmap_count = unmap_count_;
+  for (int i = 0; i < unmap_count; ++i) {
+    UnmapRange& unmap = unmaps_[i];
+    if (lba < unmap.lba || lba >= unmap.lba + unmap.count) {
+      continue;
+    }
+    const UnmapRange after = {.lba = lba + 1,
+                              .count = unmap.lba + unmap.count - lba - 1};
+    unmap.count = lba - unmap.lba;
+    if (after.count > 0 && unmap_count_ < kMaxUnmaps) {
+      unmaps_[unmap_count_] = after;
+      unmap_count_ = unmap_count_ + 1;
+    }
+  }
+  restore_interrupts(interrupts);
+}
+
+void MscDevice::Task() {
+  if (submitted_->lba == -1 && gathering_->lba != -1 &&
+      (write_complete_ || gathering_->size == disk_.SectorSize())) {
+    Submit();
+  }
+  if (submitted_->lba != -1) {
+    // Whatever the host writes, it may not be a file's contents.
+    disk_.ClearDataOnly(submitted_->lba, 1);
+    disk_.WriteSector(submitted_->lba,
+                      std::span(submitted_->data).first(submitted_->size));
+    submitted_->lba = -1;
+  }
+  if (unmap_count_ == 0 || gathering_->lba != -1) {
+    return;
+  }
+  std::array<UnmapRange, kMaxUnmaps> unmaps;
+  const uint32_t interrupts = save_and_disable_interrupts();
+  const int unmap_count = unmap_count_;
+  std::copy_n(unmaps_.begin(), unmap_count, unmaps.begin());
+  unmap_count_ = 0;
+  restore_interrupts(interrupts);
+  for (const UnmapRange& unmap : std::span(unmaps).first(unmap_count)) {
+    if (unmap.count > 0) {
+      disk_.Trim(unmap.lba, unmap.count);
+    }
+  }
+}
+
 bool tud_msc_test_unit_ready_cb(uint8_t lun) {
-  return UsbDevice::Instance().Msc(lun).Ready();
+  MscDevice& device = UsbDevice::Instance().Msc(lun);
+  if (device.TakeMediaChanged()) {
+    // NOT READY TO READY CHANGE, MEDIUM MAY HAVE CHANGED
+    tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00);
+    return false;
+  }
+  return device.Ready();
 }
 
 void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8],
@@ -30,41 +204,109 @@ void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count,
                          uint16_t* block_size) {
   MscDevice& device = UsbDevice::Instance().Msc(lun);
   *block_count = device.Disk().SectorCount();
-  *block_size = device.Disk().kSectorSize;
+  *block_size = device.Disk().SectorSize();
 }
 
 bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start,
                            bool load_eject) {
-  std::cout << fmt::format(
-                   "MSC Start Stop Unit command: start={} load_eject={}", start,
-                   load_eject)
-            << std::endl;
+  Log("MSC Start Stop Unit command: start={} load_eject={}", start,
+      load_eject);
   return true;
 }
 
 int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset,
                           void* buffer, uint32_t count) {
+  if (UsbDevice::Instance().InTimerTask()) {
+    // Reading can fill the sector cache, which the main loop may be in the
+    // middle of using. TinyUSB retries on the next poll.
+    return 0;
+  }
   MscDevice& device = UsbDevice::Instance().Msc(lun);
-  std::memcpy(buffer, device.Disk().ReadSector(lba) + offset, count);
+  // TinyUSB asks for as much as fits in its buffer, which may span several
+  // sectors; it asks again for the rest.
+  const std::span<const std::byte> sector = device.ReadSector(lba);
+  count = std::min<uint32_t>(count, sector.size() - offset);
+  std::memcpy(buffer, sector.data() + offset, count);
   return count;
 }
 
-bool tud_msc_is_writeable_cb(uint8_t lun) { return false; }
+bool tud_msc_is_writeable_cb(uint8_t lun) {
+  return UsbDevice::Instance().Msc(lun).Writable();
+}
 
 int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset,
                            uint8_t* buffer, uint32_t count) {
-  return -1;
+  MscDevice& device = UsbDevice::Instance().Msc(lun);
+  if (!device.Writable()) {
+    return -1;
+  }
+  if (UsbDevice::Instance().InTimerTask()) {
+    // Gathering may read the disk for a partial sector, and submitting hands
+    // the sector to Task(); both belong to the main loop. TinyUSB retries on
+    // the next poll.
+    return 0;
+  }
+  return device.Write(lba, offset, std::as_bytes(std::span(buffer, count)));
+}
+
+void tud_msc_write10_complete_cb(uint8_t lun) {
+  UsbDevice::Instance().Msc(lun).WriteComplete();
 }
 
 int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer,
                         uint16_t count) {
+  MscDevice& device = UsbDevice::Instance().Msc(lun);
   const uint8_t op = scsi_cmd[0];
   switch (op) {
     case 0x1E:
       return 0;
+    case 0x42: {
+      // UNMAP. TinyUSB has already received the parameter list: an 8-byte
+      // header followed by 16-byte block descriptors.
+      if (!device.Writable()) {
+        // WRITE PROTECTED
+        tud_msc_set_sense(lun, SCSI_SENSE_DATA_PROTECT, 0x27, 0x00);
+        return -1;
+      }
+      const auto* params = static_cast<const uint8_t*>(buffer);
+      if (count < 8) {
+        return count;
+      }
+      const std::size_t descriptors_size =
+          std::min<std::size_t>(ReadBigEndian(params + 2, 2), count - 8);
+      for (std::size_t offset = 8; offset + 16 <= 8 + descriptors_size;
+           offset += 16) {
+        const uint64_t lba = ReadBigEndian(params + offset, 8);
+        const uint32_t blocks = ReadBigEndian(params + offset + 8, 4);
+        if (lba + blocks > device.Disk().SectorCount()) {
+          // LOGICAL BLOCK ADDRESS OUT OF RANGE
+          tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x21, 0x00);
+          return -1;
+        }
+        if (blocks > 0) {
+          device.Unmap(lba, blocks);
+        }
+      }
+      return count;
+    }
+    case 0x9E: {
+      // SERVICE ACTION IN(16). Only READ CAPACITY(16) is supported, which
+      // hosts use to find out that the device accepts UNMAP.
+      if ((scsi_cmd[1] & 0x1F) != 0x10) {
+        break;
+      }
+      std::array<uint8_t, 32> response = {};
+      WriteBigEndian(response.data(), device.Disk().SectorCount() - 1, 8);
+      WriteBigEndian(response.data() + 8, device.Disk().SectorSize(), 4);
+      // LBPME: logical block provisioning management enabled.
+      response[14] = 0x80;
+      const uint16_t size = std::min<uint16_t>(response.size(), count);
+      std::memcpy(buffer, response.data(), size);
+      return size;
+    }
     default:
-      std::cout << fmt::format("Unsupported SCSI operation: {}", op)
-                << std::endl;
-      return -1;
+      break;
   }
+  Log("Unsupported SCSI operation: {}", op);
+  return -1;
 }
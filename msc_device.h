@@ -2,19 +2,32 @@
 
 #include <tusb.h>
 
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
 #include <string>
+#include <utility>
 
-#include "flash.h"
+#include "block_device.h"
 
 class MscDevice {
  public:
-  MscDevice(uint8_t lun, FlashDisk& disk) : lun_(lun), disk_(disk) {}
+  // Firmware filesystem access is held off until the host has stopped writing
+  // for this long.
+  static constexpr uint64_t kHostQuietUs = 1'000'000;
 
-  FlashDisk& Disk() { return disk_; }
+  MscDevice(uint8_t lun, BlockDevice& disk);
+
+  BlockDevice& Disk() { return disk_; }
 
   void SetReady(bool ready = true) { ready_ = ready; }
   bool Ready() { return ready_; }
 
+  void SetWritable(bool writable = true) { writable_ = writable; }
+  bool Writable() { return writable_; }
+
   void SetVendorId(std::string_view str) { vendor_id_.assign(str); }
   void SetProductId(std::string_view str) { product_id_.assign(str); }
   void SetProductRev(std::string_view str) { product_rev_.assign(str); }
@@ -23,12 +36,105 @@ class MscDevice {
   std::string_view ProductId() { return product_id_; }
   std::string_view ProductRev() { return product_rev_; }
 
+  // Serves BlockDevice::kSectorSize bytes starting at the given sector from a
+  // generator function instead of the disk, e.g. to expose live data as a
+  // file. If the disk's sectors are smaller, that spans several of them, and
+  // the generator runs, from the main loop, when the host reads the first.
+  // Host writes to the sectors still go to the disk but are not visible to
+  // the host. Pass -1 to disable.
+  void SetSynthesizedSector(
+      int lba, std::function<void(std::span<std::byte>)> generate);
+
+  // Tells the host that the firmware changed the media behind its back, so
+  // that it drops its cached view. Reported as UNIT ATTENTION on the next
+  // TEST UNIT READY.
+  void NotifyMediaChanged() { media_changed_ = true; }
+  bool TakeMediaChanged() { return std::exchange(media_changed_, false); }
+
+  // Whether the host has written recently, in which case the firmware should
+  // keep its hands off the filesystem.
+  bool HostWriting();
+
+  // Returns true once after each burst of host writes has settled. The
+  // firmware should then drop its cached filesystem state.
+  bool TakeHostChanges();
+
+  // TinyUSB callback glue; may run in interrupt context, except where noted.
+
+  // Serves sectors with a pending host write from the write buffers. Only
+  // called from the main loop.
+  std::span<const std::byte> ReadSector(uint32_t lba);
+
+  // Gathers partial-sector chunks into whole sectors. Returns the number of
+  // bytes consumed, which is 0 if the previous sector has not been written
+  // out yet and TinyUSB should retry later. Data past the end of the sector is
+  // left for TinyUSB to pass in again. Only called from the main loop.
+  int32_t Write(uint32_t lba, uint32_t offset, std::span<const std::byte> data);
+
+  // The current WRITE command is done; a partial sector no longer needs to
+  // wait for the rest of its data.
+  void WriteComplete() { write_complete_ = true; }
+
+  // Queues an UNMAP of the given sectors, to be trimmed by Task() once the
+  // writes before it are out. Sectors written after the UNMAP are left out of
+  // it. Ranges beyond kMaxUnmaps are dropped, since trimming is only a hint.
+  void Unmap(uint32_t lba, uint32_t count);
+
+  // Writes out gathered sectors and applies UNMAPs from the main loop.
+  void Task();
+
  private:
+  // Large enough for any disk's sectors.
+  using SectorData = std::array<std::byte, BlockDevice::kSectorSize>;
+
+  static constexpr int kMaxUnmaps = 8;
+
+  struct UnmapRange {
+    uint32_t lba;
+    uint32_t count;
+  };
+
+  struct SectorBuffer {
+    // -1 if the buffer is unused.
+    volatile int lba = -1;
+    // Number of bytes received, starting at the beginning of the sector.
+    uint32_t size = 0;
+    SectorData data;
+  };
+
+  // Hands the gathered sector over to Task(). Returns false if the previous
+  // one has not been written out yet. Main loop only, since it may read the
+  // disk.
+  bool Submit();
+
+  // Takes the sector out of the queued UNMAPs, which all came before the
+  // write to it that is starting. A range split in two loses its second half
+  // if the queue is full.
+  void DropUnmaps(uint32_t lba);
+
   uint8_t lun_;
-  FlashDisk& disk_;
+  BlockDevice& disk_;
   bool ready_ = false;
+  bool writable_ = false;
 
   std::string vendor_id_;
   std::string product_id_;
   std::string product_rev_;
+
+  volatile bool media_changed_ = false;
+  volatile bool write_complete_ = false;
+  volatile bool host_changes_ = false;
+  volatile uint64_t last_host_write_us_ = 0;
+
+  volatile int synthesized_lba_ = -1;
+  std::function<void(std::span<std::byte>)> generate_;
+  std::unique_ptr<SectorData> synthesized_ = std::make_unique<SectorData>();
+
+  // Sector being gathered from USB packets.
+  std::unique_ptr<SectorBuffer> gathering_ = std::make_unique<SectorBuffer>();
+  // Complete sector waiting for Task() to write it out.
+  std::unique_ptr<SectorBuffer> submitted_ = std::make_unique<SectorBuffer>();
+
+  std::array<UnmapRange, kMaxUnmaps> unmaps_;
+  volatile int unmap_count_ = 0;
 };
@@ -0,0 +1,100 @@
+#include "pio_uart.h"
+
+#include <hardware/clocks.h>
+
+#include <array>
+
+#include "pio_uart.pio.h"
+
+namespace {
+struct LoadedPrograms {
+  int tx_offset = -1;
+  int rx_offset = -1;
+};
+
+// Indexed by PIO number; all PioUarts on a PIO share one copy of each program.
+std::array<LoadedPrograms, NUM_PIOS> g_programs;
+
+float ClockDivider(int baud_rate) {
+  // Both programs run at 8 cycles per bit.
+  return static_cast<float>(clock_get_hz(clk_sys)) / (8.0f * baud_rate);
+}
+
+// Sticky IRQ flag raised by the receiver on a framing error or break.
+uint32_t FramingErrorFlag(int rx_sm) { return 1u << (4 + rx_sm); }
+}  // namespace
+
+PioUart::PioUart(PIO pio, int tx_pin, int rx_pin, int baud_rate,
+                 ChannelStats& stats)
+    : pio_(pio),
+      stats_(stats),
+      tx_sm_(pio_claim_unused_sm(pio, true)),
+      rx_sm_(pio_claim_unused_sm(pio, true)) {
+  LoadedPrograms& programs = g_programs[pio_get_index(pio_)];
+  if (programs.tx_offset < 0) {
+    programs.tx_offset = pio_add_program(pio_, &uart_tx_program);
+    programs.rx_offset = pio_add_program(pio_, &uart_rx_program);
+  }
+  tx_offset_ = programs.tx_offset;
+  uart_tx_program_init(pio_, tx_sm_, programs.tx_offset, tx_pin, baud_rate);
+  uart_rx_program_init(pio_, rx_sm_, programs.rx_offset, rx_pin, baud_rate);
+
+  // The receiver shifts right, so each byte lands in the top byte of its FIFO
+  // word.
+  const auto* rx_byte =
+      reinterpret_cast<const volatile uint8_t*>(&pio_->rxf[rx_sm_]) + 3;
+  stream_ = std::make_unique<DmaStream>(
+      rx_byte, pio_get_dreq(pio_, rx_sm_, false), &pio_->txf[tx_sm_],
+      pio_get_dreq(pio_, tx_sm_, true));
+}
+
+PioUart::~PioUart() {
+  stream_.reset();
+  for (int sm : {tx_sm_, rx_sm_}) {
+    pio_sm_set_enabled(pio_, sm, false);
+    pio_sm_unclaim(pio_, sm);
+  }
+}
+
+std::span<char> PioUart::Read(std::span<char> buffer) {
+  ApplyPendingConfig();
+  PollErrors();
+  stats_.rx_ring_high_water.RecordMax(stream_->RxSize());
+  const std::span<char> data = stream_->Read(buffer);
+  stats_.rx_ring_overruns.Set(stream_->RxOverruns());
+  return data;
+}
+
+int PioUart::Write(std::span<const char> data) {
+  const int written = stream_->Write(data);
+  stats_.tx_ring_high_water.RecordMax(stream_->TxSize());
+  return written;
+}
+
+void PioUart::SetConfig(const UartConfig& config) {
+  pending_config_ = config;
+  ApplyPendingConfig();
+}
+
+void PioUart::ApplyPendingConfig() {
+  // The transmitter is idle once it stalls on its first instruction, pulling
+  // from an empty FIFO with the line held at the stop bit level.
+  if (!pending_config_ || !stream_->TxIdle() ||
+      !pio_sm_is_tx_fifo_empty(pio_, tx_sm_) ||
+      pio_sm_get_pc(pio_, tx_sm_) != tx_offset_) {
+    return;
+  }
+  const float divider = ClockDivider(pending_config_->baud_rate);
+  pio_sm_set_clkdiv(pio_, tx_sm_, divider);
+  pio_sm_set_clkdiv(pio_, rx_sm_, divider);
+  pending_config_.reset();
+}
+
+void PioUart::PollErrors() {
+  const uint32_t flag = FramingErrorFlag(rx_sm_);
+  if (pio_->irq & flag) {
+    // Write 1 to clear.
+    pio_->irq = flag;
+    stats_.uart_framing_errors.Add();
+  }
+}
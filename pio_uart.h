@@ -0,0 +1,57 @@
+#pragma once
+
+#include <hardware/pio.h>
+
+#include <memory>
+#include <optional>
+#include <span>
+
+#include "dma_stream.h"
+#include "serial_port.h"
+#include "stats.h"
+
+// 8N1 UART implemented with two PIO state machines, for channels beyond the
+// two hardware UARTs. Data moves through a DmaStream just like Uart.
+//
+// Only the baud rate of a UartConfig can be applied; the data format is fixed
+// by the PIO programs. There is no flow control.
+class PioUart : public SerialPort {
+ public:
+  // Claims two state machines on the given PIO, loading the programs into it
+  // if no other PioUart has yet, and two DMA channels.
+  PioUart(PIO pio, int tx_pin, int rx_pin, int baud_rate, ChannelStats& stats);
+  ~PioUart();
+
+  PioUart(const PioUart&) = delete;
+  PioUart& operator=(const PioUart&) = delete;
+
+  std::span<char> Read(std::span<char> buffer) override;
+
+  // Zero while a baud rate change is waiting for queued data to go out.
+  int WriteAvailable() override {
+    return pending_config_ ? 0 : stream_->WriteAvailable();
+  }
+
+  int Write(std::span<const char> data) override;
+
+  // Takes effect once everything already queued has been transmitted.
+  void SetConfig(const UartConfig& config) override;
+
+ private:
+  // Applies the pending config if the transmitter has gone idle.
+  void ApplyPendingConfig();
+
+  // Counts and clears the receiver's framing error flag.
+  void PollErrors();
+
+  const PIO pio_;
+  ChannelStats& stats_;
+  const int tx_sm_;
+  const int rx_sm_;
+  // Program offset of the transmitter, where it stalls when idle.
+  int tx_offset_;
+  // Created once the state machines are running.
+  std::unique_ptr<DmaStream> stream_;
+
+  std::optional<UartConfig> pending_config_;
+};
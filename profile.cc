@@ -0,0 +1,87 @@
+#include "profile.h"
+
+#include <fmt/core.h>
+#include <hardware/clocks.h>
+#include <hardware/structs/systick.h>
+#include <hardware/sync.h>
+#include <pico/time.h>
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+ProfileHistogram* g_histograms = nullptr;
+
+// SysTick is a 24-bit down-counter; at 125MHz it wraps every ~134ms.
+constexpr uint32_t kSysTickMask = (1u << 24) - 1;
+// Longer scopes are timed with the microsecond timer instead, which can't be
+// ambiguous about wraps.
+constexpr uint32_t kSysTickLimitUs = 100'000;
+
+uint32_t CyclesPerUs() { return clock_get_hz(clk_sys) / 1'000'000; }
+}  // namespace
+
+void ProfileHistogram::Record(uint32_t cycles) {
+  if (!registered_) {
+    const uint32_t interrupts = save_and_disable_interrupts();
+    next_ = g_histograms;
+    g_histograms = this;
+    restore_interrupts(interrupts);
+    registered_ = true;
+  }
+  ++buckets_[std::bit_width(cycles)];
+  ++count_;
+  if (cycles > max_) {
+    max_ = cycles;
+  }
+}
+
+void ProfileHistogram::StartClock() {
+  systick_hw->rvr = kSysTickMask;
+  systick_hw->cvr = 0;
+  // Enable, counting processor clock cycles, without interrupt.
+  systick_hw->csr = 0b101;
+}
+
+uint32_t ProfileHistogram::Percentile(double fraction) const {
+  const double target = fraction * count_;
+  uint32_t seen = 0;
+  for (int i = 0; i < buckets_.size(); ++i) {
+    seen += buckets_[i];
+    if (seen >= target) {
+      return i == 0 ? 0 : static_cast<uint32_t>((uint64_t{1} << i) - 1);
+    }
+  }
+  return max_;
+}
+
+void ProfileHistogram::DumpAll(std::ostream& out) {
+  const double cycles_per_us = CyclesPerUs();
+  out << fmt::format("{:<24} {:>10} {:>10} {:>10} {:>10}\n", "scope", "count",
+                     "p50 us", "p99 us", "max us");
+  for (const ProfileHistogram* h = g_histograms; h != nullptr; h = h->next_) {
+    // Percentiles are bucket upper bounds, so at most a factor of 2 high.
+    out << fmt::format("{:<24} {:>10} {:>10.1f} {:>10.1f} {:>10.1f}\n",
+                       h->name_, h->count_,
+                       std::min(h->Percentile(0.5), h->max_) / cycles_per_us,
+                       std::min(h->Percentile(0.99), h->max_) / cycles_per_us,
+                       h->max_ / cycles_per_us);
+  }
+  out.flush();
+}
+
+ProfileTimer::ProfileTimer(ProfileHistogram& histogram)
+    : histogram_(histogram),
+      start_ticks_(systick_hw->cvr),
+      start_us_(time_us_32()) {}
+
+ProfileTimer::~ProfileTimer() {
+  const uint32_t ticks = systick_hw->cvr;
+  const uint32_t elapsed_us = time_us_32() - start_us_;
+  if (elapsed_us < kSysTickLimitUs) {
+    // Counts down.
+    histogram_.Record((start_ticks_ - ticks) & kSysTickMask);
+  } else {
+    histogram_.Record(elapsed_us * CyclesPerUs());
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+// Lightweight latency profiling, compiled in by the RS232_PROFILE CMake option.
+//
+//   void Foo::Task() {
+//     PROFILE_SCOPE("Foo::Task");
+//     ...
+//   }
+//
+// records the duration of every call into a histogram named "Foo::Task". Each
+// histogram must only be recorded into from one execution context (main loop
+// or a particular interrupt), so give interrupt paths their own scope names.
+// Without RS232_PROFILE the macro expands to nothing.
+
+// Fixed-size histogram of durations in CPU cycles, bucketed by log2. Can be
+// constant-initialized, so a function-local static needs no guard and no
+// allocation.
+class ProfileHistogram {
+ public:
+  constexpr explicit ProfileHistogram(const char* name) : name_(name) {}
+
+  void Record(uint32_t cycles);
+
+  // Starts the SysTick counter used for timing scopes.
+  static void StartClock();
+
+  // Prints count, p50, p99 and max duration of every histogram recorded into
+  // so far.
+  static void DumpAll(std::ostream& out);
+
+ private:
+  // Upper bound in cycles of the bucket containing the given fraction of all
+  // samples.
+  uint32_t Percentile(double fraction) const;
+
+  const char* name_;
+  // Bucket i counts durations with a bit width of i.
+  std::array<uint32_t, 33> buckets_ = {};
+  uint32_t count_ = 0;
+  uint32_t max_ = 0;
+  // Histograms link themselves into a global list on first use.
+  bool registered_ = false;
+  ProfileHistogram* next_ = nullptr;
+};
+
+// Records the lifetime of the object into a histogram.
+class ProfileTimer {
+ public:
+  explicit ProfileTimer(ProfileHistogram& histogram);
+  ~ProfileTimer();
+
+ private:
+  ProfileHistogram& histogram_;
+  uint32_t start_ticks_;
+  uint32_t start_us_;
+};
+
+#if RS232_PROFILE
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name)                                               \
+  static constinit ProfileHistogram PROFILE_CONCAT(profile_histogram_,    \
+                                                   __LINE__)(name);       \
+  const ProfileTimer PROFILE_CONCAT(profile_timer_, __LINE__)(            \
+      PROFILE_CONCAT(profile_histogram_, __LINE__))
+#else
+#define PROFILE_SCOPE(name)
+#endif
@@ -0,0 +1,223 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+
+#include "capture_format.h"
+#include "logging.h"
+
+Replayer::Replayer(FileSystem& fs, Bridge& bridge)
+    : fs_(fs),
+      bridge_(bridge),
+      window_(std::make_unique<std::array<std::byte, 2 * kReadSize>>()) {}
+
+void Replayer::Start(const std::filesystem::path& path, int channel,
+                     SerialPort& port, double speed) {
+  Stop();
+  try {
+    file_ = fs_.OpenFile(path, {.read = true, .open_existing = true});
+  } catch (const std::filesystem::filesystem_error& e) {
+    Log("Can't replay {}: {}", path.string(), e.what());
+    return;
+  }
+  Log("Replaying channel {} of {} at {}x speed.", channel, path.string(),
+      speed);
+  file_open_ = true;
+  end_of_file_ = false;
+  channel_ = channel;
+  port_ = &port;
+  speed_ = speed;
+  window_start_ = window_end_ = 0;
+  magic_checked_ = false;
+  capture_time_us_ = 0;
+  first_capture_time_us_.reset();
+  start_us_ = time_us_64() + kLeadUs;
+  payload_remaining_ = 0;
+  timing_ = {};
+  bridge_.SetUsbInputPaused(channel_, true);
+}
+
+void Replayer::Stop() {
+  if (!file_open_) {
+    return;
+  }
+  if (alarm_active_) {
+    cancel_alarm(alarm_id_);
+    alarm_active_ = false;
+  }
+  // Nothing else consumes once the alarm is cancelled.
+  std::array<Event, 16> events;
+  while (!events_.Pop(events).empty()) {
+  }
+  std::array<char, 256> bytes;
+  while (!bytes_.Pop(bytes).empty()) {
+  }
+  file_.Close();
+  file_open_ = false;
+  bridge_.SetUsbInputPaused(channel_, false);
+}
+
+void Replayer::Task() {
+  if (!file_open_) {
+    return;
+  }
+  Refill();
+  Parse();
+  Arm();
+  if (!end_of_file_ || window_start_ < window_end_ || payload_remaining_ > 0 ||
+      alarm_active_ || events_.Size() > 0) {
+    return;
+  }
+  const TimingStats& timing = timing_;
+  if (timing.events == 0) {
+    Log("Replay done; nothing to replay.");
+  } else {
+    Log("Replay done: {} records, timing error min={}us mean={}us max={}us",
+        timing.events, timing.min_error_us,
+        timing.total_error_us / timing.events, timing.max_error_us);
+  }
+  Stop();
+}
+
+void Replayer::Refill() {
+  if (end_of_file_ || window_end_ - window_start_ > kReadSize) {
+    return;
+  }
+  std::memmove(window_->data(), window_->data() + window_start_,
+               window_end_ - window_start_);
+  window_end_ -= window_start_;
+  window_start_ = 0;
+  const std::size_t read =
+      file_.Read(std::span(*window_).subspan(window_end_, kReadSize)).size();
+  window_end_ += read;
+  end_of_file_ = read < kReadSize;
+}
+
+void Replayer::Parse() {
+  while (true) {
+    std::span<const std::byte> input =
+        std::span(*window_).subspan(window_start_, window_end_ - window_start_);
+    if (!magic_checked_) {
+      if (input.size() < kCaptureMagic.size()) {
+        return;
+      }
+      if (std::memcmp(input.data(), kCaptureMagic.data(),
+                      kCaptureMagic.size()) != 0) {
+        Log("Not a capture file.");
+        end_of_file_ = true;
+        window_start_ = window_end_;
+        return;
+      }
+      window_start_ += kCaptureMagic.size();
+      magic_checked_ = true;
+      continue;
+    }
+
+    if (payload_remaining_ > 0) {
+      std::size_t size =
+          std::min<std::size_t>(payload_remaining_, input.size());
+      if (payload_replayed_) {
+        size = std::min({size, kMaxEventBytes, bytes_.Free()});
+        if (size == 0 || events_.Free() == 0) {
+          return;
+        }
+        bytes_.Push(std::span(reinterpret_cast<const char*>(input.data()),
+                              size));
+        const Event event = {
+            .time_us = payload_time_us_,
+            .length = static_cast<uint32_t>(size),
+            .continuation = payload_started_,
+        };
+        events_.Push(std::span(&event, 1));
+        payload_started_ = true;
+      }
+      if (size == 0) {
+        return;
+      }
+      window_start_ += size;
+      payload_remaining_ -= size;
+      continue;
+    }
+
+    const std::optional<CaptureHeader> header = CaptureHeader::Decode(input);
+    if (!header) {
+      if (end_of_file_) {
+        // Anything left is a truncated record.
+        window_start_ = window_end_;
+      }
+      return;
+    }
+    window_start_ = window_end_ - input.size();
+    capture_time_us_ += header->delta_us;
+    payload_remaining_ = header->length;
+    payload_replayed_ = header->channel == channel_ &&
+                        header->direction == CaptureDirection::kUsbToUart;
+    payload_started_ = false;
+    if (payload_replayed_) {
+      if (!first_capture_time_us_) {
+        first_capture_time_us_ = capture_time_us_;
+      }
+      const uint64_t offset_us = capture_time_us_ - *first_capture_time_us_;
+      payload_time_us_ = start_us_ + static_cast<uint64_t>(offset_us / speed_);
+    }
+  }
+}
+
+void Replayer::Arm() {
+  if (alarm_active_ || events_.Size() == 0) {
+    return;
+  }
+  // The alarm isn't running, so the main loop can take the first event.
+  events_.Pop(std::span(&current_, 1));
+  current_remaining_ = current_.length;
+  current_started_ = false;
+  alarm_active_ = true;
+  alarm_id_ = add_alarm_at(from_us_since_boot(current_.time_us),
+                           &Replayer::HandleAlarm, this, true);
+}
+
+int64_t Replayer::HandleAlarm(alarm_id_t id, void* user_data) {
+  return static_cast<Replayer*>(user_data)->ServiceAlarm();
+}
+
+int64_t Replayer::ServiceAlarm() {
+  while (true) {
+    if (!current_started_) {
+      current_started_ = true;
+      if (!current_.continuation) {
+        const int64_t error = static_cast<int64_t>(time_us_64() -
+                                                   current_.time_us);
+        timing_.min_error_us = timing_.events == 0
+                                   ? error
+                                   : std::min(timing_.min_error_us, error);
+        timing_.max_error_us = timing_.events == 0
+                                   ? error
+                                   : std::max(timing_.max_error_us, error);
+        timing_.total_error_us += error;
+        ++timing_.events;
+      }
+    }
+    while (current_remaining_ > 0) {
+      std::array<char, 64> chunk;
+      const std::size_t size = std::min<std::size_t>(
+          {chunk.size(), current_remaining_,
+           static_cast<std::size_t>(std::max(port_->WriteAvailable(), 0))});
+      if (size == 0) {
+        return kRetryUs;
+      }
+      port_->Write(bytes_.Pop(std::span(chunk).first(size)));
+      current_remaining_ -= size;
+    }
+    if (events_.Pop(std::span(&current_, 1)).empty()) {
+      alarm_active_ = false;
+      return 0;
+    }
+    current_remaining_ = current_.length;
+    current_started_ = false;
+    const int64_t wait = static_cast<int64_t>(current_.time_us - time_us_64());
+    if (wait > 0) {
+      return wait;
+    }
+  }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <pico/time.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+
+#include "bridge.h"
+#include "fs.h"
+#include "serial_port.h"
+#include "spsc_queue.h"
+
+// Plays the host-to-UART traffic of one channel in a capture file (see
+// capture_format.h) back onto a port, at its original timing or scaled by a
+// speed multiplier. The bridge keeps forwarding the port's responses to the
+// host, but holds off the host's own input on that channel meanwhile.
+//
+// The main loop streams the file through a window of two read-sized chunks
+// and parses records ahead of time into queues. A hardware alarm then hands
+// each record's bytes to the port when they are due, so the schedule doesn't
+// depend on main loop latency. The port's Write() must therefore be safe to
+// call from an interrupt handler while nothing else writes to it, which holds
+// for the DMA-backed UARTs and Core1Uart.
+class Replayer {
+ public:
+  // File bytes per read.
+  static constexpr std::size_t kReadSize = 4096;
+  // Delay between starting a replay and its first record.
+  static constexpr uint64_t kLeadUs = 100'000;
+
+  Replayer(FileSystem& fs, Bridge& bridge);
+
+  // Starts replaying the given capture channel's traffic onto the port,
+  // stopping any replay in progress first. Errors opening the file are
+  // logged.
+  void Start(const std::filesystem::path& path, int channel, SerialPort& port,
+             double speed = 1.0);
+
+  // Abandons the replay in progress, if any, e.g. because the filesystem is
+  // about to be remounted.
+  void Stop();
+
+  bool Active() const { return file_open_; }
+
+  // Parses ahead and schedules records, and reports timing errors once the
+  // replay is done.
+  void Task();
+
+ private:
+  // Largest number of bytes sent by one alarm event. Longer records are split
+  // into several events.
+  static constexpr std::size_t kMaxEventBytes = 256;
+  // Retry interval while the port has no room.
+  static constexpr int64_t kRetryUs = 50;
+
+  struct Event {
+    uint64_t time_us;
+    uint32_t length;
+    // Continues the previous event's record, so it is sent straight after it
+    // and not counted in the timing statistics.
+    bool continuation;
+  };
+
+  // Written by the alarm handler, read by the main loop once it is inactive.
+  struct TimingStats {
+    uint32_t events = 0;
+    int64_t min_error_us = 0;
+    int64_t max_error_us = 0;
+    int64_t total_error_us = 0;
+  };
+
+  static int64_t HandleAlarm(alarm_id_t id, void* user_data);
+  // Returns the delay from now until the alarm should fire again, or 0 once
+  // there is nothing left to send.
+  int64_t ServiceAlarm();
+
+  // Parses as many records as fit in the queues.
+  void Parse();
+  // Tops up the read window if it has room for another chunk.
+  void Refill();
+  // Starts the alarm for the next queued event if it isn't running.
+  void Arm();
+
+  FileSystem& fs_;
+  Bridge& bridge_;
+
+  // Main loop state.
+  File file_;
+  bool file_open_ = false;
+  bool end_of_file_ = false;
+  int channel_ = 0;
+  SerialPort* port_ = nullptr;
+  double speed_ = 1.0;
+  std::unique_ptr<std::array<std::byte, 2 * kReadSize>> window_;
+  std::size_t window_start_ = 0;
+  std::size_t window_end_ = 0;
+  bool magic_checked_ = false;
+  // Capture time of the current record, and of the first replayed one.
+  uint64_t capture_time_us_ = 0;
+  std::optional<uint64_t> first_capture_time_us_;
+  uint64_t start_us_ = 0;
+  // Payload of the current record left to queue or skip.
+  uint32_t payload_remaining_ = 0;
+  bool payload_replayed_ = false;
+  bool payload_started_ = false;
+  uint64_t payload_time_us_ = 0;
+
+  // Produced by the main loop, consumed by the alarm handler. While the alarm
+  // is inactive the main loop also takes the first event off, so the two
+  // never consume at the same time.
+  SpscQueue<Event, 64> events_;
+  SpscQueue<char, 4096> bytes_;
+  std::atomic<bool> alarm_active_ = false;
+  alarm_id_t alarm_id_ = 0;
+
+  // Alarm handler state.
+  Event current_;
+  uint32_t current_remaining_ = 0;
+  bool current_started_ = false;
+  TimingStats timing_;
+};
@@ -0,0 +1,107 @@
+#include "sector_cache.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "stats.h"
+
+SectorCache::SectorCache(BlockDevice& disk, int entry_count)
+    : disk_(disk), entries_(entry_count) {}
+
+std::span<const std::byte> SectorCache::ReadSector(int i) {
+  if (Entry* entry = Find(i)) {
+    CountHit();
+    entry->referenced = true;
+    return entry->data;
+  }
+  CountMiss();
+  return disk_.ReadSector(i);
+}
+
+void SectorCache::WriteSector(int i, std::span<const std::byte> payload) {
+  if (payload.size() != kSectorSize) {
+    throw std::length_error(
+        fmt::format("Payload size does not match sector size: {} vs {}",
+                    payload.size(), kSectorSize));
+  }
+  Entry* entry = Find(i);
+  if (entry != nullptr) {
+    CountHit();
+  } else {
+    CountMiss();
+    entry = &Allocate(i);
+  }
+  std::ranges::copy(payload, entry->data.begin());
+  entry->dirty = true;
+  entry->referenced = true;
+}
+
+void SectorCache::Trim(int first, int count) {
+  for (Entry& entry : entries_) {
+    if (entry.sector >= first && entry.sector < first + count) {
+      entry.sector = -1;
+      entry.dirty = false;
+      entry.referenced = false;
+    }
+  }
+  disk_.Trim(first, count);
+}
+
+void SectorCache::Sync() {
+  std::vector<Entry*> dirty;
+  for (Entry& entry : entries_) {
+    if (entry.dirty) {
+      dirty.push_back(&entry);
+    }
+  }
+  std::ranges::sort(dirty, {}, &Entry::sector);
+  for (Entry* entry : dirty) {
+    WriteBack(*entry);
+  }
+  disk_.Sync();
+}
+
+SectorCache::Entry* SectorCache::Find(int i) {
+  for (Entry& entry : entries_) {
+    if (entry.sector == i) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+SectorCache::Entry& SectorCache::Allocate(int i) {
+  while (true) {
+    Entry& entry = entries_[hand_];
+    hand_ = (hand_ + 1) % entries_.size();
+    if (entry.sector >= 0 && entry.referenced) {
+      // Second chance.
+      entry.referenced = false;
+      continue;
+    }
+    if (entry.dirty) {
+      WriteBack(entry);
+    }
+    entry.sector = i;
+    return entry;
+  }
+}
+
+void SectorCache::WriteBack(Entry& entry) {
+  disk_.WriteSector(entry.sector, entry.data);
+  entry.dirty = false;
+  ++writebacks_;
+  Stats::Global().sector_cache_writebacks.Add();
+}
+
+void SectorCache::CountHit() {
+  ++hits_;
+  Stats::Global().sector_cache_hits.Add();
+}
+
+void SectorCache::CountMiss() {
+  ++misses_;
+  Stats::Global().sector_cache_misses.Add();
+}
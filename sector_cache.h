@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "block_device.h"
+
+// Write-back RAM cache of whole sectors in front of another block device.
+//
+// Writes land in the cache and only reach the underlying device when their
+// entry is evicted or on Sync(), so the FAT and directory sectors that FatFS
+// rewrites on every append are coalesced into a single flash update. Entries
+// are evicted in CLOCK (second chance) order. Reads of uncached sectors pass
+// straight through without allocating an entry.
+class SectorCache : public BlockDevice {
+ public:
+  SectorCache(BlockDevice& disk, int entry_count = 4);
+
+  std::span<const std::byte> ReadSector(int i) override;
+
+  void WriteSector(int i, std::span<const std::byte> payload) override;
+
+  std::size_t SectorCount() override { return disk_.SectorCount(); }
+
+  // Drops any cached entries for the sectors, dirty or not, before passing the
+  // trim on.
+  void Trim(int first, int count) override;
+
+  void MarkDataOnly(int first, int count) override {
+    disk_.MarkDataOnly(first, count);
+  }
+  void ClearDataOnly(int first, int count) override {
+    disk_.ClearDataOnly(first, count);
+  }
+
+  // Writes back all dirty entries, in sector order.
+  void Sync() override;
+
+  uint32_t Hits() { return hits_; }
+  uint32_t Misses() { return misses_; }
+
+  // Number of dirty entries written to the underlying device.
+  uint32_t Writebacks() { return writebacks_; }
+
+ private:
+  struct Entry {
+    // -1 if the entry is unused.
+    int sector = -1;
+    bool dirty = false;
+    // Set on every access; cleared as the CLOCK hand passes over the entry.
+    bool referenced = false;
+    std::array<std::byte, kSectorSize> data;
+  };
+
+  Entry* Find(int i);
+
+  // Picks an entry for the given sector, writing back its previous contents
+  // if needed.
+  Entry& Allocate(int i);
+
+  void WriteBack(Entry& entry);
+
+  // Counted here and in Stats.
+  void CountHit();
+  void CountMiss();
+
+  BlockDevice& disk_;
+  std::vector<Entry> entries_;
+  std::size_t hand_ = 0;
+
+  uint32_t hits_ = 0;
+  uint32_t misses_ = 0;
+  uint32_t writebacks_ = 0;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+
+#include "uart_config.h"
+
+// A received byte and when it arrived, on the time_us_64() clock.
+struct TimestampedByte {
+  uint64_t time_us;
+  char byte;
+};
+
+// Byte stream endpoint that the bridge moves data between.
+class SerialPort {
+ public:
+  virtual ~SerialPort() = default;
+
+  // Returns the subspan of the input buffer that was actually read into. This
+  // is empty if no data is available.
+  virtual std::span<char> Read(std::span<char> buffer) = 0;
+
+  // Number of bytes that Write() will currently accept.
+  virtual int WriteAvailable() = 0;
+
+  // Whether the port timestamps each byte as it arrives, in which case
+  // ReadTimestamped() may be used in place of Read().
+  virtual bool HasRxTimestamps() { return false; }
+
+  // Like Read(), but with each byte's arrival time.
+  virtual std::span<TimestampedByte> ReadTimestamped(
+      std::span<TimestampedByte> buffer) {
+    return buffer.first(0);
+  }
+
+  // Returns the number of bytes actually written.
+  virtual int Write(std::span<const char> data) = 0;
+
+  // Pushes out any data buffered by Write().
+  virtual void Flush() {}
+
+  // Changes the line settings. Ports without any (e.g. USB) ignore this.
+  virtual void SetConfig(const UartConfig& config) {}
+
+  // Line settings requested by whatever is on the other end of this port
+  // (e.g. a USB host's SET_LINE_CODING), reported once per request.
+  virtual std::optional<UartConfig> TakeConfigRequest() { return std::nullopt; }
+};
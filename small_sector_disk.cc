@@ -0,0 +1,91 @@
+#include "small_sector_disk.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "stats.h"
+
+SmallSectorDisk::SmallSectorDisk(BlockDevice& disk)
+    : disk_(disk),
+      buffer_(std::make_unique<std::array<std::byte, kSectorSize>>()) {}
+
+std::span<const std::byte> SmallSectorDisk::ReadSector(int i) {
+  const int part = i % kSplit;
+  if (i / kSplit == assembling_ && written_[part]) {
+    return std::span(*buffer_).subspan(part * kSmallSectorSize,
+                                       kSmallSectorSize);
+  }
+  return disk_.ReadSector(i / kSplit)
+      .subspan(part * kSmallSectorSize, kSmallSectorSize);
+}
+
+void SmallSectorDisk::WriteSector(int i, std::span<const std::byte> payload) {
+  if (payload.size() != kSmallSectorSize) {
+    throw std::length_error(
+        fmt::format("Payload size does not match sector size: {} vs {}",
+                    payload.size(), kSmallSectorSize));
+  }
+  if (i / kSplit != assembling_) {
+    WriteBack();
+    assembling_ = i / kSplit;
+    written_.reset();
+  }
+  const int part = i % kSplit;
+  std::ranges::copy(payload, buffer_->begin() + part * kSmallSectorSize);
+  written_[part] = true;
+  Stats::Global().small_sector_writes.Add();
+}
+
+void SmallSectorDisk::Trim(int first, int count) {
+  const int first_full = (first + kSplit - 1) / kSplit;
+  const int end_full = (first + count) / kSplit;
+  if (assembling_ >= first_full && assembling_ < end_full) {
+    assembling_ = -1;
+  }
+  if (first_full < end_full) {
+    disk_.Trim(first_full, end_full - first_full);
+  }
+}
+
+void SmallSectorDisk::MarkDataOnly(int first, int count) {
+  const int first_full = (first + kSplit - 1) / kSplit;
+  const int end_full = (first + count) / kSplit;
+  if (first_full < end_full) {
+    disk_.MarkDataOnly(first_full, end_full - first_full);
+  }
+}
+
+void SmallSectorDisk::ClearDataOnly(int first, int count) {
+  const int first_touched = first / kSplit;
+  const int end_touched = (first + count + kSplit - 1) / kSplit;
+  if (first_touched < end_touched) {
+    disk_.ClearDataOnly(first_touched, end_touched - first_touched);
+  }
+}
+
+void SmallSectorDisk::Sync() {
+  WriteBack();
+  disk_.Sync();
+}
+
+void SmallSectorDisk::WriteBack() {
+  if (assembling_ < 0) {
+    return;
+  }
+  if (!written_.all()) {
+    Stats::Global().small_sector_fills.Add();
+    const std::span<const std::byte> old = disk_.ReadSector(assembling_);
+    for (int part = 0; part < kSplit; ++part) {
+      if (!written_[part]) {
+        const std::size_t offset = part * kSmallSectorSize;
+        std::copy_n(old.begin() + offset, kSmallSectorSize,
+                    buffer_->begin() + offset);
+      }
+    }
+  }
+  disk_.WriteSector(assembling_, *buffer_);
+  assembling_ = -1;
+  Stats::Global().small_sector_writebacks.Add();
+}
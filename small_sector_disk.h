@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "block_device.h"
+
+// Exposes 512-byte sectors on top of a device with kSectorSize sectors, for
+// hosts and tools that handle 4 KB-sector removable media badly. FatFS's
+// per-file and per-volume sector buffers shrink to match.
+//
+// Writes are assembled in a RAM copy of one underlying sector, so a run of
+// writes within it reaches the device as a single sector write once another
+// sector is written to, or on Sync(). If the whole sector was written, it goes
+// out as is; otherwise the parts that weren't are read from the device first.
+class SmallSectorDisk : public BlockDevice {
+ public:
+  static constexpr int kSmallSectorSize = 512;
+  // Small sectors per underlying sector.
+  static constexpr int kSplit = kSectorSize / kSmallSectorSize;
+
+  explicit SmallSectorDisk(BlockDevice& disk);
+
+  int SectorSize() override { return kSmallSectorSize; }
+
+  std::span<const std::byte> ReadSector(int i) override;
+
+  void WriteSector(int i, std::span<const std::byte> payload) override;
+
+  std::size_t SectorCount() override { return disk_.SectorCount() * kSplit; }
+
+  // Only underlying sectors that are trimmed in full are passed on.
+  void Trim(int first, int count) override;
+
+  // Likewise only for underlying sectors that are data-only in full.
+  void MarkDataOnly(int first, int count) override;
+
+  // Clears every underlying sector that is cleared even in part.
+  void ClearDataOnly(int first, int count) override;
+
+  // Writes back the assembled sector, then syncs the device.
+  void Sync() override;
+
+ private:
+  void WriteBack();
+
+  BlockDevice& disk_;
+
+  // Underlying sector being assembled, or -1.
+  int assembling_ = -1;
+  // Small sectors of it that have been written.
+  std::bitset<kSplit> written_;
+  std::unique_ptr<std::array<std::byte, kSectorSize>> buffer_;
+};
@@ -0,0 +1,129 @@
+#include "sniffer.h"
+
+#include <pico/time.h>
+
+#include <algorithm>
+#include <optional>
+
+Sniffer::Sniffer(int channel, SerialPort& first_tap, SerialPort& second_tap,
+                 SerialPort& output, CaptureRecorder& capture, int baud_rate)
+    : channel_(channel),
+      output_(output),
+      capture_(capture),
+      stats_(Stats::Global().channels[channel]),
+      taps_{{
+          {.port = &first_tap, .direction = CaptureDirection::kUsbToUart},
+          {.port = &second_tap, .direction = CaptureDirection::kUartToUsb},
+      }},
+      last_poll_us_(time_us_64()),
+      last_output_us_(last_poll_us_) {
+  SetBaudRate(baud_rate);
+}
+
+void Sniffer::SetBaudRate(int baud_rate) {
+  // Start bit, 8 data bits and a stop bit.
+  character_us_ = 10'000'000 / baud_rate;
+}
+
+void Sniffer::Task() {
+  if (const std::optional<UartConfig> config = output_.TakeConfigRequest()) {
+    for (Tap& tap : taps_) {
+      tap.port->SetConfig(*config);
+    }
+    SetBaudRate(config->baud_rate);
+  }
+
+  const uint64_t now = time_us_64();
+  for (Tap& tap : taps_) {
+    Poll(tap, now);
+  }
+
+  // Every byte in this poll's batches arrived after the previous poll, so
+  // merging just these batches yields a globally ordered stream. Runs of
+  // consecutive bytes from the same tap become one record.
+  std::array<char, kBatchSize> run;
+  std::size_t run_size = 0;
+  const Tap* run_tap = nullptr;
+  uint64_t run_time = 0;
+  while (true) {
+    Tap* earliest = nullptr;
+    for (Tap& tap : taps_) {
+      if (tap.next == tap.size) {
+        continue;
+      }
+      if (earliest == nullptr || tap.batch[tap.next].time_us <
+                                     earliest->batch[earliest->next].time_us) {
+        earliest = &tap;
+      }
+    }
+    if (run_size > 0 && (earliest != run_tap || run_size == run.size())) {
+      Emit(run_tap->direction, std::span(run).first(run_size), run_time);
+      run_size = 0;
+    }
+    if (earliest == nullptr) {
+      break;
+    }
+    const TimestampedByte& next = earliest->batch[earliest->next++];
+    if (run_size == 0) {
+      run_tap = earliest;
+      run_time = next.time_us;
+    }
+    run[run_size++] = next.byte;
+  }
+  last_poll_us_ = now;
+}
+
+void Sniffer::Poll(Tap& tap, uint64_t now) {
+  // Everything read now is treated as having arrived after the previous poll,
+  // which keeps the merge in Task() ordered.
+  const uint64_t max_backdate =
+      now > last_poll_us_ ? now - last_poll_us_ - 1 : 0;
+  std::size_t size;
+  if (tap.port->HasRxTimestamps()) {
+    size = tap.port->ReadTimestamped(tap.batch).size();
+    for (TimestampedByte& entry : std::span(tap.batch).first(size)) {
+      entry.time_us = std::clamp(entry.time_us, now - max_backdate, now);
+    }
+  } else {
+    std::array<char, kBatchSize> buffer;
+    const std::span<char> data = tap.port->Read(buffer);
+    size = data.size();
+    for (std::size_t i = 0; i < size; ++i) {
+      const uint64_t backdate = uint64_t{character_us_} * (size - 1 - i);
+      tap.batch[i] = {
+          .time_us = now - std::min(backdate, max_backdate),
+          .byte = data[i],
+      };
+    }
+  }
+  tap.size = size;
+  tap.next = 0;
+  (tap.direction == CaptureDirection::kUsbToUart ? stats_.usb_to_uart_bytes
+                                                 : stats_.uart_to_usb_bytes)
+      .Add(size);
+}
+
+void Sniffer::Emit(CaptureDirection direction, std::span<const char> data,
+                   uint64_t time_us) {
+  capture_.Record(channel_, direction, data, time_us);
+
+  const uint64_t time = std::max(time_us, last_output_us_);
+  const CaptureHeader header = {
+      .direction = direction,
+      .channel = static_cast<uint8_t>(channel_),
+      .delta_us = time - last_output_us_,
+      .length = static_cast<uint32_t>(data.size()),
+  };
+  std::array<std::byte, CaptureHeader::kMaxSize> header_bytes;
+  const std::size_t header_size = header.Encode(header_bytes);
+  if (header_size + data.size() > output_.WriteAvailable()) {
+    // The host isn't keeping up; records must not be split, so drop this one.
+    stats_.sniffer_dropped_bytes.Add(data.size());
+    return;
+  }
+  last_output_us_ = time;
+  output_.Write(std::span(reinterpret_cast<const char*>(header_bytes.data()),
+                          header_size));
+  output_.Write(data);
+  output_.Flush();
+}
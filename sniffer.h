@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "capture.h"
+#include "capture_format.h"
+#include "serial_port.h"
+#include "stats.h"
+
+// Passively taps both directions of a link between two external devices: each
+// tap only receives, one per direction. Traffic from the taps is merged into
+// time order and sent out as capture records (see capture_format.h), both to
+// the capture file and to an output port such as a CDC interface. The output
+// carries records only, without the file magic.
+//
+// In the records, the first tap's traffic is kUsbToUart and the second's is
+// kUartToUsb. The host's line coding on the output port is applied to both
+// taps.
+class Sniffer {
+ public:
+  // Maximum number of bytes taken from each tap per call to Task().
+  static constexpr std::size_t kBatchSize = 256;
+
+  Sniffer(int channel, SerialPort& first_tap, SerialPort& second_tap,
+          SerialPort& output, CaptureRecorder& capture, int baud_rate);
+
+  void Task();
+
+ private:
+  struct Tap {
+    SerialPort* port;
+    CaptureDirection direction;
+    // Bytes taken by the current call to Task(), and the merge position.
+    std::array<TimestampedByte, kBatchSize> batch;
+    std::size_t size = 0;
+    std::size_t next = 0;
+  };
+
+  // Takes a batch from the tap. Ports that timestamp bytes on arrival are
+  // trusted; otherwise bytes are read some time after they arrive, so each is
+  // back-dated by one character time per byte that followed it. Either way,
+  // no byte is dated to before the previous poll.
+  void Poll(Tap& tap, uint64_t now);
+
+  // Sends out one run of consecutive bytes from the same tap.
+  void Emit(CaptureDirection direction, std::span<const char> data,
+            uint64_t time_us);
+
+  void SetBaudRate(int baud_rate);
+
+  const int channel_;
+  SerialPort& output_;
+  CaptureRecorder& capture_;
+  ChannelStats& stats_;
+  std::array<Tap, 2> taps_;
+
+  // Duration of one 8N1 character.
+  uint32_t character_us_;
+  uint64_t last_poll_us_;
+  // Time of the last record sent to the output port.
+  uint64_t last_output_us_;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Wait-free single-producer/single-consumer queue of trivially copyable
+// elements, for passing data between cores (or threads).
+//
+// The producer only writes head_ and the consumer only writes tail_. Each
+// index lives on its own cache line next to the owning side's cached copy of
+// the other index, so the two sides only touch shared lines when their cached
+// view says the queue is full or empty.
+template <typename T, std::size_t kCapacity>
+class SpscQueue {
+ public:
+  static_assert(std::has_single_bit(kCapacity),
+                "Queue capacity must be a power of 2.");
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  // Producer side. Returns the number of elements actually pushed.
+  std::size_t Push(std::span<const T> data) {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (kCapacity - (head - producer_.cached_tail) < data.size()) {
+      producer_.cached_tail = tail_.load(std::memory_order_acquire);
+    }
+    const std::size_t size =
+        std::min(data.size(), kCapacity - (head - producer_.cached_tail));
+    for (std::size_t i = 0; i < size; ++i) {
+      storage_[(head + i) & kMask] = data[i];
+    }
+    head_.store(head + size, std::memory_order_release);
+    return size;
+  }
+
+  // Producer side. Lower bound on the number of elements Push() will accept.
+  std::size_t Free() const {
+    return kCapacity - (head_.load(std::memory_order_relaxed) -
+                        tail_.load(std::memory_order_acquire));
+  }
+
+  // Consumer side. Returns the subspan of the input buffer that was actually
+  // filled.
+  std::span<T> Pop(std::span<T> buffer) {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (consumer_.cached_head - tail < buffer.size()) {
+      consumer_.cached_head = head_.load(std::memory_order_acquire);
+    }
+    const std::size_t size =
+        std::min<std::size_t>(buffer.size(), consumer_.cached_head - tail);
+    for (std::size_t i = 0; i < size; ++i) {
+      buffer[i] = storage_[(tail + i) & kMask];
+    }
+    tail_.store(tail + size, std::memory_order_release);
+    return buffer.first(size);
+  }
+
+  // Consumer side. Lower bound on the number of elements Pop() will return.
+  std::size_t Size() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr uint32_t kMask = kCapacity - 1;
+  static constexpr std::size_t kCacheLineSize = 64;
+
+  // Written by the producer.
+  alignas(kCacheLineSize) std::atomic<uint32_t> head_ = 0;
+  struct {
+    uint32_t cached_tail = 0;
+  } producer_;
+
+  // Written by the consumer.
+  alignas(kCacheLineSize) std::atomic<uint32_t> tail_ = 0;
+  struct {
+    uint32_t cached_head = 0;
+  } consumer_;
+
+  alignas(kCacheLineSize) std::array<T, kCapacity> storage_;
+};
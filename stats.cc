@@ -0,0 +1,70 @@
+#include "stats.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+Stats g_stats;
+
+constexpr std::pair<const char*, Counter ChannelStats::*> kChannelCounters[] = {
+    {"usb_to_uart_bytes", &ChannelStats::usb_to_uart_bytes},
+    {"uart_to_usb_bytes", &ChannelStats::uart_to_usb_bytes},
+    {"uart_to_usb_frames", &ChannelStats::uart_to_usb_frames},
+    {"usb_tx_full", &ChannelStats::usb_tx_full},
+    {"uart_overrun_errors", &ChannelStats::uart_overrun_errors},
+    {"uart_framing_errors", &ChannelStats::uart_framing_errors},
+    {"uart_parity_errors", &ChannelStats::uart_parity_errors},
+    {"uart_break_errors", &ChannelStats::uart_break_errors},
+    {"rx_ring_overruns", &ChannelStats::rx_ring_overruns},
+    {"rx_flow_stops", &ChannelStats::rx_flow_stops},
+    {"rx_ring_high_water", &ChannelStats::rx_ring_high_water},
+    {"tx_ring_high_water", &ChannelStats::tx_ring_high_water},
+    {"sniffer_dropped_bytes", &ChannelStats::sniffer_dropped_bytes},
+    {"bridge_dropped_bytes", &ChannelStats::bridge_dropped_bytes},
+    {"capture_triggers", &ChannelStats::capture_triggers},
+};
+
+constexpr std::pair<const char*, Counter Stats::*> kGlobalCounters[] = {
+    {"flash_erases", &Stats::flash_erases},
+    {"flash_programmed_pages", &Stats::flash_programmed_pages},
+    {"flash_max_blackout_us", &Stats::flash_max_blackout_us},
+    {"flash_trimmed_sectors", &Stats::flash_trimmed_sectors},
+    {"flash_preerased_writes", &Stats::flash_preerased_writes},
+    {"flash_journaled_writes", &Stats::flash_journaled_writes},
+    {"flash_journal_replays", &Stats::flash_journal_replays},
+    {"small_sector_writes", &Stats::small_sector_writes},
+    {"small_sector_writebacks", &Stats::small_sector_writebacks},
+    {"small_sector_fills", &Stats::small_sector_fills},
+    {"sector_cache_hits", &Stats::sector_cache_hits},
+    {"sector_cache_misses", &Stats::sector_cache_misses},
+    {"sector_cache_writebacks", &Stats::sector_cache_writebacks},
+    {"fs_syncs", &Stats::fs_syncs},
+    {"fs_sync_last_us", &Stats::fs_sync_last_us},
+    {"fs_sync_max_us", &Stats::fs_sync_max_us},
+    {"log_dropped_messages", &Stats::log_dropped_messages},
+};
+}  // namespace
+
+Stats& Stats::Global() { return g_stats; }
+
+std::span<char> Stats::Format(std::span<char> buffer) const {
+  char* out = buffer.data();
+  char* const end = buffer.data() + buffer.size();
+  // format_to_n reports where untruncated output would have ended.
+  auto advance = [&](const fmt::format_to_n_result<char*>& result) {
+    out = std::min(result.out, end);
+  };
+  for (int i = 0; i < kChannels; ++i) {
+    for (const auto& [name, counter] : kChannelCounters) {
+      advance(fmt::format_to_n(out, end - out, "channel{}.{} {}\n", i, name,
+                               (channels[i].*counter).Get()));
+    }
+  }
+  for (const auto& [name, counter] : kGlobalCounters) {
+    advance(fmt::format_to_n(out, end - out, "{} {}\n", name,
+                             (this->*counter).Get()));
+  }
+  return buffer.first(out - buffer.data());
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <span>
+
+// Monotonic counter or watermark with exactly one writer. Updates are a
+// relaxed load and store rather than a read-modify-write, which the M0+ can't
+// do atomically without locking; readers may see a slightly stale value.
+class Counter {
+ public:
+  void Add(uint32_t n = 1) {
+    value_.store(value_.load(std::memory_order_relaxed) + n,
+                 std::memory_order_relaxed);
+  }
+
+  void Set(uint32_t value) { value_.store(value, std::memory_order_relaxed); }
+
+  void RecordMax(uint32_t value) {
+    if (value > value_.load(std::memory_order_relaxed)) {
+      value_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  uint32_t Get() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint32_t> value_ = 0;
+};
+
+// Counters for one bridged serial channel, indexed by bridge channel number.
+struct ChannelStats {
+  // For a sniffer channel, bytes from its first and second tap.
+  Counter usb_to_uart_bytes;
+  Counter uart_to_usb_bytes;
+  // Frames forwarded on a channel with a framer.
+  Counter uart_to_usb_frames;
+  // Times the USB side stopped accepting data.
+  Counter usb_tx_full;
+  // UART receive errors. The hardware flags are sticky between polls, so a
+  // burst of errors may only count once.
+  Counter uart_overrun_errors;
+  Counter uart_framing_errors;
+  Counter uart_parity_errors;
+  Counter uart_break_errors;
+  // Bytes lost to the RX ring filling up.
+  Counter rx_ring_overruns;
+  // Times the far end was told to stop sending.
+  Counter rx_flow_stops;
+  Counter rx_ring_high_water;
+  Counter tx_ring_high_water;
+  // Sniffed bytes that didn't fit in the output port.
+  Counter sniffer_dropped_bytes;
+  // Bytes read from one side that the other side then refused.
+  Counter bridge_dropped_bytes;
+  // Trigger pattern matches in either direction.
+  Counter capture_triggers;
+};
+
+struct Stats {
+  static constexpr int kChannels = 4;
+
+  // The process-wide counters.
+  static Stats& Global();
+
+  std::array<ChannelStats, kChannels> channels;
+
+  Counter flash_erases;
+  Counter flash_programmed_pages;
+  Counter flash_max_blackout_us;
+  // Sectors freed by FatFS or the host.
+  Counter flash_trimmed_sectors;
+  // Sector writes that found the sector already erased in the background.
+  Counter flash_preerased_writes;
+  // Sector writes that went through the journal, and interrupted ones
+  // finished from it at boot.
+  Counter flash_journaled_writes;
+  Counter flash_journal_replays;
+  // 512-byte sector writes under RS232_SMALL_SECTORS, and the underlying
+  // sector writes they turned into; 8 * writebacks / writes is the write
+  // amplification. Fills are writebacks that had to read part of the old
+  // sector back.
+  Counter small_sector_writes;
+  Counter small_sector_writebacks;
+  Counter small_sector_fills;
+  // Sector reads and writes that the RAM sector cache in front of the flash
+  // served or missed, and dirty entries it wrote out.
+  Counter sector_cache_hits;
+  Counter sector_cache_misses;
+  Counter sector_cache_writebacks;
+
+  Counter fs_syncs;
+  Counter fs_sync_last_us;
+  Counter fs_sync_max_us;
+  // Log messages lost to the log ring being full.
+  Counter log_dropped_messages;
+
+  // Formats all counters as "name value" lines into the buffer, truncating if
+  // it is too small. Does not allocate, so it is safe in interrupt context.
+  // Returns the part of the buffer written to.
+  std::span<char> Format(std::span<char> buffer) const;
+};
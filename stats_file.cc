@@ -0,0 +1,35 @@
+#include "stats_file.h"
+
+#include <algorithm>
+#include <span>
+#include <string>
+
+#include "block_device.h"
+#include "stats.h"
+
+namespace {
+void Generate(std::span<std::byte> sector) {
+  const auto text = std::span(reinterpret_cast<char*>(sector.data()),
+                              sector.size());
+  const std::span<char> used = Stats::Global().Format(text);
+  // The file size is fixed, so pad out the rest.
+  std::ranges::fill(text.subspan(used.size()), ' ');
+}
+}  // namespace
+
+StatsFile::StatsFile(FileSystem& fs, MscDevice& msc) : fs_(fs), msc_(msc) {
+  Locate();
+}
+
+void StatsFile::Locate() {
+  File file = fs_.OpenFile(kPath, {.read = true, .open_always = true});
+  if (file.Size() != BlockDevice::kSectorSize) {
+    // Clusters are at least a flash sector, so the file is contiguous.
+    file.Close();
+    file = fs_.OpenFile(kPath, {.write = true, .create_always = true});
+    std::string placeholder = "Statistics are generated when read over USB.\n";
+    placeholder.resize(BlockDevice::kSectorSize, ' ');
+    file.Write(placeholder);
+  }
+  msc_.SetSynthesizedSector(file.FirstSector(), &Generate);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "fs.h"
+#include "msc_device.h"
+
+// Exposes Stats::Global() to the USB host as a read-only text file. The file
+// occupies a single sector whose contents are generated whenever the host
+// reads it; nothing is written to flash after creation.
+//
+// Hosts cache file contents, so a fresh read may need the volume to be
+// re-read (e.g. after the next media change notification).
+class StatsFile {
+ public:
+  static constexpr char kPath[] = "/STATS.TXT";
+
+  StatsFile(FileSystem& fs, MscDevice& msc);
+
+  // Finds the file's sector again, e.g. after the host modified the volume
+  // and the filesystem was remounted.
+  void Locate();
+
+ private:
+  FileSystem& fs_;
+  MscDevice& msc_;
+};
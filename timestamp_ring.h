@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "serial_port.h"
+#include "spsc_queue.h"
+
+// Queue of received bytes and their arrival times, packed into 32 bits each:
+// the byte in the low 8 bits and the microseconds since the previous byte in
+// the upper 24. Filled from an interrupt handler, which only needs the 32-bit
+// timer, and drained by the main loop, which reconstructs 64-bit times.
+//
+// Gaps of 2^24 us (~16.8s) or more saturate. The consumer then substitutes
+// the time it reads the byte, so absolute times after such a gap are only as
+// accurate as the consumer's polling. Reconstructed times never run past the
+// time of the read, which every byte popped arrived before.
+template <std::size_t kCapacity>
+class TimestampRing {
+ public:
+  static constexpr uint32_t kMaxDelta = (1u << 24) - 1;
+
+  // Both sides start counting from the given time.
+  explicit TimestampRing(uint64_t start_us)
+      : producer_last_us_(static_cast<uint32_t>(start_us)),
+        consumer_last_us_(start_us) {}
+
+  // Producer side. Returns false, dropping the byte, if the ring is full.
+  bool Push(char byte, uint32_t now_us) {
+    const uint32_t delta = std::min(now_us - producer_last_us_, kMaxDelta);
+    const uint32_t entry = (delta << 8) | static_cast<uint8_t>(byte);
+    if (queue_.Push(std::span(&entry, 1)) == 0) {
+      return false;
+    }
+    producer_last_us_ = now_us;
+    return true;
+  }
+
+  // Consumer side. now_us is the current time: it stands in after a
+  // saturated gap and bounds every reconstructed time. Returns the subspan of
+  // the input buffer that was actually filled.
+  std::span<TimestampedByte> Pop(std::span<TimestampedByte> buffer,
+                                 uint64_t now_us) {
+    std::array<uint32_t, 64> entries;
+    std::size_t filled = 0;
+    while (filled < buffer.size()) {
+      const std::span<uint32_t> popped = queue_.Pop(
+          std::span(entries).first(std::min(entries.size(),
+                                            buffer.size() - filled)));
+      if (popped.empty()) {
+        break;
+      }
+      for (uint32_t entry : popped) {
+        const uint32_t delta = entry >> 8;
+        // Saturated gaps round up to now_us, which later deltas would carry
+        // into the future.
+        consumer_last_us_ =
+            delta == kMaxDelta ? now_us
+                               : std::min(consumer_last_us_ + delta, now_us);
+        buffer[filled++] = {
+            .time_us = consumer_last_us_,
+            .byte = static_cast<char>(entry & 0xFF),
+        };
+      }
+    }
+    return buffer.first(filled);
+  }
+
+  // Consumer side.
+  std::size_t Size() const { return queue_.Size(); }
+
+ private:
+  SpscQueue<uint32_t, kCapacity> queue_;
+  // Producer side.
+  uint32_t producer_last_us_;
+  // Consumer side.
+  uint64_t consumer_last_us_;
+};
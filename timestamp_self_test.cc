@@ -0,0 +1,94 @@
+#include "timestamp_self_test.h"
+
+#include <fmt/core.h>
+#include <pico/time.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace {
+constexpr int kSamples = 256;
+// Several character times at the default rate, so bytes never queue up behind
+// each other.
+constexpr uint64_t kIntervalUs = 2000;
+// How long to wait for the last bytes after sending.
+constexpr uint64_t kTimeoutUs = 100'000;
+
+struct Summary {
+  int64_t min = std::numeric_limits<int64_t>::max();
+  int64_t max = std::numeric_limits<int64_t>::min();
+  int64_t sum = 0;
+  int count = 0;
+
+  void Add(int64_t value) {
+    min = std::min(min, value);
+    max = std::max(max, value);
+    sum += value;
+    ++count;
+  }
+};
+}  // namespace
+
+void RunTimestampSelfTest(SerialPort& generator, SerialPort& receiver,
+                          int baud_rate, std::ostream& out) {
+  if (!receiver.HasRxTimestamps()) {
+    out << "Receiver does not timestamp bytes." << std::endl;
+    return;
+  }
+  // Discard anything left over from before the test.
+  std::array<TimestampedByte, 64> discard;
+  while (!receiver.ReadTimestamped(discard).empty()) {
+  }
+
+  std::array<uint64_t, kSamples> sent;
+  std::array<TimestampedByte, kSamples> received;
+  std::size_t received_count = 0;
+  const auto receive = [&] {
+    received_count +=
+        receiver.ReadTimestamped(std::span(received).subspan(received_count))
+            .size();
+  };
+  uint64_t next = time_us_64() + kIntervalUs;
+  for (int i = 0; i < kSamples; ++i) {
+    while (time_us_64() < next) {
+    }
+    const char byte = i;
+    sent[i] = time_us_64();
+    generator.Write(std::span(&byte, 1));
+    generator.Flush();
+    next += kIntervalUs;
+    receive();
+  }
+  const uint64_t deadline = time_us_64() + kTimeoutUs;
+  while (received_count < kSamples && time_us_64() < deadline) {
+    receive();
+  }
+  if (received_count < kSamples) {
+    out << fmt::format(
+               "Received {} of {} bytes; is the generator's TX wired to the "
+               "receiver's RX?",
+               received_count, kSamples)
+        << std::endl;
+    return;
+  }
+
+  // The receiver timestamps a byte once its stop bit is in.
+  const int64_t character_us = 10'000'000 / baud_rate;
+  Summary latency;
+  for (int i = 0; i < kSamples; ++i) {
+    if (received[i].byte != static_cast<char>(i)) {
+      out << fmt::format("Byte {} was corrupted or lost.", i) << std::endl;
+      return;
+    }
+    latency.Add(static_cast<int64_t>(received[i].time_us - sent[i]) -
+                character_us);
+  }
+  out << fmt::format(
+             "RX timestamp latency over {} bytes: min={}us mean={}us max={}us "
+             "jitter={}us",
+             latency.count, latency.min, latency.sum / latency.count,
+             latency.max, latency.max - latency.min)
+      << std::endl;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <ostream>
+
+#include "serial_port.h"
+
+// Measures the accuracy of a port's RX timestamps against a generator port
+// wired to it: sends single bytes at a fixed interval, and compares each
+// byte's timestamp with when it was sent plus one character time. Blocks until
+// done, and must run while nothing else is using either port.
+//
+// Prints the minimum, mean and maximum timestamp latency; the spread between
+// minimum and maximum is the jitter. The latency includes the generator's
+// own transmit latency, so it is an upper bound on the receiver's.
+void RunTimestampSelfTest(SerialPort& generator, SerialPort& receiver,
+                          int baud_rate, std::ostream& out);
@@ -0,0 +1,115 @@
+#include "trigger.h"
+
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "logging.h"
+
+CaptureTrigger::CaptureTrigger(FileSystem& fs, CaptureRecorder& capture)
+    : fs_(fs),
+      capture_(capture),
+      history_(std::make_unique<std::array<HistoryEntry, kPreTriggerBytes>>()) {
+  Load();
+}
+
+void CaptureTrigger::Load() {
+  // Whatever was held back under the old patterns is kept.
+  FlushHistory();
+  dfa_.reset();
+  states_ = {};
+  post_remaining_ = 0;
+  std::string text;
+  try {
+    text = fs_.OpenFile(kPath, {.read = true, .open_existing = true})
+               .ReadAll();
+  } catch (const std::filesystem::filesystem_error&) {
+    Log("No trigger patterns; capturing everything.");
+    return;
+  }
+  try {
+    const std::vector<BytePattern> patterns = ParsePatterns(text);
+    dfa_.emplace(patterns);
+    Log("Loaded {} trigger patterns ({} states).", patterns.size(),
+        dfa_->StateCount());
+  } catch (const std::exception& e) {
+    Log("Ignoring {}: {}", kPath, e.what());
+  }
+}
+
+void CaptureTrigger::Record(int channel, CaptureDirection direction,
+                            std::span<const char> data, uint64_t time_us) {
+  if (!dfa_) {
+    capture_.Record(channel, direction, data, time_us);
+    return;
+  }
+  TriggerDfa::State& state =
+      states_[channel][direction == CaptureDirection::kUartToUsb];
+  // Start of the bytes currently going straight to the capture.
+  std::size_t live_start = 0;
+  bool live = post_remaining_ > 0;
+  for (std::size_t i = 0; i < data.size(); ++i) {
+    state = dfa_->Step(state, static_cast<uint8_t>(data[i]));
+    if (live) {
+      --post_remaining_;
+    } else {
+      RecordHistory({
+          .time_us = time_us,
+          .channel = static_cast<uint8_t>(channel),
+          .direction = direction,
+          .byte = data[i],
+      });
+    }
+    if (dfa_->Accepting(state)) {
+      Stats::Global().channels[channel].capture_triggers.Add();
+      if (!live) {
+        FlushHistory();
+        live = true;
+        live_start = i + 1;
+      }
+      post_remaining_ = kPostTriggerBytes;
+    } else if (live && post_remaining_ == 0) {
+      capture_.Record(channel, direction,
+                      data.subspan(live_start, i + 1 - live_start), time_us);
+      live = false;
+    }
+  }
+  if (live && live_start < data.size()) {
+    capture_.Record(channel, direction, data.subspan(live_start), time_us);
+  }
+}
+
+void CaptureTrigger::RecordHistory(const HistoryEntry& entry) {
+  (*history_)[history_end_++ % kPreTriggerBytes] = entry;
+  if (history_end_ - history_start_ > kPreTriggerBytes) {
+    ++history_start_;
+  }
+}
+
+void CaptureTrigger::FlushHistory() {
+  // Consecutive bytes from the same stream become one record, dated by the
+  // first of them.
+  std::array<char, 64> run;
+  std::size_t run_size = 0;
+  const HistoryEntry* run_first = nullptr;
+  for (std::size_t i = history_start_; i <= history_end_; ++i) {
+    const HistoryEntry* entry =
+        i < history_end_ ? &(*history_)[i % kPreTriggerBytes] : nullptr;
+    if (run_size > 0 &&
+        (entry == nullptr || entry->channel != run_first->channel ||
+         entry->direction != run_first->direction || run_size == run.size())) {
+      capture_.Record(run_first->channel, run_first->direction,
+                      std::span(run).first(run_size), run_first->time_us);
+      run_size = 0;
+    }
+    if (entry == nullptr) {
+      break;
+    }
+    if (run_size == 0) {
+      run_first = entry;
+    }
+    run[run_size++] = entry->byte;
+  }
+  history_start_ = history_end_;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+
+#include "capture.h"
+#include "capture_format.h"
+#include "capture_sink.h"
+#include "fs.h"
+#include "stats.h"
+#include "trigger_dfa.h"
+
+// Narrows capturing down to the traffic around pattern matches. Bytes are
+// held in a pre-trigger window until a match, at which point the window and
+// everything up to kPostTriggerBytes after the match go to the capture. A
+// further match during the post-trigger window extends it.
+//
+// Patterns are read from kPath on the volume (see ParsePatterns()). Without
+// that file, or if it is malformed, everything is captured.
+class CaptureTrigger : public CaptureSink {
+ public:
+  static constexpr char kPath[] = "/TRIGGERS.TXT";
+  static constexpr std::size_t kPreTriggerBytes = 512;
+  static constexpr std::size_t kPostTriggerBytes = 4096;
+
+  CaptureTrigger(FileSystem& fs, CaptureRecorder& capture);
+
+  // Reads the patterns again, e.g. after the host modified the volume.
+  void Load();
+
+  void Record(int channel, CaptureDirection direction,
+              std::span<const char> data, uint64_t time_us) override;
+
+ private:
+  struct HistoryEntry {
+    uint64_t time_us;
+    uint8_t channel;
+    CaptureDirection direction;
+    char byte;
+  };
+
+  void RecordHistory(const HistoryEntry& entry);
+
+  // Sends the pre-trigger window to the capture and empties it.
+  void FlushHistory();
+
+  FileSystem& fs_;
+  CaptureRecorder& capture_;
+  std::optional<TriggerDfa> dfa_;
+  // Matching state of each channel's traffic in each direction.
+  std::array<std::array<TriggerDfa::State, 2>, Stats::kChannels> states_ = {};
+
+  std::unique_ptr<std::array<HistoryEntry, kPreTriggerBytes>> history_;
+  // Entries ever added, and the count at the last flush.
+  std::size_t history_end_ = 0;
+  std::size_t history_start_ = 0;
+  std::size_t post_remaining_ = 0;
+};
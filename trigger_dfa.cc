@@ -0,0 +1,158 @@
+#include "trigger_dfa.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <charconv>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+BytePattern ParseLine(std::string_view line, int line_number) {
+  BytePattern pattern;
+  std::size_t i = 0;
+  while (true) {
+    while (i < line.size() && IsSpace(line[i])) {
+      ++i;
+    }
+    if (i == line.size()) {
+      return pattern;
+    }
+    if (line[i] == '"') {
+      const std::size_t end = line.find('"', i + 1);
+      if (end == std::string_view::npos) {
+        throw std::invalid_argument(
+            fmt::format("Unterminated string on pattern line {}", line_number));
+      }
+      for (char c : line.substr(i + 1, end - i - 1)) {
+        pattern.push_back(static_cast<uint8_t>(c));
+      }
+      i = end + 1;
+      continue;
+    }
+    const std::string_view token = line.substr(i, 2);
+    i += 2;
+    if (token == "??") {
+      pattern.push_back(std::nullopt);
+      continue;
+    }
+    uint8_t value;
+    const std::from_chars_result result =
+        std::from_chars(token.data(), token.data() + token.size(), value, 16);
+    if (token.size() != 2 || result.ptr != token.data() + token.size() ||
+        (i < line.size() && !IsSpace(line[i]))) {
+      throw std::invalid_argument(fmt::format(
+          "Expected a hex byte, ?? or string on pattern line {}", line_number));
+    }
+    pattern.push_back(value);
+  }
+}
+}  // namespace
+
+std::vector<BytePattern> ParsePatterns(std::string_view text) {
+  std::vector<BytePattern> patterns;
+  int line_number = 0;
+  while (!text.empty()) {
+    const std::size_t end = std::min(text.find('\n'), text.size());
+    const std::string_view line = text.substr(0, end);
+    text.remove_prefix(std::min(end + 1, text.size()));
+    ++line_number;
+    const std::size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos || line[first] == '#') {
+      continue;
+    }
+    patterns.push_back(ParseLine(line, line_number));
+  }
+  return patterns;
+}
+
+TriggerDfa::TriggerDfa(std::span<const BytePattern> patterns) {
+  if (patterns.empty()) {
+    throw std::invalid_argument("No trigger patterns");
+  }
+  // Flatten the patterns into one list of positions. A set of positions
+  // waiting for their element is an automaton state.
+  std::vector<std::optional<uint8_t>> elements;
+  std::vector<bool> last;
+  std::vector<int> starts;
+  for (const BytePattern& pattern : patterns) {
+    if (pattern.empty()) {
+      throw std::invalid_argument("Empty trigger pattern");
+    }
+    starts.push_back(elements.size());
+    for (std::size_t i = 0; i < pattern.size(); ++i) {
+      elements.push_back(pattern[i]);
+      last.push_back(i + 1 == pattern.size());
+    }
+  }
+
+  // Class 0 is every byte that no pattern names literally.
+  std::vector<uint8_t> representatives = {0};
+  for (const std::optional<uint8_t>& element : elements) {
+    if (element && classes_[*element] == 0) {
+      classes_[*element] = representatives.size();
+      representatives.push_back(*element);
+    }
+  }
+  // Pick a byte that really is in class 0, if there is one.
+  for (int byte = 0; byte < 256; ++byte) {
+    if (classes_[byte] == 0) {
+      representatives[0] = byte;
+      break;
+    }
+  }
+  class_count_ = representatives.size();
+
+  // Every state keeps the pattern starts, since a match can begin anywhere.
+  // The accepting flag is part of the key, as the last element of the set.
+  using Key = std::vector<int>;
+  std::map<Key, State> ids;
+  std::vector<Key> keys;
+  auto intern = [&](Key key) {
+    const auto [it, inserted] = ids.try_emplace(key, keys.size());
+    if (inserted) {
+      const std::size_t table_bytes =
+          (keys.size() + 1) * class_count_ * sizeof(State);
+      if (table_bytes > kMaxTableBytes) {
+        throw std::length_error(fmt::format(
+            "Trigger patterns need more than {} automaton states with {} byte "
+            "classes, which is over {} bytes",
+            keys.size(), class_count_, kMaxTableBytes));
+      }
+      keys.push_back(std::move(key));
+    }
+    return it->second;
+  };
+  Key start = starts;
+  start.push_back(0);
+  intern(start);
+
+  for (std::size_t state = 0; state < keys.size(); ++state) {
+    for (uint8_t byte : representatives) {
+      Key next = starts;
+      bool accepting = false;
+      const Key& current = keys[state];
+      for (auto it = current.begin(); it + 1 != current.end(); ++it) {
+        const int position = *it;
+        if (elements[position] && *elements[position] != byte) {
+          continue;
+        }
+        if (last[position]) {
+          accepting = true;
+        } else {
+          next.push_back(position + 1);
+        }
+      }
+      std::ranges::sort(next);
+      next.erase(std::unique(next.begin(), next.end()), next.end());
+      next.push_back(accepting);
+      transitions_.push_back(intern(std::move(next)));
+    }
+  }
+  for (const Key& key : keys) {
+    accepting_.push_back(key.back());
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// A sequence of bytes to look for; nullopt elements match any byte.
+using BytePattern = std::vector<std::optional<uint8_t>>;
+
+// Parses one pattern per line. Each line is a sequence of tokens separated by
+// whitespace: two hex digits for a byte, ?? for any byte, or a double-quoted
+// string (without escapes) for its bytes. Blank lines and lines starting with
+// # are skipped. Throws std::invalid_argument on malformed input.
+std::vector<BytePattern> ParsePatterns(std::string_view text);
+
+// Deterministic automaton that finds occurrences of any of a set of patterns
+// anywhere in a byte stream, at one table lookup per byte.
+//
+// Built by subset construction over the patterns' positions. Bytes that don't
+// appear literally in any pattern are indistinguishable to it, so the table is
+// indexed by byte class rather than byte to keep it small.
+class TriggerDfa {
+ public:
+  using State = uint16_t;
+
+  static constexpr State kStart = 0;
+  // Bounds the transition table, which takes StateCount() times the number
+  // of byte classes times sizeof(State) bytes. Wildcard-heavy pattern sets can
+  // need many states, and many literal bytes make each one larger.
+  static constexpr std::size_t kMaxTableBytes = 32 * 1024;
+
+  // Throws std::invalid_argument if there are no patterns or one is empty,
+  // and std::length_error if the table would exceed kMaxTableBytes.
+  explicit TriggerDfa(std::span<const BytePattern> patterns);
+
+  State Step(State state, uint8_t byte) const {
+    return transitions_[state * class_count_ + classes_[byte]];
+  }
+
+  // Whether the byte that led to this state completed a match.
+  bool Accepting(State state) const { return accepting_[state]; }
+
+  std::size_t StateCount() const { return accepting_.size(); }
+
+ private:
+  // Up to 256 literal bytes plus class 0.
+  std::array<uint16_t, 256> classes_ = {};
+  std::size_t class_count_;
+  std::vector<State> transitions_;
+  std::vector<uint8_t> accepting_;
+};
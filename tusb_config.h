@@ -8,7 +8,11 @@ extern "C" {
 #define CFG_TUSB_DEBUG 1
 #define CFG_TUD_ENABLED 1
   
-#define CFG_TUD_CDC 2
+// Bridged serial channels, each with its own CDC interface. One more CDC
+// interface carries the debug console.
+#define RS232_DATA_CHANNELS 4
+
+#define CFG_TUD_CDC (1 + RS232_DATA_CHANNELS)
 #define CFG_TUD_CDC_RX_BUFSIZE 64
 #define CFG_TUD_CDC_TX_BUFSIZE 64
 
@@ -0,0 +1,208 @@
+#include "uart.h"
+
+#include <hardware/irq.h>
+#include <hardware/uart.h>
+#include <pico/time.h>
+
+#include <algorithm>
+#include <array>
+
+namespace {
+// Indexed by UART number; used to route the RX interrupts in timestamped mode.
+std::array<Uart*, NUM_UARTS> g_timestamped_uarts = {};
+
+unsigned RxIrq(uart_inst_t& uart) {
+  return uart_get_index(&uart) == 0 ? UART0_IRQ : UART1_IRQ;
+}
+}  // namespace
+
+Uart::Uart(uart_inst_t& uart, int baud_rate, ChannelStats& stats,
+           FlowControl flow_control, RxMode rx_mode)
+    : uart_(uart), stats_(stats), flow_control_(flow_control) {
+  uart_init(&uart_, baud_rate);
+  if (flow_control_ == FlowControl::kHardware) {
+    uart_set_hw_flow(&uart_, /*cts=*/true, /*rts=*/false);
+    // Assert RTS; the control bit is the complement of the nUARTRTS output.
+    hw_set_bits(&uart_get_hw(&uart_)->cr, UART_UARTCR_RTS_BITS);
+  }
+  uart_hw_t& hw = *uart_get_hw(&uart_);
+  const bool timestamped = rx_mode == RxMode::kTimestamped;
+  stream_ = std::make_unique<DmaStream>(
+      timestamped ? nullptr : &hw.dr, uart_get_dreq(&uart_, false), &hw.dr,
+      uart_get_dreq(&uart_, true));
+  if (timestamped) {
+    timestamps_ = std::make_unique<TimestampQueue>(time_us_64());
+    // One interrupt per byte, rather than per FIFO threshold or timeout.
+    uart_set_fifo_enabled(&uart_, false);
+    g_timestamped_uarts[uart_get_index(&uart_)] = this;
+    irq_set_exclusive_handler(RxIrq(uart_), &Uart::HandleRxIrq);
+    irq_set_enabled(RxIrq(uart_), true);
+    uart_set_irq_enables(&uart_, /*rx_has_data=*/true, /*tx_needs_data=*/false);
+  }
+}
+
+Uart::~Uart() {
+  if (timestamps_) {
+    uart_set_irq_enables(&uart_, false, false);
+    irq_set_enabled(RxIrq(uart_), false);
+    irq_remove_handler(RxIrq(uart_), &Uart::HandleRxIrq);
+    g_timestamped_uarts[uart_get_index(&uart_)] = nullptr;
+  }
+  stream_.reset();
+  uart_deinit(&uart_);
+}
+
+void Uart::SetConfig(const UartConfig& config) {
+  pending_config_ = config;
+  ApplyPendingConfig();
+}
+
+void Uart::ApplyPendingConfig() {
+  if (!pending_config_ || !stream_->TxIdle() ||
+      (uart_get_hw(&uart_)->fr & UART_UARTFR_BUSY_BITS)) {
+    return;
+  }
+  const UartConfig& config = *pending_config_;
+  uart_set_baudrate(&uart_, config.baud_rate);
+  uart_parity_t parity = UART_PARITY_NONE;
+  if (config.parity == UartConfig::Parity::kOdd) {
+    parity = UART_PARITY_ODD;
+  } else if (config.parity == UartConfig::Parity::kEven) {
+    parity = UART_PARITY_EVEN;
+  }
+  uart_set_format(&uart_, config.data_bits, config.stop_bits, parity);
+  pending_config_.reset();
+}
+
+std::span<char> Uart::Read(std::span<char> buffer) {
+  if (timestamps_) {
+    // Discard the timestamps.
+    std::array<TimestampedByte, 64> entries;
+    std::size_t filled = 0;
+    while (filled < buffer.size()) {
+      const std::span<TimestampedByte> read = ReadTimestamped(
+          std::span(entries).first(
+              std::min(entries.size(), buffer.size() - filled)));
+      if (read.empty()) {
+        break;
+      }
+      for (const TimestampedByte& entry : read) {
+        buffer[filled++] = entry.byte;
+      }
+    }
+    return buffer.first(filled);
+  }
+  BeginRead();
+  const std::span<char> data = stream_->Read(buffer);
+  stats_.rx_ring_overruns.Set(stream_->RxOverruns());
+  UpdateRxFlow();
+  return data;
+}
+
+std::span<TimestampedByte> Uart::ReadTimestamped(
+    std::span<TimestampedByte> buffer) {
+  if (!timestamps_) {
+    return buffer.first(0);
+  }
+  BeginRead();
+  const std::span<TimestampedByte> data =
+      timestamps_->Pop(buffer, time_us_64());
+  UpdateRxFlow();
+  return data;
+}
+
+void Uart::BeginRead() {
+  ApplyPendingConfig();
+  PollErrors();
+  stats_.rx_ring_high_water.RecordMax(RxSize());
+}
+
+std::size_t Uart::RxSize() {
+  return timestamps_ ? timestamps_->Size() : stream_->RxSize();
+}
+
+void Uart::HandleRxIrq() {
+  for (Uart* uart : g_timestamped_uarts) {
+    if (uart != nullptr) {
+      uart->ServiceRxIrq();
+    }
+  }
+}
+
+void Uart::ServiceRxIrq() {
+  uart_hw_t& hw = *uart_get_hw(&uart_);
+  while (!(hw.fr & UART_UARTFR_RXFE_BITS)) {
+    // Taken before anything else so the timestamp is as close to the byte's
+    // arrival as possible.
+    const uint32_t now = time_us_32();
+    const char byte = hw.dr;
+    if (!timestamps_->Push(byte, now)) {
+      // Only the interrupt writes this counter in timestamped mode.
+      stats_.rx_ring_overruns.Add();
+    }
+  }
+}
+
+int Uart::Write(std::span<const char> data) {
+  const int written = stream_->Write(data);
+  stats_.tx_ring_high_water.RecordMax(stream_->TxSize());
+  return written;
+}
+
+void Uart::UpdateRxFlow() {
+  const std::size_t level = RxSize();
+  bool stop;
+  if (!rx_stopped_ && level >= kRxStopLevel) {
+    stop = true;
+    stats_.rx_flow_stops.Add();
+  } else if (rx_stopped_ && level <= kRxResumeLevel) {
+    stop = false;
+  } else {
+    return;
+  }
+  rx_stopped_ = stop;
+  switch (flow_control_) {
+    case FlowControl::kNone:
+      break;
+    case FlowControl::kHardware:
+      if (stop) {
+        hw_clear_bits(&uart_get_hw(&uart_)->cr, UART_UARTCR_RTS_BITS);
+      } else {
+        hw_set_bits(&uart_get_hw(&uart_)->cr, UART_UARTCR_RTS_BITS);
+      }
+      break;
+    case FlowControl::kSoftware:
+      SendImmediate(stop ? kXoff : kXon);
+      break;
+  }
+}
+
+void Uart::SendImmediate(char c) {
+  // Goes straight into the FIFO alongside the TX DMA's writes, so it only
+  // waits behind what is already in the FIFO rather than the whole ring.
+  while (!uart_is_writable(&uart_)) {
+  }
+  uart_get_hw(&uart_)->dr = c;
+}
+
+void Uart::PollErrors() {
+  uart_hw_t& hw = *uart_get_hw(&uart_);
+  const uint32_t errors = hw.rsr;
+  if (errors == 0) {
+    return;
+  }
+  // Any write clears all the flags.
+  hw.rsr = 0;
+  if (errors & UART_UARTRSR_OE_BITS) {
+    stats_.uart_overrun_errors.Add();
+  }
+  if (errors & UART_UARTRSR_BE_BITS) {
+    stats_.uart_break_errors.Add();
+  }
+  if (errors & UART_UARTRSR_PE_BITS) {
+    stats_.uart_parity_errors.Add();
+  }
+  if (errors & UART_UARTRSR_FE_BITS) {
+    stats_.uart_framing_errors.Add();
+  }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <hardware/uart.h>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+
+#include "dma_stream.h"
+#include "serial_port.h"
+#include "stats.h"
+#include "timestamp_ring.h"
+
+// Hardware UART whose receive and transmit paths are serviced by DMA (see
+// DmaStream). The hardware FIFO is only 32 bytes deep; with DMA draining it,
+// the main loop can stall for as long as it takes to fill the RX ring without
+// losing data.
+//
+// Alternatively, received bytes can be taken one at a time by an interrupt
+// handler that timestamps each as it arrives, for protocols where the gaps
+// between bytes matter (e.g. Modbus RTU frame boundaries).
+class Uart : public SerialPort {
+ public:
+  // Receive flow is stopped when the RX ring is this full, and resumed once it
+  // drains to the lower level. The headroom above the stop level absorbs the
+  // far end's reaction time plus a main loop stall.
+  static constexpr std::size_t kRxStopLevel = DmaStream::kRxRingSize / 2;
+  static constexpr std::size_t kRxResumeLevel = DmaStream::kRxRingSize / 4;
+
+  static constexpr char kXon = 0x11;
+  static constexpr char kXoff = 0x13;
+
+  enum class RxMode {
+    // RX DMA into a byte ring.
+    kDma,
+    // The hardware FIFO is disabled and the RX interrupt timestamps every byte
+    // with the 32-bit timer on arrival, accurate to the interrupt latency (a
+    // few us). Interrupts are masked during flash erases, so bytes arriving
+    // then are lost to UART overruns unless flow control holds them off.
+    kTimestamped,
+  };
+
+  // Initializes the UART and claims two DMA channels for it, or one in
+  // timestamped mode.
+  //
+  // With hardware flow control, CTS gates transmission directly in the
+  // peripheral. RTS is driven from the RX ring level rather than by the
+  // peripheral, since the DMA keeps the hardware FIFO empty.
+  Uart(uart_inst_t& uart, int baud_rate, ChannelStats& stats,
+       FlowControl flow_control = FlowControl::kNone,
+       RxMode rx_mode = RxMode::kDma);
+  ~Uart();
+
+  Uart(const Uart&) = delete;
+  Uart& operator=(const Uart&) = delete;
+
+  std::span<char> Read(std::span<char> buffer) override;
+
+  bool HasRxTimestamps() override { return timestamps_ != nullptr; }
+
+  std::span<TimestampedByte> ReadTimestamped(
+      std::span<TimestampedByte> buffer) override;
+
+  // Number of bytes that can currently be queued for transmission. Zero while
+  // a config change is waiting for queued data to go out.
+  int WriteAvailable() override {
+    return pending_config_ ? 0 : stream_->WriteAvailable();
+  }
+
+  // Queues data for transmission. Returns the number of bytes actually queued.
+  int Write(std::span<const char> data) override;
+
+  // Takes effect once everything already queued has been transmitted with the
+  // old settings, so no byte goes out half at one rate and half at another.
+  void SetConfig(const UartConfig& config) override;
+
+  // Number of received bytes lost because the RX ring was full.
+  uint32_t RxOverruns() {
+    return timestamps_ ? stats_.rx_ring_overruns.Get() : stream_->RxOverruns();
+  }
+
+ private:
+  using TimestampQueue = TimestampRing<DmaStream::kRxRingSize>;
+
+  static void HandleRxIrq();
+
+  // Moves received bytes from the UART into the timestamp ring.
+  void ServiceRxIrq();
+
+  // Number of received bytes not yet read.
+  std::size_t RxSize();
+
+  // Common work before taking received data.
+  void BeginRead();
+
+  // Applies the pending config if the transmitter has gone idle.
+  void ApplyPendingConfig();
+
+  // Stops or resumes the far end's transmission based on the RX ring level.
+  void UpdateRxFlow();
+
+  // Sends a flow control character ahead of any queued data.
+  void SendImmediate(char c);
+
+  // Counts and clears the receive error flags.
+  void PollErrors();
+
+  uart_inst_t& uart_;
+  ChannelStats& stats_;
+  const FlowControl flow_control_;
+  // Created once the UART is initialized.
+  std::unique_ptr<DmaStream> stream_;
+  // Only in timestamped mode; filled by the RX interrupt.
+  std::unique_ptr<TimestampQueue> timestamps_;
+
+  std::optional<UartConfig> pending_config_;
+  // Whether the far end has been told to stop sending.
+  bool rx_stopped_ = false;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+// UART line settings, and their mapping from USB CDC line coding and onto the
+// RP2040 UART (PL011) registers. Kept free of SDK dependencies so that the
+// arithmetic can be checked on a host.
+struct UartConfig {
+  enum class Parity : uint8_t {
+    kNone,
+    kOdd,
+    kEven,
+  };
+
+  uint32_t baud_rate = 115'200;
+  uint8_t data_bits = 8;
+  uint8_t stop_bits = 1;
+  Parity parity = Parity::kNone;
+
+  bool operator==(const UartConfig&) const = default;
+
+  // Maps CDC SET_LINE_CODING fields (USB CDC PSTN spec table 17). Returns
+  // nullopt for settings the UART can't produce: mark/space parity, 1.5 stop
+  // bits, 16 data bits, or a baud rate outside what the given UART reference
+  // clock can generate.
+  static constexpr std::optional<UartConfig> FromLineCoding(
+      uint32_t bit_rate, uint8_t stop_bits, uint8_t parity, uint8_t data_bits,
+      uint32_t clock_hz);
+};
+
+// How the UART tells the far end to pause sending.
+enum class FlowControl : uint8_t {
+  kNone,
+  // RTS/CTS handshake lines.
+  kHardware,
+  // XON/XOFF characters in the data stream.
+  kSoftware,
+};
+
+// PL011 baud rate divisor: a 16.6 fixed-point division of the reference clock
+// by 16 times the baud rate.
+struct BaudDivisor {
+  // Limit of the 16-bit integer part.
+  static constexpr uint32_t kMaxInteger = 0xFFFF;
+
+  uint32_t integer;
+  uint32_t fraction;
+
+  // Baud rate actually produced by this divisor.
+  constexpr uint32_t BaudRate(uint32_t clock_hz) const {
+    return static_cast<uint32_t>((uint64_t{4} * clock_hz) /
+                                 (64 * integer + fraction));
+  }
+
+  // Fastest and slowest rates the reference clock can generate.
+  static constexpr uint32_t MaxBaudRate(uint32_t clock_hz) {
+    return clock_hz / 16;
+  }
+  static constexpr uint32_t MinBaudRate(uint32_t clock_hz) {
+    return BaudDivisor{.integer = kMaxInteger, .fraction = 0}.BaudRate(
+        clock_hz);
+  }
+};
+
+constexpr std::optional<UartConfig> UartConfig::FromLineCoding(
+    uint32_t bit_rate, uint8_t stop_bits, uint8_t parity, uint8_t data_bits,
+    uint32_t clock_hz) {
+  UartConfig config;
+  if (bit_rate < BaudDivisor::MinBaudRate(clock_hz) ||
+      bit_rate > BaudDivisor::MaxBaudRate(clock_hz)) {
+    return std::nullopt;
+  }
+  config.baud_rate = bit_rate;
+  switch (stop_bits) {
+    case 0:
+      config.stop_bits = 1;
+      break;
+    case 2:
+      config.stop_bits = 2;
+      break;
+    default:
+      return std::nullopt;
+  }
+  switch (parity) {
+    case 0:
+      config.parity = Parity::kNone;
+      break;
+    case 1:
+      config.parity = Parity::kOdd;
+      break;
+    case 2:
+      config.parity = Parity::kEven;
+      break;
+    default:
+      return std::nullopt;
+  }
+  if (data_bits < 5 || data_bits > 8) {
+    return std::nullopt;
+  }
+  config.data_bits = data_bits;
+  return config;
+}
@@ -7,9 +7,17 @@
 #include <iostream>
 #include <iterator>
 #include <span>
+#include <stdexcept>
+
+#include "logging.h"
 
 namespace {
 UsbDevice* g_device;
+
+// The debug console is the first CDC interface added. Only it resets into the
+// bootloader on the 1200 baud touch, so that a terminal program opening a
+// data port at 1200 baud doesn't.
+constexpr uint8_t kConsoleCdc = 0;
 };  // namespace
 
 ///////////////////////
@@ -38,27 +46,24 @@ const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
 }
 
 void tud_cdc_line_coding_cb(uint8_t itf, const cdc_line_coding_t* coding) {
-  std::cout << fmt::format(
-                   "CDC{} line coding change: bit_rate={} stop_bits={} "
-                   "parity={} data_bits={}",
-                   itf, coding->bit_rate, coding->stop_bits, coding->parity,
-                   coding->data_bits)
-            << std::endl;
-  if (coding->bit_rate == 1200) {
+  Log("CDC{} line coding change: bit_rate={} stop_bits={} parity={} "
+      "data_bits={}",
+      itf, coding->bit_rate, coding->stop_bits, coding->parity,
+      coding->data_bits);
+  UsbDevice::Instance().Cdc(itf).SetLineCoding(*coding);
+  if (itf == kConsoleCdc && coding->bit_rate == 1200) {
+    // Nothing would drain the log after this.
     std::cout << "Resetting to bootloader." << std::endl;
     reset_usb_boot(0, 0);
   }
 }
 
 void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts) {
-  std::cout << fmt::format("CDC{} line state change: dtr={} rts={}", itf, dtr,
-                           rts)
-            << std::endl;
+  Log("CDC{} line state change: dtr={} rts={}", itf, dtr, rts);
 }
 
 void tud_cdc_send_break_cb(uint8_t itf, uint16_t duration_ms) {
-  std::cout << fmt::format("CDC{} break request: duration_ms=", duration_ms)
-            << std::endl;
+  Log("CDC{} break request: duration_ms={}", itf, duration_ms);
 }
 
 UsbDevice::UsbDevice()
@@ -91,6 +96,10 @@ UsbDevice::Interface UsbDevice::AddInterface() {
   const uint8_t interface_number = interface_count_++;
   // Endpoint 0 is reserved.
   const uint8_t out = interface_number + 1;
+  if (out >= kEndpointCount) {
+    throw std::length_error(
+        fmt::format("Out of USB endpoints for interface {}", interface_number));
+  }
   const uint8_t in = 0x80 | out;
   return {interface_number, out, in};
 }
@@ -144,6 +153,10 @@ std::vector<uint16_t> UsbDevice::StringDescriptor(uint8_t index) {
 }
 
 CdcDevice& UsbDevice::AddCdc(std::string_view name) {
+  if (cdc_.size() >= CFG_TUD_CDC) {
+    throw std::length_error(
+        fmt::format("CFG_TUD_CDC only allows {} CDC interfaces", CFG_TUD_CDC));
+  }
   const uint8_t string_index = AddString(name);
   const Interface control = AddInterface();
   const Interface data = AddInterface();
@@ -156,7 +169,7 @@ CdcDevice& UsbDevice::AddCdc(std::string_view name) {
   return *cdc_.emplace_back(std::make_unique<CdcDevice>(cdc_.size()));
 }
 
-MscDevice& UsbDevice::AddMsc(std::string_view name, FlashDisk& disk) {
+MscDevice& UsbDevice::AddMsc(std::string_view name, BlockDevice& disk) {
   const uint8_t string_index = AddString(name);
   const Interface data = AddInterface();
   // Interface number, string index, EP Out & EP In address, EP size
@@ -174,7 +187,10 @@ void UsbDevice::Install() {
   add_repeating_timer_ms(
       1,
       [](repeating_timer_t*) {
+        PROFILE_SCOPE("tud_task (timer)");
+        g_device->in_timer_task_ = true;
         tud_task();
+        g_device->in_timer_task_ = false;
         return true;
       },
       nullptr, &timer_);
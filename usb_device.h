@@ -12,9 +12,10 @@
 #include <utility>
 #include <vector>
 
+#include "block_device.h"
 #include "cdc_device.h"
-#include "flash.h"
 #include "msc_device.h"
+#include "profile.h"
 
 class UsbDevice {
  public:
@@ -29,7 +30,7 @@ class UsbDevice {
   void SetSerialNumber(std::string_view str);
 
   CdcDevice& AddCdc(std::string_view name);
-  MscDevice& AddMsc(std::string_view name, FlashDisk& disk);
+  MscDevice& AddMsc(std::string_view name, BlockDevice& disk);
 
   std::vector<uint8_t> DeviceDescriptor();
   std::vector<uint8_t> ConfigurationDescriptor();
@@ -38,14 +39,25 @@ class UsbDevice {
   // Register this device with the TinyUSB stack.
   void Install();
 
+  // Whether TinyUSB is being polled from the timer interrupt rather than the
+  // main loop. The storage stack belongs to the main loop, so MSC callbacks
+  // put off touching the disk until it polls.
+  bool InTimerTask() { return in_timer_task_; }
+
   static UsbDevice& Instance();
 
   CdcDevice& Cdc(uint8_t i) { return *cdc_[i]; }
   MscDevice& Msc(uint8_t i) { return *msc_[i]; }
 
-  void Task() { tud_task(); }
+  void Task() {
+    PROFILE_SCOPE("tud_task (loop)");
+    tud_task();
+  }
 
  private:
+  // Endpoint numbers available in each direction, including endpoint 0.
+  static constexpr int kEndpointCount = 16;
+
   struct Interface {
     uint8_t interface_number;
     uint8_t endpoint_out;
@@ -65,4 +77,5 @@ class UsbDevice {
   std::vector<std::unique_ptr<MscDevice>> msc_;
 
   repeating_timer_t timer_;
+  volatile bool in_timer_task_ = false;
 };